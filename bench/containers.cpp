@@ -0,0 +1,511 @@
+//
+//  containers.cpp
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+// microbenchmarks for the containers on the packet path. RUDP::List against std::list and std::deque
+// for push, pop, pushAfter, iteration, remove and inheritFrom. NodeStore secure/free from 1 to 8
+// threads against new/delete, once with a small object and once with RUDP::Packet. RUDP::Map against
+// std::unordered_map with RUDP::PeerKey keys for find, miss and remove+insert churn at several load
+// factors, the churn once more with pointer values. everything is reported in nanoseconds per operation,
+// lower is better.
+// g++ -std=c++11 -O2 -Isrc/public src/private/RUDP/*.cpp bench/containers.cpp -lpthread -o containerbench
+
+#include <RUDP/RUDP.h>
+#include <RUDP/list.h>
+#include <RUDP/map.h>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <list>
+#include <deque>
+#include <unordered_map>
+#include <stdio.h>
+#include <string.h>
+
+const size_t NumListItems = 100000;
+const size_t NumSplices = 1000000;
+const size_t NumStoreRounds = 100000;
+const size_t NumHeldPerRound = 16;
+const uint32_t MaxThreads = 8;
+const uint32_t MapCapacity = 1 << 16;
+const size_t NumMapOps = 1000000;
+
+struct BenchItem
+{
+    uint64_t m_value;
+    char m_pad[56];
+    
+    BenchItem() : m_value(0)
+    {
+        memset(m_pad, 0, sizeof(m_pad));
+    }
+};
+
+struct BenchEntry
+{
+    uint64_t m_value;
+    
+    BenchEntry(uint64_t value) : m_value(value) {}
+};
+
+struct PeerKeyHash
+{
+    size_t operator()(const RUDP::PeerKey &key) const
+    {
+        return (size_t)key.hash();
+    }
+};
+
+struct PeerKeyEquals
+{
+    bool operator()(const RUDP::PeerKey &a, const RUDP::PeerKey &b) const
+    {
+        return a.equals(&b);
+    }
+};
+
+typedef std::chrono::steady_clock BenchClock;
+
+// keeps the compiler from dropping loops whose results are otherwise unused
+static volatile uint64_t s_sink;
+
+static double NsPerOp(BenchClock::time_point begin, size_t numOps)
+{
+    return std::chrono::duration<double, std::nano>(BenchClock::now() - begin).count() / numOps;
+}
+
+static void PrintRow(const char *name, double a, double b, double c)
+{
+    printf("%-24s", name);
+    
+    double values[] = { a, b, c };
+    for (size_t i = 0; i < RUDP_ARRAYSIZE(values); i++)
+    {
+        if (values[i] < 0)
+        {
+            printf("  %12s", "-");
+        }
+        else
+        {
+            printf("  %12.2f", values[i]);
+        }
+    }
+    
+    printf("\n");
+}
+
+static void FillList(RUDP::List<BenchItem> *list, size_t num)
+{
+    BenchItem item;
+    for (size_t i = 0; i < num; i++)
+    {
+        item.m_value = i;
+        list->push(&item);
+    }
+}
+
+static void BenchLists()
+{
+    printf("\nlists, %u items of %u bytes, ns/op\n", (unsigned)NumListItems, (unsigned)sizeof(BenchItem));
+    printf("%-24s  %12s  %12s  %12s\n", "operation", "RUDP::List", "std::list", "std::deque");
+    
+    RUDP::List<BenchItem> list;
+    std::list<BenchItem> stdList;
+    std::deque<BenchItem> stdDeque;
+    BenchItem item;
+    uint64_t sum = 0;
+    double rudp, other, deque;
+    
+    BenchClock::time_point begin = BenchClock::now();
+    FillList(&list, NumListItems);
+    rudp = NsPerOp(begin, NumListItems);
+    
+    begin = BenchClock::now();
+    for (size_t i = 0; i < NumListItems; i++)
+    {
+        item.m_value = i;
+        stdList.push_back(item);
+    }
+    other = NsPerOp(begin, NumListItems);
+    
+    begin = BenchClock::now();
+    for (size_t i = 0; i < NumListItems; i++)
+    {
+        item.m_value = i;
+        stdDeque.push_back(item);
+    }
+    deque = NsPerOp(begin, NumListItems);
+    PrintRow("push", rudp, other, deque);
+    
+    // walking with next() checks the node belongs to the store on every step
+    begin = BenchClock::now();
+    for (BenchItem *it = list.peek(); it != NULL; it = list.next(it))
+    {
+        sum += it->m_value;
+    }
+    rudp = NsPerOp(begin, NumListItems);
+    
+    begin = BenchClock::now();
+    for (std::list<BenchItem>::iterator it = stdList.begin(); it != stdList.end(); ++it)
+    {
+        sum += it->m_value;
+    }
+    other = NsPerOp(begin, NumListItems);
+    
+    begin = BenchClock::now();
+    for (std::deque<BenchItem>::iterator it = stdDeque.begin(); it != stdDeque.end(); ++it)
+    {
+        sum += it->m_value;
+    }
+    deque = NsPerOp(begin, NumListItems);
+    PrintRow("iterate", rudp, other, deque);
+    
+    begin = BenchClock::now();
+    while (list.pop()) {}
+    rudp = NsPerOp(begin, NumListItems);
+    
+    begin = BenchClock::now();
+    while (!stdList.empty())
+    {
+        stdList.pop_front();
+    }
+    other = NsPerOp(begin, NumListItems);
+    
+    begin = BenchClock::now();
+    while (!stdDeque.empty())
+    {
+        stdDeque.pop_front();
+    }
+    deque = NsPerOp(begin, NumListItems);
+    PrintRow("pop", rudp, other, deque);
+    
+    // behind the head, where a deque only has to shift one element
+    item.m_value = 0;
+    list.push(&item);
+    stdList.push_back(item);
+    stdDeque.push_back(item);
+    
+    begin = BenchClock::now();
+    for (size_t i = 1; i < NumListItems; i++)
+    {
+        item.m_value = i;
+        list.pushAfter(list.peek(), &item);
+    }
+    rudp = NsPerOp(begin, NumListItems - 1);
+    
+    begin = BenchClock::now();
+    for (size_t i = 1; i < NumListItems; i++)
+    {
+        item.m_value = i;
+        stdList.insert(++stdList.begin(), item);
+    }
+    other = NsPerOp(begin, NumListItems - 1);
+    
+    begin = BenchClock::now();
+    for (size_t i = 1; i < NumListItems; i++)
+    {
+        item.m_value = i;
+        stdDeque.insert(stdDeque.begin() + 1, item);
+    }
+    deque = NsPerOp(begin, NumListItems - 1);
+    PrintRow("pushAfter", rudp, other, deque);
+    
+    // every other item while walking, the way acknowledged packets leave the ack queue.
+    // a deque would have to shift for each one, so it has no entry here
+    begin = BenchClock::now();
+    for (BenchItem *it = list.peek(); it != NULL;)
+    {
+        BenchItem *next = list.next(it);
+        if (it->m_value % 2 == 0)
+        {
+            list.remove(it);
+        }
+        
+        it = next;
+    }
+    rudp = NsPerOp(begin, NumListItems / 2);
+    
+    begin = BenchClock::now();
+    for (std::list<BenchItem>::iterator it = stdList.begin(); it != stdList.end();)
+    {
+        if (it->m_value % 2 == 0)
+        {
+            it = stdList.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    other = NsPerOp(begin, NumListItems / 2);
+    PrintRow("remove", rudp, other, -1);
+    
+    RUDP::List<BenchItem> spare;
+    std::list<BenchItem> stdSpare;
+    
+    begin = BenchClock::now();
+    for (size_t i = 0; i < NumSplices; i++)
+    {
+        spare.inheritFrom(&list);
+        sum += spare.peekEnd()->m_value;
+        list.inheritFrom(&spare);
+    }
+    rudp = NsPerOp(begin, NumSplices * 2);
+    
+    begin = BenchClock::now();
+    for (size_t i = 0; i < NumSplices; i++)
+    {
+        stdSpare.splice(stdSpare.end(), stdList);
+        sum += stdSpare.back().m_value;
+        stdList.splice(stdList.end(), stdSpare);
+    }
+    other = NsPerOp(begin, NumSplices * 2);
+    PrintRow("inheritFrom / splice", rudp, other, -1);
+    
+    s_sink = sum + stdDeque.size();
+}
+
+template <typename Type>
+static double RunNodeStore(uint32_t numThreads)
+{
+    std::vector<std::thread> threads;
+    std::atomic<bool> start(false);
+    
+    for (uint32_t t = 0; t < numThreads; t++)
+    {
+        threads.push_back(std::thread([&]()
+        {
+            RUDP::Node<Type> *held[NumHeldPerRound];
+            
+            while (!start.load())
+            {
+                std::this_thread::yield();
+            }
+            
+            for (size_t r = 0; r < NumStoreRounds; r++)
+            {
+                for (size_t i = 0; i < NumHeldPerRound; i++)
+                {
+                    held[i] = RUDP::NodeStore<Type>::secure();
+                }
+                
+                for (size_t i = 0; i < NumHeldPerRound; i++)
+                {
+                    RUDP::NodeStore<Type>::free(held[i]);
+                }
+            }
+        }));
+    }
+    
+    BenchClock::time_point begin = BenchClock::now();
+    start = true;
+    
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        threads[i].join();
+    }
+    
+    return NsPerOp(begin, numThreads * NumStoreRounds * NumHeldPerRound);
+}
+
+template <typename Type>
+static double RunHeap(uint32_t numThreads)
+{
+    std::vector<std::thread> threads;
+    std::atomic<bool> start(false);
+    
+    for (uint32_t t = 0; t < numThreads; t++)
+    {
+        threads.push_back(std::thread([&]()
+        {
+            Type *held[NumHeldPerRound];
+            
+            while (!start.load())
+            {
+                std::this_thread::yield();
+            }
+            
+            for (size_t r = 0; r < NumStoreRounds; r++)
+            {
+                for (size_t i = 0; i < NumHeldPerRound; i++)
+                {
+                    held[i] = new Type();
+                }
+                
+                for (size_t i = 0; i < NumHeldPerRound; i++)
+                {
+                    delete held[i];
+                }
+            }
+        }));
+    }
+    
+    BenchClock::time_point begin = BenchClock::now();
+    start = true;
+    
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        threads[i].join();
+    }
+    
+    return NsPerOp(begin, numThreads * NumStoreRounds * NumHeldPerRound);
+}
+
+static void BenchNodeStore()
+{
+    printf("\nsecure+free pairs over all threads, ns/pair\n");
+    printf("%7s  %14s  %14s  %14s  %14s\n", "threads", "store item", "new item", "store packet", "new packet");
+    
+    for (uint32_t numThreads = 1; numThreads <= MaxThreads; numThreads *= 2)
+    {
+        double storeItem = RunNodeStore<BenchItem>(numThreads);
+        double heapItem = RunHeap<BenchItem>(numThreads);
+        double storePacket = RunNodeStore<RUDP::Packet>(numThreads);
+        double heapPacket = RunHeap<RUDP::Packet>(numThreads);
+        printf("%7u  %14.2f  %14.2f  %14.2f  %14.2f\n", numThreads, storeItem, heapItem, storePacket, heapPacket);
+    }
+}
+
+static RUDP::PeerKey MakeKey(uint32_t i)
+{
+    sockaddr_storage storage = {};
+    sockaddr_in *addr = (sockaddr_in*)&storage;
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(10 << 24 | i >> 16);
+    addr->sin_port = htons((uint16_t)i);
+    
+    RUDP::PeerKey key;
+    key.set(&storage);
+    return key;
+}
+
+static void BenchMaps()
+{
+    printf("\nmaps keyed by RUDP::PeerKey, %u slots, ns/op\n", MapCapacity);
+    printf("%-6s  %-10s  %12s  %12s  %18s\n", "load", "operation", "RUDP::Map", "std", "std load factor");
+    
+    const double loads[] = { 0.25, 0.5, 0.75, 0.85 };
+    std::vector<RUDP::PeerKey> keys;
+    
+    for (size_t l = 0; l < RUDP_ARRAYSIZE(loads); l++)
+    {
+        uint32_t numEntries = (uint32_t)(MapCapacity * loads[l]);
+        
+        // sized so both keep the same entry count without growing, churn keeps it there
+        RUDP::Map<RUDP::PeerKey, BenchEntry> map(MapCapacity / 8 * 7);
+        std::unordered_map<RUDP::PeerKey, BenchEntry, PeerKeyHash, PeerKeyEquals> stdMap;
+        stdMap.max_load_factor(1.0f);
+        stdMap.reserve(MapCapacity);
+        
+        keys.clear();
+        for (uint32_t i = 0; i < numEntries + NumMapOps; i++)
+        {
+            keys.push_back(MakeKey(i));
+        }
+        
+        for (uint32_t i = 0; i < numEntries; i++)
+        {
+            map.insert(&keys[i], (uint64_t)i);
+            stdMap.insert(std::make_pair(keys[i], BenchEntry(i)));
+        }
+        
+        uint64_t sum = 0;
+        double rudp, other;
+        
+        BenchClock::time_point begin = BenchClock::now();
+        for (size_t i = 0; i < NumMapOps; i++)
+        {
+            sum += map.find(&keys[i % numEntries])->m_value;
+        }
+        rudp = NsPerOp(begin, NumMapOps);
+        
+        begin = BenchClock::now();
+        for (size_t i = 0; i < NumMapOps; i++)
+        {
+            sum += stdMap.find(keys[i % numEntries])->second.m_value;
+        }
+        other = NsPerOp(begin, NumMapOps);
+        printf("%-6.2f  %-10s  %12.2f  %12.2f  %18.2f\n", loads[l], "find", rudp, other, stdMap.load_factor());
+        
+        begin = BenchClock::now();
+        for (size_t i = 0; i < NumMapOps; i++)
+        {
+            sum += map.find(&keys[numEntries + i]) == NULL;
+        }
+        rudp = NsPerOp(begin, NumMapOps);
+        
+        begin = BenchClock::now();
+        for (size_t i = 0; i < NumMapOps; i++)
+        {
+            sum += stdMap.find(keys[numEntries + i]) == stdMap.end();
+        }
+        other = NsPerOp(begin, NumMapOps);
+        printf("%-6.2f  %-10s  %12.2f  %12.2f\n", loads[l], "miss", rudp, other);
+        
+        // the oldest key leaves and a new one comes in, like peers timing out and connecting
+        begin = BenchClock::now();
+        for (size_t i = 0; i < NumMapOps; i++)
+        {
+            map.remove(&keys[i]);
+            map.insert(&keys[numEntries + i], (uint64_t)i);
+        }
+        rudp = NsPerOp(begin, NumMapOps * 2);
+        
+        begin = BenchClock::now();
+        for (size_t i = 0; i < NumMapOps; i++)
+        {
+            stdMap.erase(keys[i]);
+            stdMap.insert(std::make_pair(keys[numEntries + i], BenchEntry(i)));
+        }
+        other = NsPerOp(begin, NumMapOps * 2);
+        printf("%-6.2f  %-10s  %12.2f  %12.2f\n", loads[l], "churn", rudp, other);
+        
+        // pointer values are kept in the slot, like the socket's ack index
+        RUDP::Map<RUDP::PeerKey, BenchEntry*> index(MapCapacity / 8 * 7);
+        std::unordered_map<RUDP::PeerKey, BenchEntry*, PeerKeyHash, PeerKeyEquals> stdIndex;
+        stdIndex.max_load_factor(1.0f);
+        stdIndex.reserve(MapCapacity);
+        std::vector<BenchEntry> entries(numEntries + NumMapOps, BenchEntry(0));
+        
+        for (uint32_t i = 0; i < numEntries; i++)
+        {
+            index.insert(&keys[i], &entries[i]);
+            stdIndex.insert(std::make_pair(keys[i], &entries[i]));
+        }
+        
+        begin = BenchClock::now();
+        for (size_t i = 0; i < NumMapOps; i++)
+        {
+            index.remove(&keys[i]);
+            index.insert(&keys[numEntries + i], &entries[numEntries + i]);
+        }
+        rudp = NsPerOp(begin, NumMapOps * 2);
+        
+        begin = BenchClock::now();
+        for (size_t i = 0; i < NumMapOps; i++)
+        {
+            stdIndex.erase(keys[i]);
+            stdIndex.insert(std::make_pair(keys[numEntries + i], &entries[numEntries + i]));
+        }
+        other = NsPerOp(begin, NumMapOps * 2);
+        printf("%-6.2f  %-10s  %12.2f  %12.2f\n", loads[l], "index", rudp, other);
+        
+        s_sink = sum + map.size() + stdMap.size() + index.size() + stdIndex.size();
+    }
+}
+
+int main()
+{
+    RUDP::NodeStore<BenchItem>::initialize(NumListItems * 2);
+    RUDP::NodeStore<RUDP::Packet>::initialize(MaxThreads * NumHeldPerRound);
+    
+    BenchLists();
+    BenchNodeStore();
+    BenchMaps();
+    
+    return 0;
+}
\ No newline at end of file
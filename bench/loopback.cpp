@@ -0,0 +1,1002 @@
+//
+//  loopback.cpp
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+// end to end benchmark over loopback. the throughput test streams messages from sender sockets to
+// receiver sockets for a fixed time and reports messages and payload bits per second together with
+// the one way delivery latency, the latency test bounces one message at a time between two sockets
+// and reports the round trip. every combination of message size, channel count, peer count, sender
+// thread count and delivery mode given on the command line is run once, one row each, as csv or json.
+//
+// peers: p peers are spread over ceil(sqrt(p)) sender sockets and as many receiver sockets as needed,
+// each sender socket holding one peer per receiver socket, so 10000 peers take 200 sockets.
+// threads: the sender sockets are split between the sender threads, each thread enqueues, flushes
+// and steps its own sockets. the main thread steps the receivers and polls their messages.
+// shards: each receiver socket hands its peers' packets to that many pipeline shards, 0 keeps them on
+// the main thread, so a sweep shows where the shard handoff starts to pay off.
+// link: with --link every socket runs over an EmulatedNetwork instead of udp, each row on a fresh one
+// seeded with --seed, so retransmits, goodput and pool use can be measured under loss, delay, reordering,
+// duplication and bandwidth limits. link_drops counts what the emulated link threw away.
+//
+// g++ -std=c++11 -O2 -Isrc/public src/private/RUDP/*.cpp bench/loopback.cpp -lpthread -o loopbackbench
+// ./loopbackbench --sizes 16,1024,65536 --peers 1,100 --threads 1,2 --format json
+// ./loopbackbench --modes reliable --link loss=0.02,delay=20000,jitter=5000,bandwidth=12500000
+// ./loopbackbench --tests throughput --sizes 256,4096 --peers 64 --threads 4 --shards 0,1,2,4,8
+
+#include <RUDP/RUDP.h>
+#include <RUDP/clock.h>
+#include <RUDP/histogram.h>
+#include <RUDP/emulator.h>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <map>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+const uint16_t BasePort = 6400;
+const uint64_t MaxWindowMessages = 8192;
+const uint32_t SendBurst = 64;
+const uint64_t UnreliableStallUs = 50000;
+const uint64_t DrainTimeoutUs = 5000000;
+const uint64_t RoundTripTimeoutUs = 200000;
+const uint64_t MaxMessageSize = (uint64_t)RUDP::MaxFragments * (RUDP::PacketSize - sizeof(RUDP::PacketHeader));
+
+struct Mode
+{
+    const char *m_name;
+    RUDP::EnqueueMessageOption m_options;
+};
+
+static const Mode Modes[] =
+{
+    { "unreliable", RUDP::EnqueueMessageOption_None },
+    { "unreliable_inorder", RUDP::EnqueueMessageOption_InOrder },
+    { "reliable", RUDP::EnqueueMessageOption_ConfirmDelivery },
+    { "reliable_inorder", (RUDP::EnqueueMessageOption)(RUDP::EnqueueMessageOption_ConfirmDelivery | RUDP::EnqueueMessageOption_InOrder) }
+};
+
+struct Config
+{
+    std::vector<uint64_t> m_sizes;
+    std::vector<uint64_t> m_channels;
+    std::vector<uint64_t> m_peers;
+    std::vector<uint64_t> m_threads;
+    std::vector<uint64_t> m_shards;
+    std::vector<const Mode*> m_modes;
+    bool m_runThroughput;
+    bool m_runLatency;
+    bool m_isJson;
+    double m_seconds;
+    bool m_isEmulated;
+    RUDP::LinkConditions m_link;
+    uint64_t m_seed;
+};
+
+struct Result
+{
+    const char *m_test;
+    const char *m_mode;
+    uint64_t m_size;
+    uint64_t m_channels;
+    uint64_t m_peers;
+    uint64_t m_threads;
+    uint64_t m_shards;
+    uint64_t m_sent;
+    uint64_t m_delivered;
+    uint64_t m_lost;
+    uint64_t m_retransmits;
+    uint64_t m_kernelDrops;
+    uint64_t m_linkDrops;
+    uint64_t m_peakPackets;
+    double m_seconds;
+    RUDP::HistogramSnapshot m_latency;
+};
+
+// set for the length of a row when running over the emulator
+static RUDP::EmulatedNetwork *Network = NULL;
+static std::map<RUDP::Socket*, RUDP::EmulatedTransport*> Transports;
+
+static bool IsReliable(const Mode *mode)
+{
+    return (mode->m_options & RUDP::EnqueueMessageOption_ConfirmDelivery) != 0;
+}
+
+static void WriteStamp(char *data, uint64_t value)
+{
+    memcpy(data, &value, sizeof(value));
+}
+
+static uint64_t ReadStamp(const char *data)
+{
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static void AddCounters(RUDP::Socket *sck, Result *result)
+{
+    RUDP::SocketCounters counters;
+    sck->getCounters(&counters);
+    result->m_retransmits += counters.m_traffic.get(RUDP::Counter_Retransmits);
+    result->m_kernelDrops += counters.m_traffic.get(RUDP::Counter_KernelDrops);
+}
+
+static void SamplePool(Result *result)
+{
+    uint64_t numPackets = RUDP::NodeStore<RUDP::Packet>::getNumSecured();
+    result->m_peakPackets = numPackets > result->m_peakPackets ? numPackets : result->m_peakPackets;
+}
+
+// the longest an emulated link holds a datagram back, added to the timeouts
+static uint64_t GetLinkDelay(const Config &config)
+{
+    if (!config.m_isEmulated)
+    {
+        return 0;
+    }
+    
+    return config.m_link.m_delayUs + config.m_link.m_jitterUs + config.m_link.m_reorderDelayUs;
+}
+
+static void OpenNetwork(const Config &config)
+{
+    if (config.m_isEmulated)
+    {
+        Network = new RUDP::EmulatedNetwork(config.m_seed);
+        Network->setDefaultConditions(config.m_link);
+    }
+}
+
+static void CloseNetwork(Result *result)
+{
+    if (Network)
+    {
+        RUDP::LinkStats stats;
+        Network->getStats(&stats);
+        result->m_linkDrops = stats.m_numLost + stats.m_numQueueDrops + stats.m_numOversized;
+        
+        delete Network;
+        Network = NULL;
+    }
+}
+
+static void DeleteSockets(std::vector<RUDP::Socket*> &sockets)
+{
+    for (size_t i = 0; i < sockets.size(); i++)
+    {
+        // the socket goes first, it uses its transport until then
+        std::map<RUDP::Socket*, RUDP::EmulatedTransport*>::iterator transport = Transports.find(sockets[i]);
+        delete sockets[i];
+        
+        if (transport != Transports.end())
+        {
+            delete transport->second;
+            Transports.erase(transport);
+        }
+    }
+    
+    sockets.clear();
+}
+
+static bool OpenSockets(std::vector<RUDP::Socket*> &sockets, size_t num, uint16_t firstPort)
+{
+    for (size_t i = 0; i < num; i++)
+    {
+        RUDP::Socket *sck = new RUDP::Socket();
+        sockets.push_back(sck);
+        
+        if (Network)
+        {
+            RUDP::EmulatedTransport *transport = new RUDP::EmulatedTransport(Network, 127 << 24 | 1, (uint16_t)(firstPort + i));
+            Transports[sck] = transport;
+            
+            if (!sck->open(transport))
+            {
+                return false;
+            }
+            
+            continue;
+        }
+        
+        if (!sck->open((uint16_t)(firstPort + i), 127 << 24 | 1))
+        {
+            return false;
+        }
+        
+        // linux caps this at net.core.rmem_max, raise that for the large sizes
+        sck->setBufferSizes(8 << 20, 8 << 20);
+    }
+    
+    return true;
+}
+
+struct SenderPeer
+{
+    RUDP::Peer *m_peer;
+    uint64_t m_numSent;
+};
+
+static bool RunThroughput(const Config &config, uint64_t size, uint64_t numChannels, uint64_t numPeers, uint64_t numThreads, uint64_t numShards, const Mode *mode, Result *result)
+{
+    size_t numSenders = (size_t)ceil(sqrt((double)numPeers));
+    size_t numReceivers = (size_t)((numPeers + numSenders - 1) / numSenders);
+    std::vector<RUDP::Socket*> senders;
+    std::vector<RUDP::Socket*> receivers;
+    
+    if (!OpenSockets(receivers, numReceivers, BasePort) || !OpenSockets(senders, numSenders, (uint16_t)(BasePort + numReceivers)))
+    {
+        DeleteSockets(senders);
+        DeleteSockets(receivers);
+        return false;
+    }
+    
+    for (size_t r = 0; r < receivers.size(); r++)
+    {
+        receivers[r]->setNumShards((uint32_t)numShards);
+    }
+    
+    // peer k goes from sender k % numSenders to receiver k / numSenders
+    std::vector<std::vector<SenderPeer> > peersOfSender(numSenders);
+    for (uint64_t k = 0; k < numPeers; k++)
+    {
+        SenderPeer target = { senders[k % numSenders]->getPeer(127 << 24 | 1, (uint16_t)(BasePort + k / numSenders)), 0 };
+        peersOfSender[k % numSenders].push_back(target);
+    }
+    
+    // the window keeps the pools from running dry, unreliable data that doesn't show up within
+    // UnreliableStallUs is written off so the senders can go on
+    uint64_t windowBytes = size * 2 > (1 << 20) ? size * 2 : (1 << 20);
+    uint64_t windowMessages = MaxWindowMessages;
+    std::atomic<uint64_t> sentBytes(0);
+    std::atomic<uint64_t> sentMessages(0);
+    std::atomic<uint64_t> settledBytes(0);
+    std::atomic<uint64_t> settledMessages(0);
+    std::atomic<bool> isSending(true);
+    std::atomic<uint32_t> numStarted(0);
+    std::vector<std::thread> threads;
+    
+    for (uint64_t t = 0; t < numThreads; t++)
+    {
+        threads.push_back(std::thread([&, t]()
+        {
+            std::vector<char> data(size, (char)t);
+            std::vector<size_t> own;
+            
+            for (size_t s = t; s < numSenders; s += numThreads)
+            {
+                own.push_back(s);
+            }
+            
+            numStarted++;
+            
+            while (isSending.load())
+            {
+                for (size_t o = 0; o < own.size() && isSending.load(); o++)
+                {
+                    std::vector<SenderPeer> &peers = peersOfSender[own[o]];
+                    
+                    for (size_t p = 0; p < peers.size(); p++)
+                    {
+                        SenderPeer &target = peers[p];
+                        
+                        // a burst per peer and one flush for it, like a sender with a backlog would
+                        for (uint32_t b = 0; b < SendBurst; b++)
+                        {
+                            int64_t inFlightBytes = (int64_t)(sentBytes.load() - settledBytes.load());
+                            int64_t inFlightMessages = (int64_t)(sentMessages.load() - settledMessages.load());
+                            
+                            if (inFlightBytes + (int64_t)size > (int64_t)windowBytes || inFlightMessages >= (int64_t)windowMessages)
+                            {
+                                break;
+                            }
+                            
+                            WriteStamp(&data[0], RUDP::Clock::now());
+                            
+                            RUDP::PeerMessage message = {};
+                            message.prepareForSending(&data[0], size, target.m_peer, (RUDP::ChannelId)(target.m_numSent % numChannels));
+                            
+                            if (target.m_peer->enqueueMessage(&message, mode->m_options) != RUDP::EnqueueMessageResult_Success)
+                            {
+                                break;
+                            }
+                            
+                            target.m_numSent++;
+                            sentBytes += size;
+                            sentMessages++;
+                        }
+                        
+                        target.m_peer->flushToSocket();
+                    }
+                    
+                    senders[own[o]]->step();
+                    senders[own[o]]->updatePeers();
+                }
+                
+                std::this_thread::yield();
+            }
+            
+            // keep answering acks and resending until the receiver has everything or gives up
+            while (numStarted.load() != 0)
+            {
+                for (size_t o = 0; o < own.size(); o++)
+                {
+                    senders[own[o]]->step();
+                    senders[own[o]]->updatePeers();
+                }
+                
+                std::this_thread::yield();
+            }
+        }));
+    }
+    
+    while (numStarted.load() != numThreads)
+    {
+        std::this_thread::yield();
+    }
+    
+    RUDP::Histogram latency;
+    RUDP::MessageView views[64];
+    RUDP::ShardMessage shardMessages[64];
+    uint64_t start = RUDP::Clock::now();
+    uint64_t end = start + (uint64_t)(config.m_seconds * 1000000.0);
+    uint64_t lastDelivery = start;
+    uint64_t lastProgress = start;
+    uint64_t deliveredBytes = 0;
+    uint64_t deliveredMessages = 0;
+    uint64_t forgivenBytes = 0;
+    uint64_t forgivenMessages = 0;
+    uint64_t stallTimeout = UnreliableStallUs + GetLinkDelay(config);
+    bool isReliable = IsReliable(mode);
+    
+    for (;;)
+    {
+        uint64_t numViews = 0;
+        
+        for (size_t r = 0; r < receivers.size(); r++)
+        {
+            receivers[r]->step();
+            receivers[r]->updatePeers();
+            
+            for (size_t num = 1; num > 0;)
+            {
+                if (numShards > 0)
+                {
+                    num = receivers[r]->pollShardMessages(shardMessages, RUDP_ARRAYSIZE(shardMessages));
+                }
+                else
+                {
+                    num = receivers[r]->pollMessages(views, RUDP_ARRAYSIZE(views));
+                }
+                
+                for (size_t v = 0; v < num; v++)
+                {
+                    RUDP::MessageView *view = numShards > 0 ? &shardMessages[v].m_view : &views[v];
+                    
+                    char stamp[sizeof(uint64_t)];
+                    view->copyTo(stamp, sizeof(stamp));
+                    deliveredBytes += view->getSize();
+                    view->release();
+                    
+                    uint64_t sentAt = ReadStamp(stamp);
+                    uint64_t now = RUDP::Clock::now();
+                    latency.record(now > sentAt ? now - sentAt : 0);
+                }
+                
+                deliveredMessages += num;
+                numViews += num;
+            }
+        }
+        
+        uint64_t now = RUDP::Clock::now();
+        uint64_t sent = sentMessages.load();
+        SamplePool(result);
+        
+        if (numViews > 0)
+        {
+            lastDelivery = now;
+            lastProgress = now;
+        }
+        else if (!isReliable && now - lastProgress > stallTimeout && deliveredMessages + forgivenMessages < sent)
+        {
+            forgivenBytes = sentBytes.load() - deliveredBytes;
+            forgivenMessages = sent - deliveredMessages;
+            lastProgress = now;
+        }
+        
+        settledBytes = deliveredBytes + forgivenBytes;
+        settledMessages = deliveredMessages + forgivenMessages;
+        
+        if (isSending.load() && now >= end)
+        {
+            isSending = false;
+        }
+        
+        if (!isSending.load())
+        {
+            bool isComplete = deliveredMessages >= sentMessages.load();
+            bool isQuiet = !isReliable && now - lastProgress > stallTimeout;
+            
+            if (isComplete || isQuiet || now - end > DrainTimeoutUs)
+            {
+                break;
+            }
+        }
+        
+        if (numViews == 0)
+        {
+            std::this_thread::yield();
+        }
+    }
+    
+    numStarted = 0;
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        threads[i].join();
+    }
+    
+    result->m_sent = sentMessages.load();
+    result->m_delivered = deliveredMessages;
+    result->m_lost = result->m_sent > deliveredMessages ? result->m_sent - deliveredMessages : 0;
+    result->m_seconds = (lastDelivery - start) / 1000000.0;
+    latency.read(&result->m_latency);
+    
+    for (size_t i = 0; i < senders.size(); i++)
+    {
+        AddCounters(senders[i], result);
+    }
+    
+    for (size_t i = 0; i < receivers.size(); i++)
+    {
+        AddCounters(receivers[i], result);
+    }
+    
+    DeleteSockets(senders);
+    DeleteSockets(receivers);
+    return true;
+}
+
+static bool RunLatency(const Config &config, uint64_t size, uint64_t numChannels, const Mode *mode, Result *result)
+{
+    std::vector<RUDP::Socket*> sockets;
+    if (!OpenSockets(sockets, 2, BasePort))
+    {
+        DeleteSockets(sockets);
+        return false;
+    }
+    
+    RUDP::Socket *client = sockets[0];
+    RUDP::Socket *server = sockets[1];
+    std::atomic<bool> isRunning(true);
+    
+    // the server sends every message straight back on the channel it came in on
+    std::thread echo([&]()
+    {
+        std::vector<char> buffer(size);
+        RUDP::MessageView views[16];
+        
+        while (isRunning.load())
+        {
+            server->step();
+            server->updatePeers();
+            
+            size_t num = server->pollMessages(views, RUDP_ARRAYSIZE(views));
+            for (size_t v = 0; v < num; v++)
+            {
+                size_t len = views[v].copyTo(&buffer[0], buffer.size());
+                RUDP::Peer *peer = views[v].getPeer();
+                RUDP::PeerMessage message = {};
+                message.prepareForSending(&buffer[0], len, peer, views[v].getChannel());
+                views[v].release();
+                
+                while (peer->enqueueMessage(&message, mode->m_options) != RUDP::EnqueueMessageResult_Success && isRunning.load())
+                {
+                    server->step();
+                }
+                
+                peer->flushToSocket();
+            }
+            
+            if (num == 0)
+            {
+                std::this_thread::yield();
+            }
+        }
+    });
+    
+    RUDP::Peer *peer = client->getPeer(127 << 24 | 1, (uint16_t)(BasePort + 1));
+    RUDP::Histogram roundTrip;
+    RUDP::MessageView views[16];
+    std::vector<char> data(size, 0);
+    uint64_t start = RUDP::Clock::now();
+    uint64_t end = start + (uint64_t)(config.m_seconds * 1000000.0);
+    uint64_t timeout = RoundTripTimeoutUs + size / 4 + 2 * GetLinkDelay(config); // large messages get about 4 bytes per us
+    
+    // the sequence number after the stamp tells a late echo of a lost round apart from this one
+    for (uint64_t seq = 0; RUDP::Clock::now() < end; seq++)
+    {
+        uint64_t sentAt = RUDP::Clock::now();
+        WriteStamp(&data[0], sentAt);
+        WriteStamp(&data[sizeof(uint64_t)], seq);
+        
+        RUDP::PeerMessage message = {};
+        message.prepareForSending(&data[0], size, peer, (RUDP::ChannelId)(seq % numChannels));
+        
+        while (peer->enqueueMessage(&message, mode->m_options) != RUDP::EnqueueMessageResult_Success)
+        {
+            client->step();
+        }
+        
+        peer->flushToSocket();
+        result->m_sent++;
+        
+        for (bool isAnswered = false; !isAnswered;)
+        {
+            client->step();
+            client->updatePeers();
+            SamplePool(result);
+            
+            size_t num = client->pollMessages(views, RUDP_ARRAYSIZE(views));
+            for (size_t v = 0; v < num; v++)
+            {
+                char header[2 * sizeof(uint64_t)];
+                views[v].copyTo(header, sizeof(header));
+                views[v].release();
+                
+                if (ReadStamp(header + sizeof(uint64_t)) == seq)
+                {
+                    roundTrip.record(RUDP::Clock::now() - ReadStamp(header));
+                    result->m_delivered++;
+                    isAnswered = true;
+                }
+            }
+            
+            if (!isAnswered && RUDP::Clock::now() - sentAt > timeout)
+            {
+                result->m_lost++;
+                break;
+            }
+            
+            if (num == 0)
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+    
+    result->m_seconds = (RUDP::Clock::now() - start) / 1000000.0;
+    isRunning = false;
+    echo.join();
+    
+    roundTrip.read(&result->m_latency);
+    AddCounters(client, result);
+    AddCounters(server, result);
+    DeleteSockets(sockets);
+    return true;
+}
+
+static void PrintResult(const Config &config, const Result &result, bool isFirst)
+{
+    double msgsPerSecond = result.m_seconds > 0 ? result.m_delivered / result.m_seconds : 0;
+    double gbitPerSecond = msgsPerSecond * result.m_size * 8 / 1e9;
+    
+    if (config.m_isJson)
+    {
+        printf("%s  {\"test\": \"%s\", \"mode\": \"%s\", \"size\": %llu, \"channels\": %llu, \"peers\": %llu, \"threads\": %llu, "
+               "\"shards\": %llu, \"sent\": %llu, \"delivered\": %llu, \"lost\": %llu, \"seconds\": %.3f, \"msgs_per_s\": %.1f, \"gbit_per_s\": %.4f, "
+               "\"p50_us\": %llu, \"p99_us\": %llu, \"p999_us\": %llu, \"max_us\": %llu, \"retransmits\": %llu, \"kernel_drops\": %llu, "
+               "\"link_drops\": %llu, \"peak_packets\": %llu}",
+               isFirst ? "" : ",\n",
+               result.m_test, result.m_mode,
+               (unsigned long long)result.m_size, (unsigned long long)result.m_channels,
+               (unsigned long long)result.m_peers, (unsigned long long)result.m_threads, (unsigned long long)result.m_shards,
+               (unsigned long long)result.m_sent, (unsigned long long)result.m_delivered, (unsigned long long)result.m_lost,
+               result.m_seconds, msgsPerSecond, gbitPerSecond,
+               (unsigned long long)result.m_latency.getPercentile(50), (unsigned long long)result.m_latency.getPercentile(99),
+               (unsigned long long)result.m_latency.getPercentile(99.9), (unsigned long long)result.m_latency.getMax(),
+               (unsigned long long)result.m_retransmits, (unsigned long long)result.m_kernelDrops,
+               (unsigned long long)result.m_linkDrops, (unsigned long long)result.m_peakPackets);
+    }
+    else
+    {
+        printf("%s,%s,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%.3f,%.1f,%.4f,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n",
+               result.m_test, result.m_mode,
+               (unsigned long long)result.m_size, (unsigned long long)result.m_channels,
+               (unsigned long long)result.m_peers, (unsigned long long)result.m_threads, (unsigned long long)result.m_shards,
+               (unsigned long long)result.m_sent, (unsigned long long)result.m_delivered, (unsigned long long)result.m_lost,
+               result.m_seconds, msgsPerSecond, gbitPerSecond,
+               (unsigned long long)result.m_latency.getPercentile(50), (unsigned long long)result.m_latency.getPercentile(99),
+               (unsigned long long)result.m_latency.getPercentile(99.9), (unsigned long long)result.m_latency.getMax(),
+               (unsigned long long)result.m_retransmits, (unsigned long long)result.m_kernelDrops,
+               (unsigned long long)result.m_linkDrops, (unsigned long long)result.m_peakPackets);
+    }
+    
+    fflush(stdout);
+}
+
+static std::vector<std::string> Split(const char *list)
+{
+    std::vector<std::string> items;
+    std::string item;
+    
+    for (const char *c = list; ; c++)
+    {
+        if (*c == ',' || *c == '\0')
+        {
+            if (!item.empty())
+            {
+                items.push_back(item);
+            }
+            
+            item.clear();
+            
+            if (*c == '\0')
+            {
+                break;
+            }
+        }
+        else
+        {
+            item += *c;
+        }
+    }
+    
+    return items;
+}
+
+static std::vector<uint64_t> ParseNumbers(const char *list)
+{
+    std::vector<std::string> items = Split(list);
+    std::vector<uint64_t> numbers;
+    
+    for (size_t i = 0; i < items.size(); i++)
+    {
+        uint64_t value = strtoull(items[i].c_str(), NULL, 10);
+        if (value > 0)
+        {
+            numbers.push_back(value);
+        }
+    }
+    
+    return numbers;
+}
+
+static void PrintUsage()
+{
+    fprintf(stderr,
+            "usage: loopbackbench [options]\n"
+            "  --tests throughput,latency\n"
+            "  --sizes 16,256,4096,65536,1048576   message sizes in bytes, 16 to 16449034\n"
+            "  --channels 1                        channels the messages rotate over\n"
+            "  --peers 1                           sender to receiver peers, up to 10000\n"
+            "  --threads 1                         sender threads\n"
+            "  --shards 0                          pipeline shards per receiver socket, 0 for none\n"
+            "  --modes unreliable,unreliable_inorder,reliable,reliable_inorder\n"
+            "  --seconds 1                         sending time per row\n"
+            "  --format csv|json\n"
+            "  --link loss=0.01,delay=20000        run over the link emulator, comma separated:\n"
+            "      loss, bad_loss, good_to_bad, bad_to_good   gilbert-elliott loss, probabilities\n"
+            "      delay, jitter, reorder_delay               us\n"
+            "      reorder, duplicate                         probabilities\n"
+            "      bandwidth, queue                           bytes per second, bytes\n"
+            "      mtu                                        bytes\n"
+            "  --seed 1                            emulator random seed\n");
+}
+
+static bool ParseLink(const char *spec, RUDP::LinkConditions *link)
+{
+    std::vector<std::string> items = Split(spec);
+    
+    for (size_t i = 0; i < items.size(); i++)
+    {
+        size_t split = items[i].find('=');
+        if (split == std::string::npos)
+        {
+            return false;
+        }
+        
+        std::string key = items[i].substr(0, split);
+        const char *value = items[i].c_str() + split + 1;
+        
+        if (key == "loss")
+        {
+            link->m_lossRate = atof(value);
+        }
+        else if (key == "bad_loss")
+        {
+            link->m_badLossRate = atof(value);
+        }
+        else if (key == "good_to_bad")
+        {
+            link->m_goodToBad = atof(value);
+        }
+        else if (key == "bad_to_good")
+        {
+            link->m_badToGood = atof(value);
+        }
+        else if (key == "delay")
+        {
+            link->m_delayUs = strtoull(value, NULL, 10);
+        }
+        else if (key == "jitter")
+        {
+            link->m_jitterUs = strtoull(value, NULL, 10);
+        }
+        else if (key == "reorder")
+        {
+            link->m_reorderRate = atof(value);
+        }
+        else if (key == "reorder_delay")
+        {
+            link->m_reorderDelayUs = strtoull(value, NULL, 10);
+        }
+        else if (key == "duplicate")
+        {
+            link->m_duplicateRate = atof(value);
+        }
+        else if (key == "bandwidth")
+        {
+            link->m_bytesPerSecond = strtoull(value, NULL, 10);
+        }
+        else if (key == "queue")
+        {
+            link->m_queueBytes = strtoull(value, NULL, 10);
+        }
+        else if (key == "mtu")
+        {
+            link->m_mtu = (uint32_t)strtoul(value, NULL, 10);
+        }
+        else
+        {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+static bool ParseArguments(int argc, const char *argv[], Config *config)
+{
+    config->m_sizes = ParseNumbers("16,256,4096,65536,1048576");
+    config->m_channels = ParseNumbers("1");
+    config->m_peers = ParseNumbers("1");
+    config->m_threads = ParseNumbers("1");
+    config->m_shards.assign(1, 0);
+    config->m_runThroughput = true;
+    config->m_runLatency = true;
+    config->m_isJson = false;
+    config->m_seconds = 1.0;
+    config->m_isEmulated = false;
+    config->m_seed = 1;
+    
+    for (size_t m = 0; m < RUDP_ARRAYSIZE(Modes); m++)
+    {
+        config->m_modes.push_back(&Modes[m]);
+    }
+    
+    for (int i = 1; i < argc; i += 2)
+    {
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+        
+        const char *value = argv[i + 1];
+        
+        if (strcmp(argv[i], "--sizes") == 0)
+        {
+            config->m_sizes = ParseNumbers(value);
+        }
+        else if (strcmp(argv[i], "--channels") == 0)
+        {
+            config->m_channels = ParseNumbers(value);
+        }
+        else if (strcmp(argv[i], "--peers") == 0)
+        {
+            config->m_peers = ParseNumbers(value);
+        }
+        else if (strcmp(argv[i], "--threads") == 0)
+        {
+            config->m_threads = ParseNumbers(value);
+        }
+        else if (strcmp(argv[i], "--shards") == 0)
+        {
+            // 0 is a valid count here, so not through ParseNumbers
+            std::vector<std::string> items = Split(value);
+            config->m_shards.clear();
+            
+            for (size_t n = 0; n < items.size(); n++)
+            {
+                config->m_shards.push_back(strtoull(items[n].c_str(), NULL, 10));
+            }
+        }
+        else if (strcmp(argv[i], "--seconds") == 0)
+        {
+            config->m_seconds = atof(value);
+        }
+        else if (strcmp(argv[i], "--format") == 0)
+        {
+            config->m_isJson = strcmp(value, "json") == 0;
+        }
+        else if (strcmp(argv[i], "--link") == 0)
+        {
+            config->m_isEmulated = true;
+            
+            if (!ParseLink(value, &config->m_link))
+            {
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--seed") == 0)
+        {
+            config->m_seed = strtoull(value, NULL, 10);
+        }
+        else if (strcmp(argv[i], "--tests") == 0)
+        {
+            std::string tests = std::string(",") + value + ",";
+            config->m_runThroughput = tests.find(",throughput,") != std::string::npos;
+            config->m_runLatency = tests.find(",latency,") != std::string::npos;
+        }
+        else if (strcmp(argv[i], "--modes") == 0)
+        {
+            std::vector<std::string> names = Split(value);
+            config->m_modes.clear();
+            
+            for (size_t n = 0; n < names.size(); n++)
+            {
+                for (size_t m = 0; m < RUDP_ARRAYSIZE(Modes); m++)
+                {
+                    if (names[n] == Modes[m].m_name)
+                    {
+                        config->m_modes.push_back(&Modes[m]);
+                    }
+                }
+            }
+        }
+        else
+        {
+            return false;
+        }
+    }
+    
+    for (size_t i = 0; i < config->m_sizes.size(); i++)
+    {
+        // the send stamp and the sequence number ride in the first 16 bytes
+        if (config->m_sizes[i] < 16 || config->m_sizes[i] > MaxMessageSize)
+        {
+            return false;
+        }
+    }
+    
+    for (size_t i = 0; i < config->m_peers.size(); i++)
+    {
+        if (config->m_peers[i] > 10000)
+        {
+            return false;
+        }
+    }
+    
+    for (size_t i = 0; i < config->m_channels.size(); i++)
+    {
+        if (config->m_channels[i] > RUDP::MaxChannels)
+        {
+            return false;
+        }
+    }
+    
+    return !config->m_modes.empty() && !config->m_shards.empty() && config->m_seconds > 0;
+}
+
+int main(int argc, const char * argv[])
+{
+    Config config;
+    if (!ParseArguments(argc, argv, &config))
+    {
+        PrintUsage();
+        return EXIT_FAILURE;
+    }
+    
+    // pools sized for a full window of the largest message on both ends
+    uint64_t maxSize = 0;
+    for (size_t i = 0; i < config.m_sizes.size(); i++)
+    {
+        maxSize = config.m_sizes[i] > maxSize ? config.m_sizes[i] : maxSize;
+    }
+    
+    uint64_t windowBytes = maxSize * 2 > (1 << 20) ? maxSize * 2 : (1 << 20);
+    size_t numPackets = (size_t)(4 * windowBytes / RUDP::PacketSize) + 4 * MaxWindowMessages;
+    RUDP::NodeStore<RUDP::Packet>::initialize(numPackets);
+    RUDP::NodeStore<RUDP::MessageStart>::initialize(4 * MaxWindowMessages);
+    RUDP::NodeStore<RUDP::PendingMessage>::initialize(4 * MaxWindowMessages);
+    
+    if (config.m_isJson)
+    {
+        printf("[\n");
+    }
+    else
+    {
+        printf("test,mode,size,channels,peers,threads,shards,sent,delivered,lost,seconds,msgs_per_s,gbit_per_s,p50_us,p99_us,p999_us,max_us,retransmits,kernel_drops,link_drops,peak_packets\n");
+    }
+    
+    bool isFirst = true;
+    bool isValid = true;
+    
+    for (size_t m = 0; m < config.m_modes.size(); m++)
+    {
+        for (size_t s = 0; s < config.m_sizes.size(); s++)
+        {
+            for (size_t c = 0; c < config.m_channels.size(); c++)
+            {
+                if (config.m_runLatency)
+                {
+                    Result result = {};
+                    result.m_test = "latency";
+                    result.m_mode = config.m_modes[m]->m_name;
+                    result.m_size = config.m_sizes[s];
+                    result.m_channels = config.m_channels[c];
+                    result.m_peers = 1;
+                    result.m_threads = 1;
+                    
+                    OpenNetwork(config);
+                    bool isRun = RunLatency(config, result.m_size, result.m_channels, config.m_modes[m], &result);
+                    CloseNetwork(&result);
+                    
+                    if (isRun)
+                    {
+                        PrintResult(config, result, isFirst);
+                        isFirst = false;
+                    }
+                    else
+                    {
+                        isValid = false;
+                    }
+                }
+                
+                for (size_t p = 0; p < config.m_peers.size() && config.m_runThroughput; p++)
+                {
+                    for (size_t t = 0; t < config.m_threads.size(); t++)
+                    {
+                        for (size_t h = 0; h < config.m_shards.size(); h++)
+                        {
+                            Result result = {};
+                            result.m_test = "throughput";
+                            result.m_mode = config.m_modes[m]->m_name;
+                            result.m_size = config.m_sizes[s];
+                            result.m_channels = config.m_channels[c];
+                            result.m_peers = config.m_peers[p];
+                            result.m_threads = config.m_threads[t];
+                            result.m_shards = config.m_shards[h];
+                        
+                            OpenNetwork(config);
+                            bool isRun = RunThroughput(config, result.m_size, result.m_channels, result.m_peers, result.m_threads, result.m_shards, config.m_modes[m], &result);
+                            CloseNetwork(&result);
+                        
+                            if (isRun)
+                            {
+                                PrintResult(config, result, isFirst);
+                                isFirst = false;
+                            }
+                            else
+                            {
+                                isValid = false;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    
+    if (config.m_isJson)
+    {
+        printf("\n]\n");
+    }
+    
+    return isValid ? EXIT_SUCCESS : EXIT_FAILURE;
+}
\ No newline at end of file
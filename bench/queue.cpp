@@ -0,0 +1,160 @@
+//
+//  queue.cpp
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+// contention benchmark for the handoff into the socket's out queue: 1 to 16 producer threads
+// pass batches to one consumer, once through a mutex guarded list splice like the socket used to
+// and once through RUDP::MpscQueue.
+// g++ -std=c++11 -O2 -Isrc/public bench/queue.cpp -lpthread -o queuebench
+
+#include <RUDP/queue.h>
+#include <RUDP/list.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <stdio.h>
+
+const size_t NumBatchesPerProducer = 1 << 16;
+
+typedef RUDP::Node<int> BenchNode;
+typedef RUDP::Chain<int> BenchChain;
+
+static BenchChain MakeBatch(BenchNode *node)
+{
+    node->m_next = NULL;
+    node->m_prev = NULL;
+    BenchChain chain = { node, node };
+    return chain;
+}
+
+static size_t CountBatch(BenchChain chain)
+{
+    size_t num = 0;
+    for (BenchNode *node = chain.m_head; node != NULL; node = node->m_next)
+    {
+        num++;
+    }
+    
+    return num;
+}
+
+struct LockedList
+{
+    std::mutex m_lock;
+    RUDP::List<int> m_list;
+    
+    bool push(BenchChain chain)
+    {
+        m_lock.lock();
+        m_list.attach(chain);
+        m_lock.unlock();
+        return true;
+    }
+    
+    size_t drain()
+    {
+        m_lock.lock();
+        BenchChain chain = m_list.detach();
+        m_lock.unlock();
+        return CountBatch(chain);
+    }
+};
+
+struct LockFree
+{
+    RUDP::MpscQueue<BenchChain> m_queue;
+    
+    LockFree() : m_queue(1024) {}
+    
+    bool push(BenchChain chain)
+    {
+        return m_queue.push(chain);
+    }
+    
+    size_t drain()
+    {
+        size_t num = 0;
+        BenchChain chain;
+        
+        while (m_queue.pop(&chain))
+        {
+            num += CountBatch(chain);
+        }
+        
+        return num;
+    }
+};
+
+template <typename Queue>
+static double Run(uint32_t numProducers)
+{
+    Queue queue;
+    std::vector<BenchNode> nodes(numProducers * NumBatchesPerProducer);
+    std::vector<std::thread> producers;
+    std::atomic<bool> start(false);
+    size_t numExpected = nodes.size();
+    size_t numReceived = 0;
+    
+    for (uint32_t p = 0; p < numProducers; p++)
+    {
+        producers.push_back(std::thread([&, p]()
+        {
+            while (!start.load())
+            {
+                std::this_thread::yield();
+            }
+            
+            BenchNode *own = &nodes[p * NumBatchesPerProducer];
+            for (size_t i = 0; i < NumBatchesPerProducer; i++)
+            {
+                BenchChain chain = MakeBatch(&own[i]);
+                while (!queue.push(chain))
+                {
+                    std::this_thread::yield();
+                }
+            }
+        }));
+    }
+    
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    start = true;
+    
+    while (numReceived < numExpected)
+    {
+        size_t num = queue.drain();
+        if (num == 0)
+        {
+            std::this_thread::yield();
+        }
+        
+        numReceived += num;
+    }
+    
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    
+    for (size_t i = 0; i < producers.size(); i++)
+    {
+        producers[i].join();
+    }
+    
+    return numExpected / seconds / 1000000.0;
+}
+
+int main()
+{
+    printf("producers  mutex+list Mbatch/s  mpsc Mbatch/s\n");
+    
+    for (uint32_t numProducers = 1; numProducers <= 16; numProducers *= 2)
+    {
+        double locked = Run<LockedList>(numProducers);
+        double lockFree = Run<LockFree>(numProducers);
+        printf("%9u  %19.2f  %13.2f\n", numProducers, locked, lockFree);
+    }
+    
+    return 0;
+}
\ No newline at end of file
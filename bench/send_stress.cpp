@@ -0,0 +1,471 @@
+//
+//  send_stress.cpp
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+// stress test for concurrent sends to one peer. first several threads publish tagged chains into a
+// RUDP::ChainStack while another thread drains it, every chain has to come out whole and in order.
+// then several threads call enqueueMessage and flushToSocket on the same peer over loopback while the
+// main thread steps both sockets, the receiver checks that every message arrives intact. then unreliable
+// messages go over an emulated link that loses some of them, the ones after a loss have to keep arriving.
+// the same again with a reliable message now and then, every reliable one has to arrive while the
+// unreliable ones keep flowing past their own losses. last unreliable messages longer than the duplicate
+// window have to arrive whole over a clean link.
+// exits with 0 when all pass.
+// g++ -std=c++11 -O2 -Isrc/public src/private/RUDP/*.cpp bench/send_stress.cpp -lpthread -o sendstress
+
+#include <RUDP/RUDP.h>
+#include <RUDP/queue.h>
+#include <RUDP/emulator.h>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <stdio.h>
+
+const uint32_t NumThreads = 8;
+const uint32_t NumChainsPerThread = 20000;
+const uint32_t NumMessagesPerThread = 200;
+const uint16_t StressPort = 6250;
+const uint32_t NumLossyMessages = 60000; // enough fragments to wrap the packet ids several times
+const double LossRate = 0.02;
+const uint32_t ReliableEvery = 64; // in the mixed phase, starting with the first message
+
+// thread in the top byte, chain in the middle and fragment in the low 16 bits
+static uint64_t Tag(uint64_t thread, uint64_t chain, uint64_t fragment)
+{
+    return thread << 56 | chain << 16 | fragment;
+}
+
+static bool StressChainStack()
+{
+    RUDP::ChainStack<uint64_t> stack;
+    std::vector<std::thread> producers;
+    std::atomic<uint32_t> numDone(0);
+    std::vector<uint64_t> nextChain(NumThreads, 0);
+    uint64_t numChains = 0;
+    bool isValid = true;
+    
+    for (uint32_t t = 0; t < NumThreads; t++)
+    {
+        producers.push_back(std::thread([&, t]()
+        {
+            for (uint32_t c = 0; c < NumChainsPerThread; c++)
+            {
+                RUDP::List<uint64_t> fragments;
+                uint32_t numFragments = 1 + c % 5;
+                
+                for (uint32_t f = 0; f < numFragments; f++)
+                {
+                    uint64_t tag = Tag(t, c, f);
+                    while (!fragments.push(&tag))
+                    {
+                        std::this_thread::yield();
+                    }
+                }
+                
+                stack.push(fragments.detach());
+            }
+            
+            numDone++;
+        }));
+    }
+    
+    for (bool isLast = false; !isLast;)
+    {
+        isLast = numDone.load() == NumThreads;
+        
+        RUDP::List<uint64_t> drained;
+        stack.popAll(&drained);
+        
+        for (uint64_t *tag = drained.peek(); tag != NULL; tag = drained.peek())
+        {
+            uint64_t thread = *tag >> 56;
+            uint64_t chain = (*tag >> 16) & 0xffffffffffULL;
+            uint32_t numFragments = 1 + chain % 5;
+            
+            // a thread's chains come out in the order it pushed them, each one unbroken
+            if (chain != nextChain[thread]++)
+            {
+                isValid = false;
+            }
+            
+            for (uint32_t f = 0; f < numFragments; f++)
+            {
+                tag = drained.peek();
+                if (!tag || *tag != Tag(thread, chain, f))
+                {
+                    isValid = false;
+                }
+                
+                drained.pop();
+            }
+            
+            numChains++;
+        }
+    }
+    
+    for (size_t i = 0; i < producers.size(); i++)
+    {
+        producers[i].join();
+    }
+    
+    printf("chain stack: %llu chains, %s\n", (unsigned long long)numChains, isValid ? "ok" : "broken");
+    return isValid && numChains == (uint64_t)NumThreads * NumChainsPerThread;
+}
+
+static bool StressPeer()
+{
+    RUDP::Socket sender;
+    RUDP::Socket receiver;
+    
+    if (!sender.open(StressPort) || !receiver.open(StressPort + 1))
+    {
+        return false;
+    }
+    
+    RUDP::Peer *peer = sender.getPeer(127 << 24 | 1, StressPort + 1);
+    std::vector<std::thread> senders;
+    std::atomic<uint32_t> numSendersDone(0);
+    
+    for (uint32_t t = 0; t < NumThreads; t++)
+    {
+        senders.push_back(std::thread([&, t]()
+        {
+            // half the threads share channel 0, the rest have one each. sizes span several fragments
+            RUDP::ChannelId channel = t % 2 == 0 ? 0 : (RUDP::ChannelId)t;
+            std::vector<uint32_t> data;
+            
+            for (uint32_t m = 0; m < NumMessagesPerThread; m++)
+            {
+                data.assign(64 + (m * 97) % 600, t << 24 | m);
+                
+                RUDP::PeerMessage message = {};
+                message.prepareForSending((char*)data.data(), data.size() * sizeof(uint32_t), peer, channel);
+                
+                while (peer->enqueueMessage(&message, RUDP::EnqueueMessageOption_ConfirmDelivery) != RUDP::EnqueueMessageResult_Success)
+                {
+                    peer->flushToSocket();
+                    std::this_thread::yield();
+                }
+                
+                if (m % 4 == 0)
+                {
+                    peer->flushToSocket();
+                }
+            }
+            
+            while (!peer->flushToSocket())
+            {
+                std::this_thread::yield();
+            }
+            
+            numSendersDone++;
+        }));
+    }
+    
+    uint32_t numReceived = 0;
+    uint32_t numBroken = 0;
+    RUDP::MessageView views[16];
+    std::vector<uint32_t> buffer;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    
+    while (numReceived < NumThreads * NumMessagesPerThread && std::chrono::steady_clock::now() - start < std::chrono::seconds(30))
+    {
+        // the sending threads only enqueue and flush, both sockets are driven from here
+        bool isBusy = sender.step();
+        isBusy = receiver.step() || isBusy;
+        sender.updatePeers();
+        receiver.updatePeers();
+        
+        size_t numViews = receiver.pollMessages(views, 16);
+        for (size_t i = 0; i < numViews; i++)
+        {
+            buffer.resize(views[i].getSize() / sizeof(uint32_t));
+            views[i].copyTo((char*)buffer.data(), buffer.size() * sizeof(uint32_t));
+            views[i].release();
+            
+            uint32_t m = buffer.empty() ? 0 : buffer[0] & 0xffffff;
+            bool isIntact = buffer.size() == 64 + (m * 97) % 600;
+            
+            for (size_t k = 0; k < buffer.size() && isIntact; k++)
+            {
+                isIntact = buffer[k] == buffer[0];
+            }
+            
+            numBroken += isIntact ? 0 : 1;
+            numReceived++;
+        }
+        
+        if (numViews == 0 && !isBusy)
+        {
+            std::this_thread::yield();
+        }
+    }
+    
+    // senders still waiting on a full queue need the sockets stepped to finish
+    while (numSendersDone.load() < NumThreads)
+    {
+        sender.step();
+        receiver.step();
+        sender.updatePeers();
+        receiver.updatePeers();
+    }
+    
+    for (size_t i = 0; i < senders.size(); i++)
+    {
+        senders[i].join();
+    }
+    
+    printf("peer: %u of %u messages, %u broken\n", numReceived, NumThreads * NumMessagesPerThread, numBroken);
+    return numReceived == NumThreads * NumMessagesPerThread && numBroken == 0;
+}
+
+static bool StressLossyChannel()
+{
+    RUDP::EmulatedNetwork network(1);
+    RUDP::LinkConditions link;
+    link.m_lossRate = LossRate;
+    link.m_delayUs = 1000;
+    link.m_jitterUs = 100;
+    network.setDefaultConditions(link);
+    
+    // the transports go last, the sockets use them until they're closed
+    RUDP::EmulatedTransport senderLink(&network, 127 << 24 | 1, StressPort);
+    RUDP::EmulatedTransport receiverLink(&network, 127 << 24 | 1, StressPort + 1);
+    RUDP::Socket sender;
+    RUDP::Socket receiver;
+    
+    if (!sender.open(&senderLink) || !receiver.open(&receiverLink))
+    {
+        return false;
+    }
+    
+    RUDP::Peer *peer = sender.getPeer(127 << 24 | 1, StressPort + 1);
+    uint32_t numSent = 0;
+    uint32_t numReceived = 0;
+    uint32_t numReceivedLast = 0; // of the last quarter, sent once the ids had wrapped
+    std::vector<uint32_t> data(300);
+    RUDP::MessageView views[64];
+    std::chrono::steady_clock::time_point lastReceived = std::chrono::steady_clock::now();
+    
+    // one thread drives both sockets, messages of one to three fragments
+    while (numSent < NumLossyMessages || std::chrono::steady_clock::now() - lastReceived < std::chrono::milliseconds(200))
+    {
+        for (uint32_t i = 0; i < 32 && numSent < NumLossyMessages; i++)
+        {
+            data[0] = numSent;
+            
+            RUDP::PeerMessage message = {};
+            message.prepareForSending((char*)data.data(), 4 + (numSent * 131) % 1196, peer, 0);
+            
+            if (peer->enqueueMessage(&message, RUDP::EnqueueMessageOption_None) != RUDP::EnqueueMessageResult_Success)
+            {
+                break;
+            }
+            
+            numSent++;
+        }
+        
+        peer->flushToSocket();
+        sender.step();
+        receiver.step();
+        sender.updatePeers();
+        receiver.updatePeers();
+        
+        size_t numViews = receiver.pollMessages(views, 64);
+        for (size_t i = 0; i < numViews; i++)
+        {
+            uint32_t m = 0;
+            views[i].copyTo((char*)&m, sizeof(m));
+            views[i].release();
+            
+            numReceived++;
+            numReceivedLast += m >= NumLossyMessages / 4 * 3 ? 1 : 0;
+            lastReceived = std::chrono::steady_clock::now();
+        }
+    }
+    
+    // a message is lost with any of its fragments, allow for three fragments each
+    double expected = 1 - 3 * LossRate;
+    bool isValid = numReceived > NumLossyMessages * expected && numReceivedLast > NumLossyMessages / 4 * expected;
+    
+    printf("lossy channel: %u of %u messages, %u of the last %u\n", numReceived, NumLossyMessages, numReceivedLast, NumLossyMessages / 4);
+    return isValid;
+}
+
+static bool StressMixedChannel()
+{
+    RUDP::EmulatedNetwork network(1);
+    RUDP::LinkConditions link;
+    link.m_lossRate = LossRate;
+    link.m_delayUs = 1000;
+    link.m_jitterUs = 100;
+    network.setDefaultConditions(link);
+    
+    RUDP::EmulatedTransport senderLink(&network, 127 << 24 | 1, StressPort);
+    RUDP::EmulatedTransport receiverLink(&network, 127 << 24 | 1, StressPort + 1);
+    RUDP::Socket sender;
+    RUDP::Socket receiver;
+    
+    if (!sender.open(&senderLink) || !receiver.open(&receiverLink))
+    {
+        return false;
+    }
+    
+    RUDP::Peer *peer = sender.getPeer(127 << 24 | 1, StressPort + 1);
+    uint32_t numSent = 0;
+    uint32_t numReliableReceived = 0;
+    uint32_t numUnreliableReceived = 0;
+    size_t maxMessagesHeld = 0;
+    std::vector<uint32_t> data(300);
+    RUDP::MessageView views[64];
+    std::chrono::steady_clock::time_point lastReceived = std::chrono::steady_clock::now();
+    
+    // lost reliable fragments come back after the ack timeout, the tail waits past it
+    while (numSent < NumLossyMessages || std::chrono::steady_clock::now() - lastReceived < std::chrono::seconds(2))
+    {
+        for (uint32_t i = 0; i < 32 && numSent < NumLossyMessages; i++)
+        {
+            data[0] = numSent;
+            
+            RUDP::PeerMessage message = {};
+            message.prepareForSending((char*)data.data(), 4 + (numSent * 131) % 1196, peer, 0);
+            
+            RUDP::EnqueueMessageOption options = numSent % ReliableEvery == 0 ? RUDP::EnqueueMessageOption_ConfirmDelivery : RUDP::EnqueueMessageOption_None;
+            
+            if (peer->enqueueMessage(&message, options) != RUDP::EnqueueMessageResult_Success)
+            {
+                break;
+            }
+            
+            numSent++;
+        }
+        
+        peer->flushToSocket();
+        sender.step();
+        receiver.step();
+        sender.updatePeers();
+        receiver.updatePeers();
+        
+        size_t numViews = receiver.pollMessages(views, 64);
+        for (size_t i = 0; i < numViews; i++)
+        {
+            uint32_t m = 0;
+            views[i].copyTo((char*)&m, sizeof(m));
+            views[i].release();
+            
+            numReliableReceived += m % ReliableEvery == 0 ? 1 : 0;
+            numUnreliableReceived += m % ReliableEvery == 0 ? 0 : 1;
+            lastReceived = std::chrono::steady_clock::now();
+        }
+        
+        // only the receiver keeps messages, delivered ones must not pile up behind the reliable ones
+        size_t numHeld = RUDP::NodeStore<RUDP::MessageStart>::getNumSecured();
+        maxMessagesHeld = numHeld > maxMessagesHeld ? numHeld : maxMessagesHeld;
+    }
+    
+    uint32_t numReliable = (NumLossyMessages + ReliableEvery - 1) / ReliableEvery;
+    uint32_t numUnreliable = NumLossyMessages - numReliable;
+    bool isValid = numReliableReceived == numReliable && numUnreliableReceived > numUnreliable * (1 - 3 * LossRate) && maxMessagesHeld < 2048;
+    
+    printf("mixed channel: %u of %u reliable, %u of %u unreliable, at most %u messages held\n", numReliableReceived, numReliable, numUnreliableReceived, numUnreliable, (uint32_t)maxMessagesHeld);
+    return isValid;
+}
+
+static bool StressLargeUnreliable()
+{
+    RUDP::EmulatedNetwork network(1);
+    RUDP::LinkConditions link;
+    link.m_delayUs = 1000;
+    network.setDefaultConditions(link);
+    
+    RUDP::EmulatedTransport senderLink(&network, 127 << 24 | 1, StressPort);
+    RUDP::EmulatedTransport receiverLink(&network, 127 << 24 | 1, StressPort + 1);
+    RUDP::Socket sender;
+    RUDP::Socket receiver;
+    
+    if (!sender.open(&senderLink) || !receiver.open(&receiverLink))
+    {
+        return false;
+    }
+    
+    // spanning more fragments than the duplicate window, the first ones leave it before the last arrive
+    const size_t sizes[] = { 500000, 530000, 600000, 1048576, 4194304 };
+    const uint32_t numSizes = sizeof(sizes) / sizeof(sizes[0]);
+    
+    RUDP::Peer *peer = sender.getPeer(127 << 24 | 1, StressPort + 1);
+    uint32_t numSent = 0;
+    uint32_t numReceived = 0;
+    uint32_t numBroken = 0;
+    std::vector<uint32_t> data;
+    std::vector<uint32_t> buffer;
+    RUDP::MessageView views[16];
+    std::chrono::steady_clock::time_point lastReceived = std::chrono::steady_clock::now();
+    
+    // stops once everything arrived, or once nothing did for a while
+    while (numReceived < numSizes && std::chrono::steady_clock::now() - lastReceived < std::chrono::seconds(2))
+    {
+        // one message at a time, so the out queue never holds more than one of them
+        if (numSent < numSizes && numSent == numReceived)
+        {
+            data.assign(sizes[numSent] / sizeof(uint32_t), numSent);
+            
+            RUDP::PeerMessage message = {};
+            message.prepareForSending((char*)data.data(), data.size() * sizeof(uint32_t), peer, 0);
+            
+            if (peer->enqueueMessage(&message, RUDP::EnqueueMessageOption_None) == RUDP::EnqueueMessageResult_Success)
+            {
+                numSent++;
+                lastReceived = std::chrono::steady_clock::now();
+            }
+        }
+        
+        peer->flushToSocket();
+        sender.step();
+        receiver.step();
+        sender.updatePeers();
+        receiver.updatePeers();
+        
+        size_t numViews = receiver.pollMessages(views, 16);
+        for (size_t i = 0; i < numViews; i++)
+        {
+            buffer.resize(views[i].getSize() / sizeof(uint32_t));
+            views[i].copyTo((char*)buffer.data(), buffer.size() * sizeof(uint32_t));
+            views[i].release();
+            
+            uint32_t m = buffer.empty() ? numSizes : buffer[0];
+            bool isIntact = m < numSizes && buffer.size() == sizes[m] / sizeof(uint32_t);
+            
+            for (size_t k = 0; k < buffer.size() && isIntact; k++)
+            {
+                isIntact = buffer[k] == m;
+            }
+            
+            numBroken += isIntact ? 0 : 1;
+            numReceived++;
+            lastReceived = std::chrono::steady_clock::now();
+        }
+    }
+    
+    printf("large unreliable: %u of %u messages, %u broken\n", numReceived, numSizes, numBroken);
+    return numReceived == numSizes && numBroken == 0;
+}
+
+int main()
+{
+    RUDP::NodeStore<uint64_t>::initialize(1 << 16);
+    RUDP::NodeStore<RUDP::Packet>::initialize(1 << 16);
+    RUDP::NodeStore<RUDP::MessageStart>::initialize(1 << 12);
+    RUDP::NodeStore<RUDP::PendingMessage>::initialize(1 << 12);
+    
+    bool isValid = StressChainStack();
+    isValid = StressPeer() && isValid;
+    isValid = StressLossyChannel() && isValid;
+    isValid = StressMixedChannel() && isValid;
+    isValid = StressLargeUnreliable() && isValid;
+    
+    return isValid ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,362 @@
+//
+//  soak.cpp
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+// soak test under virtual time. every endpoint of an RUDP::Simulation sends messages at a fixed rate,
+// with a random phase, to the next endpoint in a ring over emulated links, for minutes or hours of
+// virtual time that take as long as the packets take to process. the report covers delivery, one way
+// latency in virtual time, retransmits and what the links dropped. the digest folds every delivery's
+// time, receiver and content together, so runs with the same arguments and seed print the same digest
+// and a change in timing behaviour shows up as a different one, e.g. for git bisect.
+// g++ -std=c++11 -O2 -Isrc/public src/private/RUDP/*.cpp bench/soak.cpp -lpthread -o soakbench
+// ./soakbench --endpoints 1000 --minutes 60 --rate 2 --link loss=0.01,delay=30000,jitter=10000
+
+#include <RUDP/RUDP.h>
+#include <RUDP/simulation.h>
+#include <RUDP/histogram.h>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const uint16_t BasePort = 7000;
+const uint32_t BaseAddress = 10 << 24;
+
+struct Config
+{
+    uint64_t m_numEndpoints;
+    double m_minutes;
+    double m_rate; // messages per second per endpoint
+    uint64_t m_size;
+    uint64_t m_seed;
+    bool m_isReliable;
+    RUDP::LinkConditions m_link;
+};
+
+struct Sender
+{
+    RUDP::Socket *m_socket;
+    RUDP::Peer *m_target;
+    uint64_t m_numSent;
+};
+
+struct Soak
+{
+    const Config *m_config;
+    std::vector<Sender> m_senders;
+    std::vector<char> m_data;
+    RUDP::Histogram m_latency;
+    uint64_t m_intervalUs;
+    uint64_t m_endUs;
+    uint64_t m_numSent;
+    uint64_t m_numRefused;
+    uint64_t m_numDelivered;
+    uint64_t m_digest;
+};
+
+static Soak s_soak;
+
+static void WriteStamp(char *data, uint64_t value)
+{
+    memcpy(data, &value, sizeof(value));
+}
+
+static uint64_t ReadStamp(const char *data)
+{
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static void OnSend(RUDP::Simulation *simulation, RUDP::Socket *socket, void *context)
+{
+    Sender *sender = (Sender*)context;
+    uint64_t now = simulation->getTime();
+    
+    WriteStamp(&s_soak.m_data[0], now);
+    WriteStamp(&s_soak.m_data[sizeof(uint64_t)], sender->m_numSent);
+    
+    RUDP::PeerMessage message = {};
+    message.prepareForSending(&s_soak.m_data[0], s_soak.m_data.size(), sender->m_target, 0);
+    
+    RUDP::EnqueueMessageOption options = s_soak.m_config->m_isReliable ? RUDP::EnqueueMessageOption_ConfirmDelivery : RUDP::EnqueueMessageOption_None;
+    if (sender->m_target->enqueueMessage(&message, options) == RUDP::EnqueueMessageResult_Success)
+    {
+        sender->m_target->flushToSocket();
+        sender->m_numSent++;
+        s_soak.m_numSent++;
+    }
+    else
+    {
+        s_soak.m_numRefused++;
+    }
+    
+    if (now + s_soak.m_intervalUs < s_soak.m_endUs)
+    {
+        simulation->schedule(now + s_soak.m_intervalUs, socket, OnSend, context);
+    }
+}
+
+static void OnStep(RUDP::Simulation *simulation, RUDP::Socket *socket, void *)
+{
+    RUDP::MessageView views[32];
+    
+    for (size_t num = 1; num > 0;)
+    {
+        num = socket->pollMessages(views, RUDP_ARRAYSIZE(views));
+        
+        for (size_t v = 0; v < num; v++)
+        {
+            char header[2 * sizeof(uint64_t)];
+            views[v].copyTo(header, sizeof(header));
+            
+            uint64_t sentAt = ReadStamp(header);
+            uint64_t now = simulation->getTime();
+            s_soak.m_latency.record(now - sentAt);
+            
+            s_soak.m_digest = RUDP::hashMix(s_soak.m_digest ^ now, sentAt ^ ((uint64_t)socket->getPort() << 48));
+            s_soak.m_digest = RUDP::hashMix(s_soak.m_digest ^ ReadStamp(header + sizeof(uint64_t)), views[v].getSize() | 1);
+            s_soak.m_numDelivered++;
+            
+            views[v].release();
+        }
+    }
+}
+
+static bool ParseLink(const char *spec, RUDP::LinkConditions *link)
+{
+    std::string list = std::string(spec) + ",";
+    size_t start = 0;
+    
+    for (size_t comma = list.find(','); comma != std::string::npos; start = comma + 1, comma = list.find(',', start))
+    {
+        std::string item = list.substr(start, comma - start);
+        size_t split = item.find('=');
+        if (split == std::string::npos)
+        {
+            return false;
+        }
+        
+        std::string key = item.substr(0, split);
+        const char *value = item.c_str() + split + 1;
+        
+        if (key == "loss")
+        {
+            link->m_lossRate = atof(value);
+        }
+        else if (key == "bad_loss")
+        {
+            link->m_badLossRate = atof(value);
+        }
+        else if (key == "good_to_bad")
+        {
+            link->m_goodToBad = atof(value);
+        }
+        else if (key == "bad_to_good")
+        {
+            link->m_badToGood = atof(value);
+        }
+        else if (key == "delay")
+        {
+            link->m_delayUs = strtoull(value, NULL, 10);
+        }
+        else if (key == "jitter")
+        {
+            link->m_jitterUs = strtoull(value, NULL, 10);
+        }
+        else if (key == "reorder")
+        {
+            link->m_reorderRate = atof(value);
+        }
+        else if (key == "reorder_delay")
+        {
+            link->m_reorderDelayUs = strtoull(value, NULL, 10);
+        }
+        else if (key == "duplicate")
+        {
+            link->m_duplicateRate = atof(value);
+        }
+        else if (key == "bandwidth")
+        {
+            link->m_bytesPerSecond = strtoull(value, NULL, 10);
+        }
+        else if (key == "queue")
+        {
+            link->m_queueBytes = strtoull(value, NULL, 10);
+        }
+        else if (key == "mtu")
+        {
+            link->m_mtu = (uint32_t)strtoul(value, NULL, 10);
+        }
+        else
+        {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+static void PrintUsage()
+{
+    fprintf(stderr,
+            "usage: soakbench [options]\n"
+            "  --endpoints 1000                    sockets in the ring, up to 65535\n"
+            "  --minutes 60                        virtual time to run\n"
+            "  --rate 1                            messages per second each endpoint sends\n"
+            "  --size 256                          message size in bytes, at least 16\n"
+            "  --mode reliable|unreliable\n"
+            "  --link loss=0.01,delay=20000        link conditions, as for loopbackbench\n"
+            "  --seed 1\n");
+}
+
+static bool ParseArguments(int argc, const char *argv[], Config *config)
+{
+    config->m_numEndpoints = 1000;
+    config->m_minutes = 60;
+    config->m_rate = 1;
+    config->m_size = 256;
+    config->m_seed = 1;
+    config->m_isReliable = true;
+    
+    for (int i = 1; i < argc; i += 2)
+    {
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+        
+        const char *value = argv[i + 1];
+        
+        if (strcmp(argv[i], "--endpoints") == 0)
+        {
+            config->m_numEndpoints = strtoull(value, NULL, 10);
+        }
+        else if (strcmp(argv[i], "--minutes") == 0)
+        {
+            config->m_minutes = atof(value);
+        }
+        else if (strcmp(argv[i], "--rate") == 0)
+        {
+            config->m_rate = atof(value);
+        }
+        else if (strcmp(argv[i], "--size") == 0)
+        {
+            config->m_size = strtoull(value, NULL, 10);
+        }
+        else if (strcmp(argv[i], "--mode") == 0)
+        {
+            config->m_isReliable = strcmp(value, "unreliable") != 0;
+        }
+        else if (strcmp(argv[i], "--link") == 0)
+        {
+            if (!ParseLink(value, &config->m_link))
+            {
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--seed") == 0)
+        {
+            config->m_seed = strtoull(value, NULL, 10);
+        }
+        else
+        {
+            return false;
+        }
+    }
+    
+    return config->m_numEndpoints >= 2 && config->m_numEndpoints <= 65535 && config->m_minutes > 0 &&
+           config->m_rate > 0 && config->m_size >= 16 && config->m_size <= (1 << 20);
+}
+
+int main(int argc, const char * argv[])
+{
+    Config config;
+    if (!ParseArguments(argc, argv, &config))
+    {
+        PrintUsage();
+        return EXIT_FAILURE;
+    }
+    
+    // every endpoint may hold a few seconds of its messages while losses are repaired
+    size_t numPackets = (size_t)(config.m_numEndpoints * (config.m_size / RUDP::PacketSize + 1) * (config.m_rate * 8 + 16));
+    RUDP::NodeStore<RUDP::Packet>::initialize(numPackets);
+    RUDP::NodeStore<RUDP::MessageStart>::initialize((size_t)(config.m_numEndpoints * (config.m_rate * 8 + 16)));
+    RUDP::NodeStore<RUDP::PendingMessage>::initialize((size_t)(config.m_numEndpoints * (config.m_rate * 8 + 16)));
+    
+    RUDP::Simulation simulation(config.m_seed);
+    simulation.getNetwork()->setDefaultConditions(config.m_link);
+    
+    s_soak.m_config = &config;
+    s_soak.m_data.assign(config.m_size, 'x');
+    s_soak.m_intervalUs = (uint64_t)(1000000.0 / config.m_rate);
+    s_soak.m_endUs = simulation.getTime() + (uint64_t)(config.m_minutes * 60000000.0);
+    s_soak.m_digest = config.m_seed;
+    
+    for (uint64_t i = 0; i < config.m_numEndpoints; i++)
+    {
+        simulation.addEndpoint(BaseAddress + (uint32_t)(i / 1000), (uint16_t)(BasePort + i % 1000));
+    }
+    
+    simulation.setStepCallback(OnStep, NULL);
+    s_soak.m_senders.resize(config.m_numEndpoints);
+    
+    for (uint64_t i = 0; i < config.m_numEndpoints; i++)
+    {
+        uint64_t next = (i + 1) % config.m_numEndpoints;
+        Sender *sender = &s_soak.m_senders[i];
+        sender->m_socket = simulation.getEndpoint(i);
+        sender->m_target = sender->m_socket->getPeer(BaseAddress + (uint32_t)(next / 1000), (uint16_t)(BasePort + next % 1000));
+        sender->m_numSent = 0;
+        
+        uint64_t phase = simulation.getRandom()->nextUpTo(s_soak.m_intervalUs);
+        simulation.schedule(simulation.getTime() + phase, sender->m_socket, OnSend, sender);
+    }
+    
+    // a few seconds past the last send for the last repairs
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    simulation.run(s_soak.m_endUs - simulation.getTime() + 10000000);
+    double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    
+    uint64_t numRetransmits = 0;
+    for (size_t i = 0; i < simulation.getNumEndpoints(); i++)
+    {
+        RUDP::SocketCounters counters;
+        simulation.getEndpoint(i)->getCounters(&counters);
+        numRetransmits += counters.m_traffic.get(RUDP::Counter_Retransmits);
+    }
+    
+    RUDP::SimulationStats stats;
+    simulation.getStats(&stats);
+    
+    RUDP::LinkStats link;
+    simulation.getNetwork()->getStats(&link);
+    
+    RUDP::HistogramSnapshot latency;
+    s_soak.m_latency.read(&latency);
+    
+    double virtualSeconds = config.m_minutes * 60 + 10;
+    printf("endpoints      %llu\n", (unsigned long long)config.m_numEndpoints);
+    printf("virtual_s      %.1f\n", virtualSeconds);
+    printf("wall_s         %.2f\n", wallSeconds);
+    printf("speedup        %.1f\n", wallSeconds > 0 ? virtualSeconds / wallSeconds : 0);
+    printf("sent           %llu\n", (unsigned long long)s_soak.m_numSent);
+    printf("refused        %llu\n", (unsigned long long)s_soak.m_numRefused);
+    printf("delivered      %llu\n", (unsigned long long)s_soak.m_numDelivered);
+    printf("retransmits    %llu\n", (unsigned long long)numRetransmits);
+    printf("datagrams      %llu\n", (unsigned long long)link.m_numSent);
+    printf("link_drops     %llu\n", (unsigned long long)(link.m_numLost + link.m_numQueueDrops + link.m_numOversized));
+    printf("events         %llu\n", (unsigned long long)stats.m_numEvents);
+    printf("steps          %llu\n", (unsigned long long)stats.m_numSteps);
+    printf("p50_us         %llu\n", (unsigned long long)latency.getPercentile(50));
+    printf("p99_us         %llu\n", (unsigned long long)latency.getPercentile(99));
+    printf("max_us         %llu\n", (unsigned long long)latency.getMax());
+    printf("digest         %016llx\n", (unsigned long long)s_soak.m_digest);
+    
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,39 @@
+//
+//  address.cpp
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+#include <RUDP/address.h>
+
+void RUDP::PeerKey::set(const sockaddr_storage *addr)
+{
+    memset(this, 0, sizeof(*this));
+    
+    switch (addr->ss_family)
+    {
+        case AF_INET:
+        {
+            const sockaddr_in *in = (const sockaddr_in*)addr;
+            m_family = 4;
+            m_length = 6;
+            memcpy(m_data, &in->sin_port, 2);
+            memcpy(m_data + 2, &in->sin_addr, 4);
+            break;
+        }
+            
+        case AF_INET6:
+        {
+            const sockaddr_in6 *in6 = (const sockaddr_in6*)addr;
+            m_family = 6;
+            m_length = 18;
+            memcpy(m_data, &in6->sin6_port, 2);
+            memcpy(m_data + 2, &in6->sin6_addr, 16);
+            break;
+        }
+            
+        default:
+            break;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,214 @@
+//
+//  async.cpp
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+#include <RUDP/async.h>
+
+#ifdef RUDP_HAS_COROUTINES
+
+namespace
+{
+    struct FreeFrame
+    {
+        FreeFrame *m_next;
+    };
+    
+    RUDP_THREADLOCAL FreeFrame *s_freeFrames[RUDP::FramePool::NumClasses];
+}
+
+void *RUDP::FramePool::allocate(size_t size)
+{
+    size_t sizeClass = (size + Granularity - 1) / Granularity;
+    if (sizeClass >= NumClasses)
+    {
+        return ::operator new(size);
+    }
+    
+    FreeFrame *frame = s_freeFrames[sizeClass];
+    if (frame)
+    {
+        s_freeFrames[sizeClass] = frame->m_next;
+        return frame;
+    }
+    
+    return ::operator new(sizeClass * Granularity);
+}
+
+void RUDP::FramePool::deallocate(void *ptr, size_t size)
+{
+    size_t sizeClass = (size + Granularity - 1) / Granularity;
+    if (sizeClass >= NumClasses)
+    {
+        ::operator delete(ptr);
+        return;
+    }
+    
+    FreeFrame *frame = (FreeFrame*)ptr;
+    frame->m_next = s_freeFrames[sizeClass];
+    s_freeFrames[sizeClass] = frame;
+}
+
+void RUDP::ReceiveAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    m_handle = handle;
+    *m_executor->m_receiversEnd = this;
+    m_executor->m_receiversEnd = &m_next;
+}
+
+bool RUDP::SendAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    m_handle = handle;
+    m_message->m_userData = this;
+    
+    RUDP::EnqueueMessageOption options = (RUDP::EnqueueMessageOption)(m_options | RUDP::EnqueueMessageOption_ConfirmDelivery);
+    m_result = m_message->m_peer->enqueueMessage(m_message, options);
+    
+    if (m_result != RUDP::EnqueueMessageResult_Success)
+    {
+        // nothing was queued, resume straight away with the error
+        return false;
+    }
+    
+    m_message->m_peer->flushToSocket();
+    return true;
+}
+
+RUDP::AcceptAwaiter::AcceptAwaiter(RUDP::Executor *executor) :
+m_executor(executor),
+m_peer(executor->m_socket->acceptPeer()),
+m_next(nullptr)
+{
+    
+}
+
+void RUDP::AcceptAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    m_handle = handle;
+    *m_executor->m_acceptorsEnd = this;
+    m_executor->m_acceptorsEnd = &m_next;
+}
+
+RUDP::Executor::Executor(RUDP::Socket *socket) :
+m_socket(socket),
+m_receivers(nullptr),
+m_receiversEnd(&m_receivers),
+m_acceptors(nullptr),
+m_acceptorsEnd(&m_acceptors)
+{
+    m_socket->setMessageAcknowledgedCallback(&RUDP::Executor::OnMessageAcknowledged);
+}
+
+RUDP::Executor::~Executor()
+{
+    m_socket->setMessageAcknowledgedCallback(nullptr);
+}
+
+void RUDP::Executor::OnMessageAcknowledged(RUDP::Peer *, RUDP::ChannelId, void *userData, bool isExpired)
+{
+    // reliable messages sent outside of the executor carry no awaiter
+    RUDP::SendAwaiter *awaiter = (RUDP::SendAwaiter*)userData;
+    if (awaiter)
+    {
+        if (isExpired)
+        {
+            awaiter->m_result = RUDP::EnqueueMessageResult_Expired;
+        }
+        
+        awaiter->m_executor->m_ready.push_back(awaiter->m_handle);
+    }
+}
+
+void RUDP::Executor::spawn(RUDP::Task task)
+{
+    m_ready.push_back(task.m_handle);
+    task.m_handle = nullptr;
+}
+
+size_t RUDP::Executor::poll()
+{
+    // acknowledgements are dispatched from here and queue their senders
+    m_socket->updatePeers();
+    
+    while (m_acceptors)
+    {
+        RUDP::Peer *peer = m_socket->acceptPeer();
+        if (!peer)
+        {
+            break;
+        }
+        
+        RUDP::AcceptAwaiter *awaiter = m_acceptors;
+        m_acceptors = awaiter->m_next;
+        if (!m_acceptors)
+        {
+            m_acceptorsEnd = &m_acceptors;
+        }
+        
+        awaiter->m_peer = peer;
+        m_ready.push_back(awaiter->m_handle);
+    }
+    
+    for (RUDP::ReceiveAwaiter **link = &m_receivers; *link != nullptr;)
+    {
+        RUDP::ReceiveAwaiter *awaiter = *link;
+        
+        if (awaiter->m_peer->receiveMessage(awaiter->m_channel, &awaiter->m_view))
+        {
+            *link = awaiter->m_next;
+            if (!*link)
+            {
+                m_receiversEnd = link;
+            }
+            
+            m_ready.push_back(awaiter->m_handle);
+        }
+        else
+        {
+            link = &awaiter->m_next;
+        }
+    }
+    
+    // coroutines resumed here may queue more work, keep going until nothing is ready
+    size_t numResumed = 0;
+    
+    while (!m_ready.empty())
+    {
+        m_running.swap(m_ready);
+        
+        for (size_t i = 0; i < m_running.size(); i++)
+        {
+            m_running[i].resume();
+        }
+        
+        numResumed += m_running.size();
+        m_running.clear();
+    }
+    
+    return numResumed;
+}
+
+size_t RUDP::Executor::runOnce(uint64_t msTimeout)
+{
+    m_socket->update(msTimeout);
+    return poll();
+}
+
+RUDP::ReceiveAwaiter RUDP::Executor::receive(RUDP::Peer *peer, RUDP::ChannelId channel)
+{
+    return RUDP::ReceiveAwaiter(this, peer, channel);
+}
+
+RUDP::SendAwaiter RUDP::Executor::sendReliable(RUDP::PeerMessage *message, RUDP::EnqueueMessageOption options)
+{
+    return RUDP::SendAwaiter(this, message, options);
+}
+
+RUDP::AcceptAwaiter RUDP::Executor::accept()
+{
+    return RUDP::AcceptAwaiter(this);
+}
+
+#endif
\ No newline at end of file
@@ -8,92 +8,720 @@
 
 #include <RUDP/channel.h>
 
-RUDP::MessageStart *RUDP::Channel::addMessage(RUDP::Packet *first, RUDP::Packet *last)
+RUDP::Channel::~Channel()
 {
-    if (RUDP_BIT_HAS(first->getHeader()->m_flags, RUDP::PacketFlag_InOrder))
+    for (RUDP::MessageStart *msg = m_messages.peek(); msg != NULL; msg = m_messages.next(msg))
     {
-        // ensure is behind message needed
-        RUDP::MessageStart start = {};
-        start.m_first = first;
-        start.m_last = last;
-        start.m_isAvailable = false;
+        msg->releaseFragments();
+    }
+    
+    for (int i = 0; i < RUDP::LatencyHistogram_Count; i++)
+    {
+        delete m_histograms[i].load();
+    }
+}
+
+void RUDP::Channel::recordLatency(RUDP::LatencyHistogram histogram, uint64_t us)
+{
+    // only this kind's writer ever allocates it, so no other thread can race the store
+    RUDP::Histogram *target = m_histograms[histogram].load(std::memory_order_relaxed);
+    if (!target)
+    {
+        target = new RUDP::Histogram();
+        m_histograms[histogram].store(target, std::memory_order_release);
+    }
+    
+    target->record(us);
+}
+
+bool RUDP::Channel::readLatency(RUDP::LatencyHistogram histogram, RUDP::HistogramSnapshot *snapshot)
+{
+    RUDP::Histogram *source = m_histograms[histogram].load(std::memory_order_acquire);
+    if (!source)
+    {
+        return false;
+    }
+    
+    source->read(snapshot);
+    return true;
+}
+
+bool RUDP::Channel::isDuplicate(RUDP::PacketId packetId)
+{
+    if (!m_hasReceived)
+    {
+        m_lastAcknowledged = packetId - 1;
+        m_hasReceived = true;
+    }
+    
+    if (RUDP::PacketId_IsAfter(packetId, m_lastAcknowledged))
+    {
+        // slide the window, ids that fall out of it are forgotten
+        uint16_t shift = (uint16_t)(packetId - m_lastAcknowledged);
         
-        RUDP::MessageStart *toCheck = m_messages.peekEnd();
-        while (toCheck)
+        if (shift >= RUDP::DuplicateWindow)
         {
-            if (toCheck->m_first->getHeader()->m_packetId < first->getHeader()->m_packetId)
+            memset(m_receivedWindow, 0, sizeof(m_receivedWindow));
+        }
+        else
+        {
+            for (RUDP::PacketId id = m_lastAcknowledged + 1; id != (RUDP::PacketId)(packetId + 1); id++)
             {
-                start.m_isAvailable = toCheck == m_messages.peek();
-                return m_messages.pushAfter(toCheck, &start);
+                uint16_t bit = id % RUDP::DuplicateWindow;
+                RUDP_BIT_UNSET(m_receivedWindow[bit / 64], 1ULL << (bit % 64));
             }
-            
-            toCheck = m_messages.prev(toCheck);
         }
         
-        start.m_isAvailable = true;
-        return m_messages.push(&start);
+        m_lastAcknowledged = packetId;
+        return false;
+    }
+    
+    // too old to tell, the reassembly table decides
+    if ((uint16_t)(m_lastAcknowledged - packetId) >= RUDP::DuplicateWindow)
+    {
+        return false;
+    }
+    
+    uint16_t bit = packetId % RUDP::DuplicateWindow;
+    return RUDP_BIT_HAS(m_receivedWindow[bit / 64], 1ULL << (bit % 64));
+}
+
+void RUDP::Channel::markReceived(RUDP::PacketId packetId)
+{
+    if ((uint16_t)(m_lastAcknowledged - packetId) < RUDP::DuplicateWindow)
+    {
+        uint16_t bit = packetId % RUDP::DuplicateWindow;
+        RUDP_BIT_SET(m_receivedWindow[bit / 64], 1ULL << (bit % 64));
+    }
+}
+
+void RUDP::Channel::markSettled(RUDP::PacketId settledBefore)
+{
+    if (RUDP::PacketId_IsAfter(settledBefore, m_peerSettledBefore))
+    {
+        m_peerSettledBefore = settledBefore;
+    }
+}
+
+RUDP::MessageStart *RUDP::Channel::findMessage(RUDP::PacketId messageId)
+{
+    // fragments of the newest message are the most likely to arrive, so search from the end
+    for (RUDP::MessageStart *msg = m_messages.peekEnd(); msg != NULL; msg = m_messages.prev(msg))
+    {
+        if (msg->m_messageId == messageId)
+        {
+            return msg;
+        }
+        
+        if (RUDP::PacketId_IsAfter(messageId, msg->m_messageId))
+        {
+            break;
+        }
+    }
+    
+    return NULL;
+}
+
+RUDP::MessageStart *RUDP::Channel::addMessage(RUDP::PacketHeader *header, uint64_t arrivalTime)
+{
+    // keep the table sorted by message id so in-order delivery can walk it from the head
+    RUDP::MessageStart *msg = NULL;
+    RUDP::MessageStart *toCheck = m_messages.peekEnd();
+    
+    while (toCheck && RUDP::PacketId_IsAfter(toCheck->m_messageId, header->m_messageId))
+    {
+        toCheck = m_messages.prev(toCheck);
+    }
+    
+    if (toCheck)
+    {
+        msg = m_messages.pushAfter(toCheck);
+    }
+    else if (m_messages.peek())
+    {
+        msg = m_messages.pushBefore(m_messages.peek(), NULL);
     }
     else
     {
-        RUDP::MessageStart *start = m_messages.push();
-        start->m_first = first;
-        start->m_last = last;
-        return start;
+        msg = m_messages.push();
+    }
+    
+    if (msg)
+    {
+        msg->m_messageId = header->m_messageId;
+        msg->m_numFragments = header->m_numFragments;
+        msg->m_arrivalTime = arrivalTime;
+        msg->m_flags = header->m_flags;
+        
+        if (!msg->initFragments(header->m_numFragments))
+        {
+            m_messages.remove(msg);
+            msg = NULL;
+        }
     }
+    
+    return msg;
 }
 
-RUDP::Packet *RUDP::Channel::findMessageStart(RUDP::Packet *newPck)
+bool RUDP::Channel::addFragment(RUDP::MessageStart *msg, RUDP::Packet *pck)
 {
-    RUDP::Packet *pck = m_queue.prev(newPck);
-    RUDP::Packet *prevPck = newPck;
+    RUDP::PacketHeader *header = pck->getHeader();
+    uint16_t index = (uint16_t)(header->m_packetId - msg->m_messageId);
     
-    while (pck)
+    msg->setFragment(index);
+    msg->m_numReceived++;
+    msg->m_size += pck->getUserDataSize();
+    
+    if (index == 0)
+    {
+        msg->m_first = pck;
+    }
+    
+    if (index == msg->m_numFragments - 1)
+    {
+        msg->m_last = pck;
+    }
+    
+    if (!msg->isComplete())
+    {
+        return false;
+    }
+    
+    recordLatency(RUDP::LatencyHistogram_Reassembly, pck->getTimestamp() - msg->m_arrivalTime);
+    
+    if (RUDP_BIT_HAS(header->m_flags, RUDP::PacketFlag_Sequenced))
+    {
+        supersede(msg);
+    }
+    
+    if (!RUDP_BIT_HAS(header->m_flags, RUDP::PacketFlag_InOrder))
     {
-        if (prevPck->getHeader()->m_packetId != pck->getHeader()->m_packetId + 1)
+        msg->m_isAvailable = true;
+        m_numAvailable++;
+    }
+    
+    advance(m_nextMessageId);
+    return true;
+}
+
+void RUDP::Channel::updateQueueDepth(int32_t delta)
+{
+    m_numQueued += delta;
+    
+    m_receiveCounters.begin();
+    m_receiveCounters.set(RUDP::Counter_ReassemblyDepth, m_numQueued);
+    m_receiveCounters.end();
+}
+
+void RUDP::Channel::supersede(RUDP::MessageStart *msg)
+{
+    // everything older is stale now, only messages already handed out are kept until released
+    for (RUDP::MessageStart *old = m_messages.peek(); old != NULL && old != msg;)
+    {
+        RUDP::MessageStart *next = m_messages.next(old);
+        
+        if (!old->m_isHeld)
         {
-            break;
+            freeFragments(old);
+            
+            if (old->m_isAvailable)
+            {
+                m_numAvailable--;
+            }
+            
+            eraseMessage(old);
         }
         
-        if (RUDP_BIT_HAS(pck->getHeader()->m_flags, RUDP::PacketFlag_StartOfMessage))
+        old = next;
+    }
+    
+    // late arrivals of older messages are dropped before they reach the queue
+    m_nextMessageId = msg->m_messageId + msg->m_numFragments;
+}
+
+void RUDP::Channel::freeFragments(RUDP::MessageStart *msg)
+{
+    // the queue is sorted by packet id, so the message's fragments form one run
+    for (RUDP::Packet *pck = m_queue.peek(); pck != NULL;)
+    {
+        RUDP::Packet *next = m_queue.next(pck);
+        uint16_t index = (uint16_t)(pck->getHeader()->m_packetId - msg->m_messageId);
+        
+        if (index < msg->m_numFragments)
         {
-            return pck;
+            m_queue.remove(pck);
+            updateQueueDepth(-1);
         }
-        else if (RUDP_BIT_HAS(pck->getHeader()->m_flags, RUDP::PacketFlag_EndOfMessage))
+        else if (RUDP::PacketId_IsAfter(pck->getHeader()->m_packetId, msg->m_messageId))
         {
             break;
         }
         
-        prevPck = pck;
-        pck = m_queue.prev(pck);
+        pck = next;
+    }
+    
+    msg->m_first = NULL;
+    msg->m_last = NULL;
+}
+
+void RUDP::Channel::eraseMessage(RUDP::MessageStart *msg)
+{
+    msg->releaseFragments();
+    m_messages.remove(msg);
+}
+
+void RUDP::Channel::advance(RUDP::PacketId giveUpBefore)
+{
+    RUDP::MessageStart *msg = m_messages.peek();
+    
+    while (msg)
+    {
+        RUDP::MessageStart *next = m_messages.next(msg);
+        
+        // already passed and waiting to be received
+        if (RUDP::PacketId_IsAfter(m_nextMessageId, msg->m_messageId))
+        {
+            msg = next;
+            continue;
+        }
+        
+        bool isTooOld = RUDP::PacketId_IsAfter(giveUpBefore, msg->m_messageId);
+        
+        if (msg->m_messageId != m_nextMessageId)
+        {
+            // nothing of the messages in between arrived, reliable ones may still be on their way until
+            // the sender announced them settled
+            RUDP::PacketId limit = RUDP::PacketId_IsAfter(msg->m_messageId, m_peerSettledBefore) ? m_peerSettledBefore : msg->m_messageId;
+            
+            if (isTooOld && RUDP::PacketId_IsAfter(limit, m_nextMessageId))
+            {
+                m_nextMessageId = limit;
+            }
+            
+            if (msg->m_messageId != m_nextMessageId)
+            {
+                break;
+            }
+        }
+        
+        if (!msg->isComplete())
+        {
+            // a message longer than the window still has fragments on the way after its first id left it,
+            // only once its last id left too nothing more of it can be told apart from retransmissions
+            RUDP::PacketId lastId = msg->m_messageId + msg->m_numFragments - 1;
+            
+            if (!RUDP::PacketId_IsAfter(giveUpBefore, lastId) || msg->isReliable())
+            {
+                break;
+            }
+            
+            // the missing fragments were lost
+            m_nextMessageId += msg->m_numFragments;
+            freeFragments(msg);
+            eraseMessage(msg);
+            msg = next;
+            continue;
+        }
+        
+        m_nextMessageId += msg->m_numFragments;
+        
+        if (msg->m_isDelivered)
+        {
+            eraseMessage(msg);
+        }
+        else if (!msg->m_isAvailable && !msg->m_isHeld)
+        {
+            msg->m_isAvailable = true;
+            m_numAvailable++;
+        }
+        
+        msg = next;
+    }
+    
+    // nothing left in the table, the gap up to the horizon is given up as well as far as it is settled
+    if (!msg)
+    {
+        RUDP::PacketId limit = RUDP::PacketId_IsAfter(giveUpBefore, m_peerSettledBefore) ? m_peerSettledBefore : giveUpBefore;
+        
+        if (RUDP::PacketId_IsAfter(limit, m_nextMessageId))
+        {
+            m_nextMessageId = limit;
+        }
+    }
+}
+
+void RUDP::Channel::expireMessages()
+{
+    // ids that left the duplicate window can't be told apart from retransmissions anymore
+    RUDP::PacketId horizon = m_lastAcknowledged - RUDP::DuplicateWindow + 1;
+    
+    if (m_hasReceived && RUDP::PacketId_IsAfter(horizon, m_nextMessageId))
+    {
+        advance(horizon);
+    }
+}
+
+bool RUDP::Channel::expireOldest()
+{
+    // the reassembly table is out of entries, give up on the oldest message that is still waited for
+    for (RUDP::MessageStart *msg = m_messages.peek(); msg != NULL; msg = m_messages.next(msg))
+    {
+        if (!RUDP::PacketId_IsAfter(m_nextMessageId, msg->m_messageId))
+        {
+            RUDP::PacketId before = m_nextMessageId;
+            advance(msg->m_messageId + msg->m_numFragments);
+            return m_nextMessageId != before;
+        }
+    }
+    
+    return false;
+}
+
+RUDP::MessageStart *RUDP::Channel::peekMessage()
+{
+    if (m_numAvailable == 0)
+    {
+        return NULL;
+    }
+    
+    for (RUDP::MessageStart *msg = m_messages.peek(); msg != NULL; msg = m_messages.next(msg))
+    {
+        if (msg->m_isAvailable)
+        {
+            return msg;
+        }
     }
     
     return NULL;
 }
 
-RUDP::Packet * RUDP::Channel::findMessageEnd(RUDP::Packet *newPck)
+void RUDP::Channel::holdMessage(RUDP::MessageStart *msg)
+{
+    if (msg->m_isAvailable)
+    {
+        msg->m_isAvailable = false;
+        m_numAvailable--;
+    }
+    
+    msg->m_isHeld = true;
+}
+
+void RUDP::Channel::removeMessage(RUDP::MessageStart *msg)
 {
-    RUDP::Packet *pck = m_queue.next(newPck);
-    RUDP::Packet *prevPck = newPck;
+    RUDP::Packet *pck = msg->m_first;
+    int32_t numRemoved = 0;
     
     while (pck)
     {
-        if (prevPck->getHeader()->m_packetId != pck->getHeader()->m_packetId - 1)
+        RUDP::Packet *toRemove = pck;
+        pck = toRemove == msg->m_last ? NULL : m_queue.next(pck);
+        m_queue.remove(toRemove);
+        numRemoved++;
+    }
+    
+    if (numRemoved > 0)
+    {
+        updateQueueDepth(-numRemoved);
+    }
+    
+    if (msg->m_isAvailable)
+    {
+        msg->m_isAvailable = false;
+        m_numAvailable--;
+    }
+    
+    msg->m_isHeld = false;
+    
+    // unreliable messages become a gap, late fragments are found through the duplicate window instead
+    if (RUDP::PacketId_IsAfter(m_nextMessageId, msg->m_messageId) || !msg->isReliable())
+    {
+        eraseMessage(msg);
+    }
+    else
+    {
+        // delivered ahead of the in-order sequence, keep a placeholder so the sequence can advance past it
+        msg->m_isDelivered = true;
+        msg->m_first = NULL;
+        msg->m_last = NULL;
+        msg->releaseFragments();
+    }
+}
+
+RUDP::ReceiveResult RUDP::Channel::skipMessage(RUDP::PacketHeader *header)
+{
+    RUDP::MessageStart *msg = findMessage(header->m_messageId);
+    
+    if (!msg)
+    {
+        // already delivered and passed
+        if (RUDP::PacketId_IsAfter(m_nextMessageId, header->m_messageId))
         {
-            break;
+            return RUDP::ReceiveResult_Known;
+        }
+        
+        msg = addMessage(header, 0);
+        if (!msg)
+        {
+            return RUDP::ReceiveResult_Dropped;
         }
+    }
+    
+    // a message that made it in full is still delivered
+    if (msg->m_isDelivered || msg->isComplete())
+    {
+        return RUDP::ReceiveResult_Known;
+    }
+    
+    freeFragments(msg);
+    
+    // turn it into a delivered placeholder so in-order delivery moves past it
+    msg->m_isDelivered = true;
+    msg->releaseFragments();
+    msg->m_numReceived = msg->m_numFragments;
+    
+    advance(m_nextMessageId);
+    return RUDP::ReceiveResult_Kept;
+}
+
+RUDP::PendingMessage *RUDP::Channel::stagePending(RUDP::List<RUDP::PendingMessage> *staged, uint16_t numFragments, void *userData, uint64_t enqueueTime)
+{
+    RUDP::PendingMessage *pending = staged->push();
+    if (!pending)
+    {
+        return NULL;
+    }
+    
+    pending->m_messageId = 0;
+    pending->m_numRemaining = numFragments;
+    pending->m_userData = userData;
+    pending->m_enqueueTime = enqueueTime;
+    
+    // counted before its ids are reserved, so nothing is announced settled past them in the meantime
+    m_numUnsettled++;
+    return pending;
+}
+
+void RUDP::Channel::addPending(RUDP::List<RUDP::PendingMessage> *staged, RUDP::PacketId messageId)
+{
+    staged->peek()->m_messageId = messageId;
+    m_newPending.push(staged->detach());
+}
+
+void RUDP::Channel::collectPending()
+{
+    if (m_newPending.isEmpty())
+    {
+        return;
+    }
+    
+    RUDP::PendingMessage *last = m_pending.peekEnd();
+    m_newPending.popAll(&m_pending);
+    
+    RUDP::PendingMessage *pending = last ? m_pending.next(last) : m_pending.peek();
+    
+    while (pending)
+    {
+        RUDP::PendingMessage *following = m_pending.next(pending);
+        
+        // concurrent senders may publish out of id order, m_pending stays sorted so its head is the oldest
+        RUDP::PendingMessage *before = m_pending.prev(pending);
+        
+        if (before && RUDP::PacketId_IsAfter(before->m_messageId, pending->m_messageId))
+        {
+            while (m_pending.prev(before) && RUDP::PacketId_IsAfter(m_pending.prev(before)->m_messageId, pending->m_messageId))
+            {
+                before = m_pending.prev(before);
+            }
+            
+            m_pending.moveBefore(before, pending);
+        }
+        
+        m_numPending++;
+        RUDP::PendingKey key = { pending->m_messageId };
         
-        if (RUDP_BIT_HAS(pck->getHeader()->m_flags, RUDP::PacketFlag_EndOfMessage))
+        // a message id still unacknowledged after the sequence wrapped keeps the older entry, the
+        // newer one is indexed once that leaves
+        if (m_pendingIndex.find(&key))
         {
-            return pck;
+            m_numPendingShadowed++;
         }
-        else if (RUDP_BIT_HAS(pck->getHeader()->m_flags, RUDP::PacketFlag_StartOfMessage))
+        else
+        {
+            m_pendingIndex.insert(&key, pending);
+        }
+        
+        pending = following;
+    }
+}
+
+RUDP::PendingMessage *RUDP::Channel::findPending(RUDP::PacketId messageId)
+{
+    collectPending();
+    
+    RUDP::PendingKey key = { messageId };
+    RUDP::PendingMessage **pending = m_pendingIndex.find(&key);
+    return pending ? *pending : NULL;
+}
+
+void RUDP::Channel::erasePending(RUDP::PendingMessage *pending)
+{
+    RUDP::PendingKey key = { pending->m_messageId };
+    bool isOldest = pending == m_pending.peek();
+    m_pendingIndex.remove(&key);
+    m_pending.remove(pending);
+    m_numPending--;
+    m_numUnsettled--;
+    
+    for (RUDP::PendingMessage *other = m_pending.peek(); other != NULL && m_numPendingShadowed > 0; other = m_pending.next(other))
+    {
+        if (other->m_messageId == key.m_messageId)
+        {
+            m_numPendingShadowed--;
+            m_pendingIndex.insert(&key, other);
+            break;
+        }
+    }
+    
+    if (isOldest)
+    {
+        updateSettledBefore();
+    }
+}
+
+void RUDP::Channel::updateSettledBefore()
+{
+    // read before the count, anything reserved later gets a newer id
+    RUDP::PacketId nextId = m_nextPacketId;
+    
+    if (m_numUnsettled != m_numPending)
+    {
+        collectPending();
+    }
+    
+    // a sender is between staging and publishing, its id isn't known yet so the last floor stays
+    if (m_numUnsettled != m_numPending)
+    {
+        return;
+    }
+    
+    RUDP::PendingMessage *oldest = m_pending.peek();
+    m_settledBefore = oldest ? oldest->m_messageId : nextId;
+}
+
+RUDP::PacketId RUDP::Channel::getSettledBefore()
+{
+    RUDP::PacketId nextId = m_nextPacketId;
+    
+    // nothing reliable staged or unacknowledged, so everything before the next id is settled
+    if (m_numUnsettled == 0)
+    {
+        return nextId;
+    }
+    
+    return m_settledBefore;
+}
+
+bool RUDP::Channel::removePending(RUDP::PacketId messageId, void **userData)
+{
+    RUDP::PendingMessage *pending = findPending(messageId);
+    if (!pending)
+    {
+        return false;
+    }
+    
+    if (userData)
+    {
+        *userData = pending->m_userData;
+    }
+    
+    erasePending(pending);
+    return true;
+}
+
+bool RUDP::Channel::acknowledgeFragment(RUDP::PacketId messageId, void **userData, uint64_t ackTime)
+{
+    RUDP::PendingMessage *pending = findPending(messageId);
+    if (!pending || --pending->m_numRemaining > 0)
+    {
+        return false;
+    }
+    
+    *userData = pending->m_userData;
+    recordLatency(RUDP::LatencyHistogram_EnqueueToAck, ackTime - pending->m_enqueueTime);
+    erasePending(pending);
+    return true;
+}
+
+bool RUDP::Channel::addStreamPacket(RUDP::Packet *pck)
+{
+    RUDP::PacketId id = pck->getHeader()->m_packetId;
+    
+    // beyond the window or already read
+    if ((uint16_t)(id - m_streamNextRead) >= m_streamWindow)
+    {
+        return false;
+    }
+    
+    RUDP::Packet *after = m_stream.peekEnd();
+    
+    while (after && RUDP::PacketId_IsAfter(after->getHeader()->m_packetId, id))
+    {
+        after = m_stream.prev(after);
+    }
+    
+    if (after && after->getHeader()->m_packetId == id)
+    {
+        return false;
+    }
+    
+    RUDP::Packet *added = NULL;
+    
+    if (after)
+    {
+        added = m_stream.pushAfter(after, pck);
+    }
+    else if (m_stream.peek())
+    {
+        added = m_stream.pushBefore(m_stream.peek(), pck);
+    }
+    else
+    {
+        added = m_stream.push(pck);
+    }
+    
+    if (added)
+    {
+        added->resetReadPosition();
+    }
+    
+    return added != NULL;
+}
+
+size_t RUDP::Channel::readStream(char *buffer, size_t bufferLen, RUDP::List<RUDP::Packet> *consumed)
+{
+    size_t numRead = 0;
+    
+    for (RUDP::Packet *pck = m_stream.peek(); pck != NULL && numRead < bufferLen; pck = m_stream.peek())
+    {
+        if (pck->getHeader()->m_packetId != m_streamNextRead)
         {
             break;
         }
         
-        prevPck = pck;
-        pck = m_queue.next(pck);
+        uint16_t offset = pck->getReadPosition();
+        size_t available = pck->getUserDataSize() - offset;
+        size_t toCopy = bufferLen - numRead < available ? bufferLen - numRead : available;
+        
+        memcpy(buffer + numRead, pck->getUserDataPtr() + offset, toCopy);
+        numRead += toCopy;
+        pck->setReadPosition((uint16_t)(offset + toCopy));
+        
+        if (toCopy == available)
+        {
+            m_streamNextRead++;
+            m_stream.popTo(consumed);
+        }
     }
     
-    return NULL;
+    return numRead;
 }
\ No newline at end of file
@@ -0,0 +1,136 @@
+//
+//  clock.cpp
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+#include <RUDP/clock.h>
+#include <RUDP/platform.h>
+#include <thread>
+#include <chrono>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define RUDP_HAS_TSC 1
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#include <cpuid.h>
+#define RUDP_HAS_TSC 1
+#endif
+
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+std::atomic<RUDP::ClockSource> RUDP::Clock::s_source(NULL);
+void *RUDP::Clock::s_sourceContext = NULL;
+std::atomic<bool> RUDP::Clock::s_useTsc(false);
+double RUDP::Clock::s_usPerTick = 0;
+uint64_t RUDP::Clock::s_tscBase = 0;
+uint64_t RUDP::Clock::s_usBase = 0;
+
+uint64_t RUDP::Clock::readSystem()
+{
+#ifdef _WIN32
+    static LARGE_INTEGER s_frequency = {};
+    if (s_frequency.QuadPart == 0)
+    {
+        QueryPerformanceFrequency(&s_frequency);
+    }
+    
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    
+    // split so the multiplication can't overflow
+    uint64_t seconds = counter.QuadPart / s_frequency.QuadPart;
+    uint64_t remainder = counter.QuadPart % s_frequency.QuadPart;
+    return seconds * 1000000 + remainder * 1000000 / s_frequency.QuadPart;
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+#endif
+}
+
+uint64_t RUDP::Clock::now()
+{
+    RUDP::ClockSource source = s_source.load(std::memory_order_acquire);
+    if (source)
+    {
+        return source(s_sourceContext);
+    }
+
+#ifdef RUDP_HAS_TSC
+    if (s_useTsc.load(std::memory_order_acquire))
+    {
+        return s_usBase + (uint64_t)((double)(__rdtsc() - s_tscBase) * s_usPerTick);
+    }
+#endif
+    
+    return readSystem();
+}
+
+bool RUDP::Clock::enableTsc(uint32_t calibrationMs)
+{
+#ifdef RUDP_HAS_TSC
+    if (s_useTsc.load())
+    {
+        return true;
+    }
+    
+    // cpuid 0x80000007, edx bit 8: the counter ticks at a constant rate in every p and c state
+    unsigned int regs[4] = {};
+#ifdef _MSC_VER
+    __cpuid((int*)regs, 0x80000000);
+    if (regs[0] < 0x80000007)
+    {
+        return false;
+    }
+    
+    __cpuid((int*)regs, 0x80000007);
+#else
+    if (__get_cpuid_max(0x80000000, NULL) < 0x80000007)
+    {
+        return false;
+    }
+    
+    __get_cpuid(0x80000007, &regs[0], &regs[1], &regs[2], &regs[3]);
+#endif
+    
+    if ((regs[3] & (1 << 8)) == 0)
+    {
+        return false;
+    }
+    
+    uint64_t usStart = readSystem();
+    uint64_t tscStart = __rdtsc();
+    std::this_thread::sleep_for(std::chrono::milliseconds(calibrationMs == 0 ? 1 : calibrationMs));
+    uint64_t usEnd = readSystem();
+    uint64_t tscEnd = __rdtsc();
+    
+    if (tscEnd <= tscStart || usEnd <= usStart)
+    {
+        return false;
+    }
+    
+    s_usPerTick = (double)(usEnd - usStart) / (double)(tscEnd - tscStart);
+    s_tscBase = tscEnd;
+    s_usBase = usEnd;
+    s_useTsc.store(true, std::memory_order_release);
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool RUDP::Clock::isTscEnabled()
+{
+    return s_useTsc.load();
+}
+
+void RUDP::Clock::setSource(RUDP::ClockSource source, void *context)
+{
+    s_sourceContext = context;
+    s_source.store(source, std::memory_order_release);
+}
\ No newline at end of file
@@ -0,0 +1,65 @@
+//
+//  counters.cpp
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+#include <RUDP/counters.h>
+#include <string.h>
+#include <thread>
+
+void RUDP::CounterSnapshot::clear()
+{
+    memset(m_values, 0, sizeof(m_values));
+}
+
+void RUDP::CounterSnapshot::add(const RUDP::CounterSnapshot &other)
+{
+    for (int i = 0; i < RUDP::Counter_Count; i++)
+    {
+        m_values[i] += other.m_values[i];
+    }
+}
+
+RUDP::CounterSlot::CounterSlot() : m_version(0)
+{
+    for (int i = 0; i < RUDP::Counter_Count; i++)
+    {
+        m_values[i] = 0;
+    }
+}
+
+void RUDP::CounterSlot::read(RUDP::CounterSnapshot *snapshot)
+{
+    uint64_t values[RUDP::Counter_Count];
+    
+    for (;;)
+    {
+        uint32_t version = m_version.load(std::memory_order_acquire);
+        
+        // the writer only stays between begin and end for a few stores
+        if (version & 1)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        
+        for (int i = 0; i < RUDP::Counter_Count; i++)
+        {
+            values[i] = m_values[i].load(std::memory_order_relaxed);
+        }
+        
+        std::atomic_thread_fence(std::memory_order_acquire);
+        
+        if (m_version.load(std::memory_order_relaxed) == version)
+        {
+            break;
+        }
+    }
+    
+    for (int i = 0; i < RUDP::Counter_Count; i++)
+    {
+        snapshot->m_values[i] += values[i];
+    }
+}
\ No newline at end of file
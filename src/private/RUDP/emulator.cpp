@@ -0,0 +1,447 @@
+//
+//  emulator.cpp
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+#include <RUDP/emulator.h>
+#include <RUDP/clock.h>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
+namespace
+{
+    // orders the inbox heap so the earliest due datagram is on top
+    struct LaterDue
+    {
+        bool operator()(const RUDP::EmulatedDatagram *a, const RUDP::EmulatedDatagram *b) const
+        {
+            return a->m_due != b->m_due ? a->m_due > b->m_due : a->m_order > b->m_order;
+        }
+    };
+}
+
+RUDP::EmulatedNetwork::EmulatedNetwork(uint64_t seed) :
+m_links(256),
+m_endpoints(256),
+m_deliveryCallback(NULL),
+m_deliveryContext(NULL),
+m_random(seed),
+m_nextOrder(0),
+m_numQueued(0),
+m_maxQueued(0)
+{
+
+}
+
+RUDP::EmulatedNetwork::~EmulatedNetwork()
+{
+    for (size_t i = 0; i < m_freeDatagrams.size(); i++)
+    {
+        delete m_freeDatagrams[i];
+    }
+}
+
+void RUDP::EmulatedNetwork::MakeAddress(sockaddr_storage *address, uint32_t ipv4, uint16_t port)
+{
+    memset(address, 0, sizeof(*address));
+    sockaddr_in *in = (sockaddr_in*)address;
+    in->sin_family = AF_INET;
+    in->sin_addr.s_addr = htonl(ipv4);
+    in->sin_port = htons(port);
+}
+
+RUDP::EmulatedNetwork::Link *RUDP::EmulatedNetwork::getLink(const RUDP::LinkKey *key)
+{
+    Link *link = m_links.find(key);
+    if (!link)
+    {
+        link = m_links.insert(key, m_defaultConditions);
+        m_linkList.push_back(link);
+    }
+    
+    return link;
+}
+
+void RUDP::EmulatedNetwork::setDefaultConditions(const RUDP::LinkConditions &conditions)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_defaultConditions = conditions;
+    
+    for (size_t i = 0; i < m_linkList.size(); i++)
+    {
+        if (!m_linkList[i]->m_hasOwnConditions)
+        {
+            m_linkList[i]->m_conditions = conditions;
+        }
+    }
+}
+
+void RUDP::EmulatedNetwork::setConditions(const sockaddr_storage *from, const sockaddr_storage *to, const RUDP::LinkConditions &conditions)
+{
+    RUDP::LinkKey key;
+    key.m_from.set(from);
+    key.m_to.set(to);
+    
+    std::lock_guard<std::mutex> guard(m_lock);
+    Link *link = getLink(&key);
+    link->m_conditions = conditions;
+    link->m_hasOwnConditions = true;
+}
+
+bool RUDP::EmulatedNetwork::getLinkStats(const sockaddr_storage *from, const sockaddr_storage *to, RUDP::LinkStats *stats)
+{
+    RUDP::LinkKey key;
+    key.m_from.set(from);
+    key.m_to.set(to);
+    
+    std::lock_guard<std::mutex> guard(m_lock);
+    Link *link = m_links.find(&key);
+    if (!link)
+    {
+        stats->clear();
+        return false;
+    }
+    
+    *stats = link->m_stats;
+    return true;
+}
+
+void RUDP::EmulatedNetwork::getStats(RUDP::LinkStats *stats)
+{
+    stats->clear();
+    
+    std::lock_guard<std::mutex> guard(m_lock);
+    for (size_t i = 0; i < m_linkList.size(); i++)
+    {
+        stats->add(m_linkList[i]->m_stats);
+    }
+}
+
+uint64_t RUDP::EmulatedNetwork::getNumQueued()
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    return m_numQueued;
+}
+
+uint64_t RUDP::EmulatedNetwork::getMaxQueued()
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    return m_maxQueued;
+}
+
+void RUDP::EmulatedNetwork::setDeliveryCallback(RUDP::DeliveryCallback callback, void *context)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_deliveryCallback = callback;
+    m_deliveryContext = context;
+}
+
+void RUDP::EmulatedNetwork::attach(RUDP::EmulatedTransport *transport)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    if (m_endpoints.find(&transport->m_key))
+    {
+        RUDP::Print::f("Emulated address already in use\n");
+        return;
+    }
+    
+    m_endpoints.insert(&transport->m_key, transport);
+}
+
+void RUDP::EmulatedNetwork::detach(RUDP::EmulatedTransport *transport)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    Endpoint *endpoint = m_endpoints.find(&transport->m_key);
+    if (endpoint && endpoint->m_transport == transport)
+    {
+        m_endpoints.remove(&transport->m_key);
+    }
+    
+    for (size_t i = 0; i < transport->m_inbox.size(); i++)
+    {
+        recycle(transport->m_inbox[i]);
+    }
+    
+    transport->m_inbox.clear();
+    transport->m_nextDue = UINT64_MAX;
+}
+
+void RUDP::EmulatedNetwork::recycle(RUDP::EmulatedDatagram *datagram)
+{
+    m_freeDatagrams.push_back(datagram);
+    m_numQueued--;
+}
+
+void RUDP::EmulatedNetwork::deliver(RUDP::EmulatedTransport *target, const RUDP::EmulatedDatagram *datagram)
+{
+    if (target->m_inboxLimit && target->m_inbox.size() >= target->m_inboxLimit)
+    {
+        target->m_numDropped++;
+        return;
+    }
+    
+    RUDP::EmulatedDatagram *copy;
+    if (m_freeDatagrams.empty())
+    {
+        copy = new RUDP::EmulatedDatagram;
+    }
+    else
+    {
+        copy = m_freeDatagrams.back();
+        m_freeDatagrams.pop_back();
+    }
+    
+    copy->m_due = datagram->m_due;
+    copy->m_order = m_nextOrder++;
+    copy->m_source = datagram->m_source;
+    copy->m_size = datagram->m_size;
+    memcpy(copy->m_data, datagram->m_data, datagram->m_size);
+    
+    target->m_inbox.push_back(copy);
+    std::push_heap(target->m_inbox.begin(), target->m_inbox.end(), LaterDue());
+    target->m_nextDue = target->m_inbox.front()->m_due;
+    
+    m_numQueued++;
+    m_maxQueued = std::max(m_maxQueued, m_numQueued);
+    
+    target->m_arrivalEvent.signal();
+    
+    if (m_deliveryCallback)
+    {
+        m_deliveryCallback(target, copy->m_due, m_deliveryContext);
+    }
+}
+
+void RUDP::EmulatedNetwork::send(RUDP::EmulatedTransport *source, const RUDP::TransportBuffer *buffers, size_t numBuffers, const sockaddr_storage *target)
+{
+    RUDP::EmulatedDatagram datagram;
+    datagram.m_size = 0;
+    
+    size_t size = 0;
+    for (size_t i = 0; i < numBuffers; i++)
+    {
+        size += buffers[i].m_dataLen;
+    }
+    
+    RUDP::LinkKey key;
+    key.m_from = source->m_key;
+    key.m_to.set(target);
+    
+    uint64_t now = RUDP::Clock::now();
+    
+    std::lock_guard<std::mutex> guard(m_lock);
+    Link *link = getLink(&key);
+    const RUDP::LinkConditions &conditions = link->m_conditions;
+    
+    link->m_stats.m_numSent++;
+    link->m_stats.m_numBytesSent += size;
+    
+    if (size > sizeof(datagram.m_data) || (conditions.m_mtu && size > conditions.m_mtu))
+    {
+        link->m_stats.m_numOversized++;
+        return;
+    }
+    
+    // step the loss state before deciding, so a burst starts with the datagram that entered it
+    if (link->m_isBad)
+    {
+        link->m_isBad = !m_random.chance(conditions.m_badToGood);
+    }
+    else
+    {
+        link->m_isBad = m_random.chance(conditions.m_goodToBad);
+    }
+    
+    if (m_random.chance(link->m_isBad ? conditions.m_badLossRate : conditions.m_lossRate))
+    {
+        link->m_stats.m_numLost++;
+        return;
+    }
+    
+    uint64_t departure = now;
+    if (conditions.m_bytesPerSecond)
+    {
+        uint64_t start = std::max(now, link->m_busyUntil);
+        uint64_t backlog = (start - now) * conditions.m_bytesPerSecond / 1000000;
+        if (conditions.m_queueBytes && backlog + size > conditions.m_queueBytes)
+        {
+            link->m_stats.m_numQueueDrops++;
+            return;
+        }
+        
+        departure = start + size * 1000000 / conditions.m_bytesPerSecond;
+        link->m_busyUntil = departure;
+    }
+    
+    Endpoint *endpoint = m_endpoints.find(&key.m_to);
+    if (!endpoint)
+    {
+        link->m_stats.m_numLost++;
+        return;
+    }
+    
+    for (size_t i = 0; i < numBuffers; i++)
+    {
+        memcpy(datagram.m_data + datagram.m_size, buffers[i].m_data, buffers[i].m_dataLen);
+        datagram.m_size += (uint32_t)buffers[i].m_dataLen;
+    }
+    
+    source->getAddress(&datagram.m_source);
+    
+    int copies = 1;
+    if (m_random.chance(conditions.m_duplicateRate))
+    {
+        copies = 2;
+        link->m_stats.m_numDuplicated++;
+    }
+    
+    for (int i = 0; i < copies; i++)
+    {
+        datagram.m_due = departure + conditions.m_delayUs;
+        if (conditions.m_jitterUs)
+        {
+            datagram.m_due += m_random.nextUpTo(conditions.m_jitterUs);
+        }
+        
+        if (m_random.chance(conditions.m_reorderRate))
+        {
+            datagram.m_due += conditions.m_reorderDelayUs;
+            link->m_stats.m_numReordered++;
+        }
+        
+        link->m_stats.m_numDelivered++;
+        deliver(endpoint->m_transport, &datagram);
+    }
+}
+
+RUDP::EmulatedTransport::EmulatedTransport(RUDP::EmulatedNetwork *network, const sockaddr_storage *address) :
+m_network(network),
+m_nextDue(UINT64_MAX),
+m_inboxLimit(0),
+m_numDropped(0),
+m_userData(NULL)
+{
+    m_address = *address;
+    m_key.set(address);
+    m_arrivalEvent.open();
+    m_network->attach(this);
+}
+
+RUDP::EmulatedTransport::EmulatedTransport(RUDP::EmulatedNetwork *network, uint32_t ipv4, uint16_t port) :
+m_network(network),
+m_nextDue(UINT64_MAX),
+m_inboxLimit(0),
+m_numDropped(0),
+m_userData(NULL)
+{
+    RUDP::EmulatedNetwork::MakeAddress(&m_address, ipv4, port);
+    m_key.set(&m_address);
+    m_arrivalEvent.open();
+    m_network->attach(this);
+}
+
+RUDP::EmulatedTransport::~EmulatedTransport()
+{
+    m_network->detach(this);
+}
+
+void RUDP::EmulatedTransport::setReceiveLimit(size_t numDatagrams)
+{
+    std::lock_guard<std::mutex> guard(m_network->m_lock);
+    m_inboxLimit = numDatagrams;
+}
+
+uint64_t RUDP::EmulatedTransport::getNextDue()
+{
+    return m_nextDue.load(std::memory_order_acquire);
+}
+
+void RUDP::EmulatedTransport::setUserData(void *userData)
+{
+    m_userData = userData;
+}
+
+void *RUDP::EmulatedTransport::getUserData()
+{
+    return m_userData;
+}
+
+bool RUDP::EmulatedTransport::send(const RUDP::TransportBuffer *buffers, size_t numBuffers, const sockaddr_storage *target)
+{
+    m_network->send(this, buffers, numBuffers, target);
+    return true;
+}
+
+ssize_t RUDP::EmulatedTransport::receive(char *buffer, size_t bufferLen, sockaddr_storage *sender)
+{
+    // the socket polls far more often than anything arrives, keep the empty case off the lock
+    uint64_t now = RUDP::Clock::now();
+    if (m_nextDue.load(std::memory_order_acquire) > now)
+    {
+        return 0;
+    }
+    
+    std::lock_guard<std::mutex> guard(m_network->m_lock);
+    if (m_inbox.empty() || m_inbox.front()->m_due > now)
+    {
+        return 0;
+    }
+    
+    std::pop_heap(m_inbox.begin(), m_inbox.end(), LaterDue());
+    RUDP::EmulatedDatagram *datagram = m_inbox.back();
+    m_inbox.pop_back();
+    m_nextDue = m_inbox.empty() ? UINT64_MAX : m_inbox.front()->m_due;
+    
+    // like a udp socket, anything past the buffer is cut off
+    size_t size = std::min((size_t)datagram->m_size, bufferLen);
+    memcpy(buffer, datagram->m_data, size);
+    *sender = datagram->m_source;
+    
+    m_network->recycle(datagram);
+    return (ssize_t)size;
+}
+
+void RUDP::EmulatedTransport::wait(RUDP::Event *wakeup, uint64_t ms)
+{
+    // reset before reading m_nextDue so an arrival in between still ends the wait
+    m_arrivalEvent.reset();
+    
+    uint64_t now = RUDP::Clock::now();
+    uint64_t nextDue = m_nextDue.load(std::memory_order_acquire);
+    if (nextDue <= now)
+    {
+        return;
+    }
+    
+    if (nextDue != UINT64_MAX)
+    {
+        ms = std::min(ms, (nextDue - now + 999) / 1000);
+    }
+
+#ifdef _WIN32
+    HANDLE handles[2] = { m_arrivalEvent.getHandle(), wakeup->getHandle() };
+    WaitForMultipleObjects(2, handles, FALSE, (DWORD)ms);
+#else
+    pollfd fds[2] = {};
+    fds[0].fd = m_arrivalEvent.getHandle();
+    fds[0].events = POLLIN;
+    fds[1].fd = wakeup->getHandle();
+    fds[1].events = POLLIN;
+    ::poll(fds, 2, (int)ms);
+#endif
+}
+
+uint64_t RUDP::EmulatedTransport::getNumDropped()
+{
+    return m_numDropped;
+}
+
+void RUDP::EmulatedTransport::getAddress(sockaddr_storage *address)
+{
+    *address = m_address;
+}
\ No newline at end of file
@@ -0,0 +1,132 @@
+//
+//  event.cpp
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+#include <RUDP/event.h>
+#include <RUDP/util.h>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#elif !defined(_WIN32)
+#include <fcntl.h>
+#endif
+
+RUDP::Event::Event() :
+m_handle(RUDP_INVALIDEVENT),
+#if !defined(_WIN32) && !defined(__linux__)
+m_writeHandle(RUDP_INVALIDEVENT),
+#endif
+m_isSignaled(false)
+{
+    
+}
+
+RUDP::Event::~Event()
+{
+    close();
+}
+
+bool RUDP::Event::open()
+{
+    if (m_handle != RUDP_INVALIDEVENT)
+    {
+        return true;
+    }
+    
+#if defined(_WIN32)
+    m_handle = CreateEvent(NULL, TRUE, FALSE, NULL);
+#elif defined(__linux__)
+    m_handle = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#else
+    int fds[2];
+    if (pipe(fds) == 0)
+    {
+        fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+        m_handle = fds[0];
+        m_writeHandle = fds[1];
+    }
+#endif
+    
+    if (m_handle == RUDP_INVALIDEVENT)
+    {
+        RUDP::Print::f("Error creating event handle\n");
+        return false;
+    }
+    
+    return true;
+}
+
+void RUDP::Event::close()
+{
+    if (m_handle == RUDP_INVALIDEVENT)
+    {
+        return;
+    }
+    
+#if defined(_WIN32)
+    CloseHandle(m_handle);
+#else
+    ::close(m_handle);
+#if !defined(__linux__)
+    ::close(m_writeHandle);
+    m_writeHandle = RUDP_INVALIDEVENT;
+#endif
+#endif
+    
+    m_handle = RUDP_INVALIDEVENT;
+}
+
+void RUDP::Event::signal()
+{
+    if (m_handle == RUDP_INVALIDEVENT || m_isSignaled.exchange(true))
+    {
+        return;
+    }
+    
+#if defined(_WIN32)
+    SetEvent(m_handle);
+#elif defined(__linux__)
+    uint64_t value = 1;
+    ssize_t written = write(m_handle, &value, sizeof(value));
+    (void)written;
+#else
+    char value = 1;
+    ssize_t written = write(m_writeHandle, &value, sizeof(value));
+    (void)written;
+#endif
+}
+
+void RUDP::Event::reset()
+{
+    if (m_handle == RUDP_INVALIDEVENT || !m_isSignaled.load())
+    {
+        return;
+    }
+    
+#if defined(_WIN32)
+    ResetEvent(m_handle);
+#elif defined(__linux__)
+    uint64_t value = 0;
+    ssize_t numRead = read(m_handle, &value, sizeof(value));
+    (void)numRead;
+#else
+    char buffer[64];
+    while (read(m_handle, buffer, sizeof(buffer)) > 0)
+    {
+        
+    }
+#endif
+    
+    // cleared after draining, a signal skipped in between belongs to data the caller
+    // picks up after the reset anyway
+    m_isSignaled.store(false);
+}
+
+RUDP::EventHandle RUDP::Event::getHandle()
+{
+    return m_handle;
+}
\ No newline at end of file
@@ -0,0 +1,106 @@
+//
+//  histogram.cpp
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+#include <RUDP/histogram.h>
+#include <string.h>
+#include <math.h>
+
+namespace
+{
+    uint64_t HighestInBucket(uint32_t bucket)
+    {
+        if (bucket < RUDP::HistogramSubBuckets)
+        {
+            return bucket;
+        }
+        
+        uint32_t shift = bucket / RUDP::HistogramSubBuckets - 1;
+        uint64_t lowest = (uint64_t)(RUDP::HistogramSubBuckets + bucket % RUDP::HistogramSubBuckets) << shift;
+        return lowest + (1ULL << shift) - 1;
+    }
+}
+
+void RUDP::HistogramSnapshot::clear()
+{
+    memset(m_counts, 0, sizeof(m_counts));
+}
+
+void RUDP::HistogramSnapshot::add(const RUDP::HistogramSnapshot &other)
+{
+    for (uint32_t i = 0; i < RUDP::HistogramNumBuckets; i++)
+    {
+        m_counts[i] += other.m_counts[i];
+    }
+}
+
+uint64_t RUDP::HistogramSnapshot::getCount() const
+{
+    uint64_t total = 0;
+    
+    for (uint32_t i = 0; i < RUDP::HistogramNumBuckets; i++)
+    {
+        total += m_counts[i];
+    }
+    
+    return total;
+}
+
+uint64_t RUDP::HistogramSnapshot::getMax() const
+{
+    for (uint32_t i = RUDP::HistogramNumBuckets; i > 0; i--)
+    {
+        if (m_counts[i - 1] > 0)
+        {
+            return HighestInBucket(i - 1);
+        }
+    }
+    
+    return 0;
+}
+
+uint64_t RUDP::HistogramSnapshot::getPercentile(double percentile) const
+{
+    uint64_t total = getCount();
+    if (total == 0)
+    {
+        return 0;
+    }
+    
+    // rank of the sample at the percentile, the first sample has rank 1
+    double clamped = percentile < 0 ? 0 : (percentile > 100 ? 100 : percentile);
+    uint64_t rank = (uint64_t)ceil(clamped / 100.0 * (double)total);
+    rank = rank == 0 ? 1 : rank;
+    
+    uint64_t seen = 0;
+    
+    for (uint32_t i = 0; i < RUDP::HistogramNumBuckets; i++)
+    {
+        seen += m_counts[i];
+        if (seen >= rank)
+        {
+            return HighestInBucket(i);
+        }
+    }
+    
+    return getMax();
+}
+
+RUDP::Histogram::Histogram()
+{
+    for (uint32_t i = 0; i < RUDP::HistogramNumBuckets; i++)
+    {
+        m_counts[i] = 0;
+    }
+}
+
+void RUDP::Histogram::read(RUDP::HistogramSnapshot *snapshot)
+{
+    for (uint32_t i = 0; i < RUDP::HistogramNumBuckets; i++)
+    {
+        snapshot->m_counts[i] += m_counts[i].load(std::memory_order_relaxed);
+    }
+}
\ No newline at end of file
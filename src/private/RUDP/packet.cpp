@@ -8,6 +8,138 @@
 
 #include <RUDP/packet.h>
 #include <RUDP/platform.h>
+#include <RUDP/nodestore.h>
+
+RUDP::SharedPayload::SharedPayload(size_t dataLen) :
+m_data(new char[dataLen > 0 ? dataLen : 1]),
+m_dataLen(dataLen)
+{
+    m_refCount = 1;
+}
+
+RUDP::SharedPayload::~SharedPayload()
+{
+    delete[] m_data;
+}
+
+RUDP::SharedPayload *RUDP::SharedPayload::create(const char *data, size_t dataLen)
+{
+    RUDP::MessageSpan span = { data, dataLen };
+    return create(&span, 1);
+}
+
+RUDP::SharedPayload *RUDP::SharedPayload::create(const RUDP::MessageSpan *spans, size_t numSpans)
+{
+    size_t dataLen = 0;
+    for (size_t i = 0; i < numSpans; i++)
+    {
+        dataLen += spans[i].m_dataLen;
+    }
+    
+    RUDP::SharedPayload *payload = new RUDP::SharedPayload(dataLen);
+    
+    char *dst = payload->m_data;
+    for (size_t i = 0; i < numSpans; i++)
+    {
+        memcpy(dst, spans[i].m_data, spans[i].m_dataLen);
+        dst += spans[i].m_dataLen;
+    }
+    
+    return payload;
+}
+
+void RUDP::SharedPayload::acquire()
+{
+    std::atomic_fetch_add(&m_refCount, 1u);
+}
+
+void RUDP::SharedPayload::release()
+{
+    if (std::atomic_fetch_sub(&m_refCount, 1u) == 1)
+    {
+        delete this;
+    }
+}
+
+const char *RUDP::SharedPayload::getData()
+{
+    return m_data;
+}
+
+size_t RUDP::SharedPayload::getDataLen()
+{
+    return m_dataLen;
+}
+
+RUDP::Packet::Packet(const RUDP::Packet &other) : m_payload(NULL), m_payloadData(NULL), m_channel(NULL)
+{
+    *this = other;
+}
+
+RUDP::Packet &RUDP::Packet::operator=(const RUDP::Packet &other)
+{
+    if (this == &other)
+    {
+        return *this;
+    }
+    
+    if (other.m_payload)
+    {
+        other.m_payload->acquire();
+    }
+    
+    if (m_payload)
+    {
+        m_payload->release();
+    }
+    
+    // only the used part of the buffer is worth copying
+    memcpy(m_buffer, other.m_buffer, sizeof(RUDP::PacketHeader) + (other.m_payload ? 0 : other.m_writePosition));
+    m_targetAddr = other.m_targetAddr;
+    m_peerKey = other.m_peerKey;
+    m_timestamp = other.m_timestamp;
+    m_deadline = other.m_deadline;
+    m_payload = other.m_payload;
+    m_payloadData = other.m_payloadData;
+    m_channel = other.m_channel;
+    m_isResent = other.m_isResent;
+    m_readPosition = other.m_readPosition;
+    m_writePosition = other.m_writePosition;
+    m_sendWeight = other.m_sendWeight;
+    m_sendClass = other.m_sendClass;
+    
+    return *this;
+}
+
+RUDP::Packet::~Packet()
+{
+    if (m_payload)
+    {
+        m_payload->release();
+    }
+}
+
+void RUDP::Packet::setPayload(RUDP::SharedPayload *payload, size_t offset, uint16_t len)
+{
+    if (payload)
+    {
+        payload->acquire();
+    }
+    
+    if (m_payload)
+    {
+        m_payload->release();
+    }
+    
+    m_payload = payload;
+    m_payloadData = payload ? payload->getData() + offset : NULL;
+    m_writePosition = payload ? len : 0;
+}
+
+RUDP::SharedPayload *RUDP::Packet::getPayload()
+{
+    return m_payload;
+}
 
 void RUDP::Packet::setHeader(RUDP::PacketHeader *header)
 {
@@ -25,6 +157,11 @@ sockaddr_storage *RUDP::Packet::getTargetAddr()
     return &m_targetAddr;
 }
 
+RUDP::PeerKey *RUDP::Packet::getPeerKey()
+{
+    return &m_peerKey;
+}
+
 void RUDP::Packet::setTargetAddr(sockaddr_storage *addr)
 {
     m_targetAddr = *addr;
@@ -52,6 +189,57 @@ uint16_t RUDP::Packet::write(RUDP::Packet *buffer, size_t len)
     return write(buffer->getUserDataPtr(), len);
 }
 
+void RUDP::Packet::setSendPriority(uint8_t priorityClass, uint16_t weight)
+{
+    m_sendClass = priorityClass;
+    m_sendWeight = weight;
+}
+
+uint8_t RUDP::Packet::getSendClass()
+{
+    return m_sendClass;
+}
+
+uint16_t RUDP::Packet::getSendWeight()
+{
+    return m_sendWeight;
+}
+
+void RUDP::Packet::setChannel(RUDP::Channel *channel)
+{
+    m_channel = channel;
+}
+
+RUDP::Channel *RUDP::Packet::getChannel()
+{
+    return m_channel;
+}
+
+void RUDP::Packet::setResent(bool isResent)
+{
+    m_isResent = isResent;
+}
+
+bool RUDP::Packet::isResent()
+{
+    return m_isResent;
+}
+
+void RUDP::Packet::setDeadline(uint64_t us)
+{
+    m_deadline = us;
+}
+
+uint64_t RUDP::Packet::getDeadline()
+{
+    return m_deadline;
+}
+
+bool RUDP::Packet::isExpired(uint64_t now)
+{
+    return m_deadline != 0 && now >= m_deadline;
+}
+
 void RUDP::Packet::setTimestamp(uint64_t time)
 {
     m_timestamp = time;
@@ -69,7 +257,7 @@ const char *RUDP::Packet::getDataPtr()
 
 const char *RUDP::Packet::getUserDataPtr()
 {
-    return m_buffer + sizeof(PacketHeader);
+    return m_payloadData ? m_payloadData : m_buffer + sizeof(PacketHeader);
 }
 
 uint16_t RUDP::Packet::getTotalSize()
@@ -112,4 +300,33 @@ bool RUDP::Packet::setReadPosition(uint16_t len)
     }
     
     return false;
+}
+
+bool RUDP::MessageStart::initFragments(uint16_t numFragments)
+{
+    memset(m_received, 0, sizeof(m_received));
+    
+    if (numFragments <= RUDP::InlineFragments)
+    {
+        return true;
+    }
+    
+    RUDP::Node<RUDP::FragmentBitmap> *node = RUDP::NodeStore<RUDP::FragmentBitmap>::secure();
+    if (!node)
+    {
+        return false;
+    }
+    
+    m_overflow = &node->m_obj;
+    memset(m_overflow->m_bits, 0, (numFragments + 63) / 64 * sizeof(uint64_t));
+    return true;
+}
+
+void RUDP::MessageStart::releaseFragments()
+{
+    if (m_overflow)
+    {
+        RUDP::NodeStore<RUDP::FragmentBitmap>::free(m_overflow);
+        m_overflow = NULL;
+    }
 }
\ No newline at end of file
@@ -6,101 +6,356 @@
 //  Copyright (c) 2016 Timothy Smale. All rights reserved.
 //
 #include <RUDP/peer.h>
+#include <RUDP/clock.h>
+#include <RUDP/shard.h>
 #include <RUDP/socket.h>
 
+// first set bit at or after start in a 256 bit mask, wrapping around, or -1
+static int findNextSet(const uint64_t *mask, uint32_t start)
+{
+    for (uint32_t i = 0; i <= 4; i++)
+    {
+        uint32_t word = ((start / 64) + i) % 4;
+        uint64_t bits = mask[word];
+        
+        if (i == 0)
+        {
+            bits &= ~0ULL << (start % 64);
+        }
+        else if (i == 4)
+        {
+            bits &= (1ULL << (start % 64)) - 1;
+        }
+        
+        if (bits)
+        {
+            return (int)(word * 64 + RUDP::countTrailingZeros64(bits));
+        }
+    }
+    
+    return -1;
+}
+
 void RUDP::PeerMessage::prepareForReceiving(char *messageBuffer, size_t bufferLen)
 {
     m_data = messageBuffer;
     m_dataLen = bufferLen;
+    m_spans = NULL;
+    m_numSpans = 0;
+    m_payload = NULL;
     m_channel = 0;
     m_peer = NULL;
+    m_userData = NULL;
+    m_timeToLive = 0;
 }
 
 void RUDP::PeerMessage::prepareForSending(char *dataToSend, size_t dataLen, RUDP::Peer *target, RUDP::ChannelId channel)
 {
     m_data = dataToSend;
     m_dataLen = dataLen;
+    m_spans = NULL;
+    m_numSpans = 0;
+    m_payload = NULL;
+    m_channel = channel;
+    m_peer = target;
+    m_userData = NULL;
+    m_timeToLive = 0;
+}
+
+void RUDP::PeerMessage::prepareForSending(const RUDP::MessageSpan *spans, size_t numSpans, RUDP::Peer *target, RUDP::ChannelId channel)
+{
+    m_data = NULL;
+    m_dataLen = 0;
+    m_spans = spans;
+    m_numSpans = numSpans;
+    m_payload = NULL;
+    m_channel = channel;
+    m_peer = target;
+    m_userData = NULL;
+    m_timeToLive = 0;
+    
+    for (size_t i = 0; i < numSpans; i++)
+    {
+        m_dataLen += spans[i].m_dataLen;
+    }
+}
+
+void RUDP::PeerMessage::prepareForSending(RUDP::SharedPayload *payload, RUDP::Peer *target, RUDP::ChannelId channel)
+{
+    m_data = NULL;
+    m_dataLen = payload->getDataLen();
+    m_spans = NULL;
+    m_numSpans = 0;
+    m_payload = payload;
     m_channel = channel;
     m_peer = target;
+    m_userData = NULL;
+    m_timeToLive = 0;
 }
 
 RUDP::PacketId RUDP::Peer::reservePacketsOnChannel(RUDP::ChannelId channel, RUDP::PacketId numNeeded)
 {
-    return std::atomic_fetch_add(&m_ChannelPacketIds[channel], numNeeded);
+    return std::atomic_fetch_add(&getChannel(channel, true)->m_nextPacketId, numNeeded);
 }
 
 RUDP::Peer::Peer() : Peer(NULL, NULL)
 {
-    
+
 }
 
 RUDP::Peer::Peer(RUDP::Socket *socket, sockaddr_storage *addr) :
-m_ChannelPacketIds(new std::atomic<RUDP::PacketId>[RUDP::MaxChannels]),
+m_addr(addr == NULL ? sockaddr_storage() : *addr),
+m_deliveryPolicy(RUDP::DeliveryPolicy_RoundRobin),
+m_deliveryCursor(0),
+m_isReadyListed(false),
 m_socket(socket),
-m_inQueueChannels(std::vector<RUDP::Channel>(RUDP::MaxChannels)),
-m_addr(addr == NULL ? sockaddr_storage() : *addr)
+m_shard(NULL)
 {
-    
+    memset(m_readyMask, 0, sizeof(m_readyMask));
+    m_directory.store(new RUDP::ChannelDirectory());
+    m_key.set(&m_addr);
 }
 
 RUDP::Peer::~Peer()
 {
-    delete[] m_ChannelPacketIds;
+    RUDP::ChannelDirectory *directory = m_directory.load();
+    
+    for (size_t i = 0; i < directory->m_channels.size(); i++)
+    {
+        delete directory->m_channels[i];
+    }
+    
+    delete directory;
+    
+    for (size_t i = 0; i < m_oldDirectories.size(); i++)
+    {
+        delete m_oldDirectories[i];
+    }
 }
 
-// generic hash
-uint32_t RUDP::Peer::hash()
+uint32_t RUDP::ChannelDirectory::indexOf(RUDP::ChannelId channel)
 {
-    if (!m_hash)
+    uint32_t word = channel / 64;
+    uint32_t index = RUDP::popCount64(m_mask[word] & ((1ULL << (channel % 64)) - 1));
+    
+    for (uint32_t i = 0; i < word; i++)
     {
-        m_hash = 31;
-        const char *data = (const char*)&m_addr;
-        
-        for (size_t i = 0; i < sizeof(sockaddr_storage); i++)
-        {
-            m_hash = (m_hash * 54059) ^ (data[i] * 76963);
-        }
+        index += RUDP::popCount64(m_mask[i]);
     }
     
-    return m_hash;
+    return index;
 }
 
-bool RUDP::Peer::equals(RUDP::Peer *peer)
+RUDP::Channel *RUDP::ChannelDirectory::find(RUDP::ChannelId channel)
 {
-    return memcmp(&peer->m_addr, &m_addr, sizeof(sockaddr_storage)) == 0;
+    if (!RUDP_BIT_HAS(m_mask[channel / 64], 1ULL << (channel % 64)))
+    {
+        return NULL;
+    }
+    
+    return m_channels[indexOf(channel)];
 }
 
-sockaddr_storage *RUDP::Peer::getAddress()
+void RUDP::ChannelDirectory::insert(RUDP::Channel *channel)
 {
-    return &m_addr;
+    m_channels.insert(m_channels.begin() + indexOf(channel->m_id), channel);
+    RUDP_BIT_SET(m_mask[channel->m_id / 64], 1ULL << (channel->m_id % 64));
 }
 
-bool RUDP::Peer::peekMessage(size_t &msgSize)
+RUDP::Channel *RUDP::Peer::getChannel(RUDP::ChannelId channel, bool create)
 {
-    msgSize = 0;
-    RUDP::Channel **queue = m_inQueue.peek();
+    RUDP::Channel *result = m_directory.load(std::memory_order_acquire)->find(channel);
+    if (result || !create)
+    {
+        return result;
+    }
+    
+    std::lock_guard<std::mutex> guard(m_channelLock);
+    
+    RUDP::ChannelDirectory *directory = m_directory.load(std::memory_order_relaxed);
+    result = directory->find(channel);
+    if (result)
+    {
+        return result;
+    }
+    
+    // lookups on other threads may still be reading the old directory, so it's kept until the peer goes away
+    RUDP::ChannelDirectory *grown = new RUDP::ChannelDirectory(*directory);
+    result = new RUDP::Channel(channel);
+    grown->insert(result);
+    
+    m_oldDirectories.push_back(directory);
+    m_directory.store(grown, std::memory_order_release);
+    
+    return result;
+}
+
+size_t RUDP::Peer::getNumChannels()
+{
+    return m_directory.load(std::memory_order_acquire)->m_channels.size();
+}
+
+void RUDP::Peer::getCounters(RUDP::CounterSnapshot *snapshot)
+{
+    snapshot->clear();
+    
+    RUDP::ChannelDirectory *directory = m_directory.load(std::memory_order_acquire);
+    
+    for (size_t i = 0; i < directory->m_channels.size(); i++)
+    {
+        directory->m_channels[i]->m_sendCounters.read(snapshot);
+        directory->m_channels[i]->m_receiveCounters.read(snapshot);
+    }
+}
+
+void RUDP::Peer::getLatency(RUDP::LatencyHistogram histogram, RUDP::HistogramSnapshot *snapshot)
+{
+    snapshot->clear();
+    
+    RUDP::ChannelDirectory *directory = m_directory.load(std::memory_order_acquire);
+    
+    for (size_t i = 0; i < directory->m_channels.size(); i++)
+    {
+        directory->m_channels[i]->readLatency(histogram, snapshot);
+    }
+}
+
+bool RUDP::Peer::getChannelLatency(RUDP::ChannelId channelId, RUDP::LatencyHistogram histogram, RUDP::HistogramSnapshot *snapshot)
+{
+    snapshot->clear();
+    
+    RUDP::Channel *channel = getChannel(channelId, false);
+    return channel && channel->readLatency(histogram, snapshot);
+}
+
+bool RUDP::Peer::getChannelCounters(RUDP::ChannelId channelId, RUDP::CounterSnapshot *snapshot)
+{
+    snapshot->clear();
+    
+    RUDP::Channel *channel = getChannel(channelId, false);
+    if (!channel)
+    {
+        return false;
+    }
+    
+    channel->m_sendCounters.read(snapshot);
+    channel->m_receiveCounters.read(snapshot);
+    return true;
+}
+
+void RUDP::Peer::setDeliveryPolicy(RUDP::DeliveryPolicy policy)
+{
+    m_deliveryPolicy = policy;
+}
+
+void RUDP::Peer::setChannelWeight(RUDP::ChannelId channel, uint16_t weight)
+{
+    getChannel(channel, true)->m_weight = weight == 0 ? 1 : weight;
+}
+
+void RUDP::Peer::setChannelSendPriority(RUDP::ChannelId channel, RUDP::SendPriority priorityClass, uint16_t weight)
+{
+    RUDP::Channel *target = getChannel(channel, true);
+    target->m_sendClass = priorityClass < RUDP::SendPriority_Count ? priorityClass : RUDP::SendPriority_Background;
+    target->m_sendWeight = weight == 0 ? 1 : weight;
+}
+
+void RUDP::Peer::updateReady(RUDP::Channel *channel)
+{
+    uint64_t bit = 1ULL << (channel->m_id % 64);
     
-    if (queue)
+    if (channel->m_numAvailable > 0)
     {
-        RUDP::MessageStart *msg = (*queue)->m_messages.peek();
+        RUDP_BIT_SET(m_readyMask[channel->m_id / 64], bit);
         
-        if (msg)
+        if (!m_isReadyListed && m_shard)
+        {
+            m_isReadyListed = true;
+            m_shard->addReadyPeer(this);
+        }
+        else if (!m_isReadyListed && m_socket)
+        {
+            m_isReadyListed = true;
+            m_socket->addReadyPeer(this);
+        }
+    }
+    else
+    {
+        RUDP_BIT_UNSET(m_readyMask[channel->m_id / 64], bit);
+        channel->m_deficit = 0;
+    }
+}
+
+bool RUDP::Peer::hasReadyChannels()
+{
+    return (m_readyMask[0] | m_readyMask[1] | m_readyMask[2] | m_readyMask[3]) != 0;
+}
+
+RUDP::Channel *RUDP::Peer::selectReadyChannel()
+{
+    // the selection only changes when a message is received, so peek and receive agree
+    switch (m_deliveryPolicy)
+    {
+        case RUDP::DeliveryPolicy_Priority:
+        {
+            int id = findNextSet(m_readyMask, 0);
+            return id < 0 ? NULL : getChannel((RUDP::ChannelId)id, false);
+        }
+        
+        case RUDP::DeliveryPolicy_WeightedFair:
         {
-            RUDP::Packet *pck = msg->m_first;
-            RUDP::Channel *channel = &m_inQueueChannels[pck->getHeader()->m_channelId];
+            int id = findNextSet(m_readyMask, m_deliveryCursor);
             
-            while (pck)
+            while (id >= 0)
             {
-                msgSize += pck->getUserDataSize();
+                RUDP::Channel *channel = getChannel((RUDP::ChannelId)id, false);
+                RUDP::MessageStart *msg = channel->peekMessage();
                 
-                if (RUDP_BIT_HAS(pck->getHeader()->m_flags, RUDP::PacketFlag::PacketFlag_EndOfMessage))
+                if (msg->m_size <= channel->m_deficit)
                 {
-                    break;
+                    m_deliveryCursor = (RUDP::ChannelId)id;
+                    return channel;
                 }
                 
-                pck = channel->m_queue.next(pck);
+                // out of credit, top up and give the next ready channel its turn
+                channel->m_deficit += (size_t)channel->m_weight * RUDP::PacketSize;
+                id = findNextSet(m_readyMask, (id + 1) % 256);
             }
             
+            return NULL;
+        }
+        
+        case RUDP::DeliveryPolicy_RoundRobin:
+        default:
+        {
+            int id = findNextSet(m_readyMask, m_deliveryCursor);
+            return id < 0 ? NULL : getChannel((RUDP::ChannelId)id, false);
+        }
+    }
+}
+
+sockaddr_storage *RUDP::Peer::getAddress()
+{
+    return &m_addr;
+}
+
+RUDP::PeerKey *RUDP::Peer::getKey()
+{
+    return &m_key;
+}
+
+bool RUDP::Peer::peekMessage(size_t &msgSize)
+{
+    msgSize = 0;
+    RUDP::Channel *channel = selectReadyChannel();
+    
+    if (channel)
+    {
+        RUDP::MessageStart *msg = channel->peekMessage();
+        
+        if (msg)
+        {
+            msgSize = msg->m_size;
             return true;
         }
     }
@@ -113,207 +368,616 @@ RUDP::EnqueueMessageResult RUDP::Peer::enqueueMessage(RUDP::PeerMessage *message
     PacketHeader header = {};
     header.m_channelId = message->m_channel;
     
-    if (RUDP_BIT_HAS(options, RUDP::EnqueueMessageOption_ConfirmDelivery))
+    bool isSequenced = RUDP_BIT_HAS(options, RUDP::EnqueueMessageOption_Sequenced);
+    
+    if (isSequenced)
+    {
+        RUDP_BIT_SET(header.m_flags, RUDP::PacketFlag_Sequenced);
+    }
+    
+    if (RUDP_BIT_HAS(options, RUDP::EnqueueMessageOption_ConfirmDelivery) && !isSequenced)
     {
         RUDP_BIT_SET(header.m_flags, RUDP::PacketFlag_ConfirmDelivery);
     }
     
-    if (RUDP_BIT_HAS(options, RUDP::EnqueueMessageOption_InOrder))
+    if (RUDP_BIT_HAS(options, RUDP::EnqueueMessageOption_InOrder) && !isSequenced)
     {
         RUDP_BIT_SET(header.m_flags, RUDP::PacketFlag_InOrder);
     }
     
     size_t sizeofHeader = sizeof(RUDP::PacketHeader);
     size_t spaceForMessage = RUDP::PacketSize - sizeofHeader;
-    const char *toWrite = message->m_data;
     
-    uint16_t numPacketsNeeded = message->m_dataLen / spaceForMessage;
+    // a plain buffer is gathered as a single span
+    RUDP::MessageSpan single = { message->m_data, message->m_dataLen };
+    const RUDP::MessageSpan *spans = message->m_spans ? message->m_spans : &single;
+    size_t numSpans = message->m_spans ? message->m_numSpans : 1;
+    size_t spanIndex = 0;
+    size_t spanOffset = 0;
+    
+    size_t numPacketsNeeded = message->m_dataLen / spaceForMessage;
     numPacketsNeeded += (message->m_dataLen % spaceForMessage) != 0;
     
-    RUDP::PacketId packetId = reservePacketsOnChannel(message->m_channel, numPacketsNeeded);
-    bool start = true;
+    if (numPacketsNeeded > RUDP::MaxFragments)
+    {
+        return RUDP::EnqueueMessageResult_MessageTooLarge;
+    }
+    
+    header.m_numFragments = (uint16_t)numPacketsNeeded;
+    
+    RUDP::Channel *channel = getChannel(message->m_channel, true);
+    bool isReliable = RUDP_BIT_HAS(header.m_flags, RUDP::PacketFlag_ConfirmDelivery);
+    
+    // held back until the oldest reliable message still unsettled is acknowledged or skipped
+    RUDP::PacketId nextId = channel->m_nextPacketId;
+    RUDP::PacketId settledBefore = channel->getSettledBefore();
+    
+    if (settledBefore != nextId && (uint16_t)(nextId - settledBefore) + numPacketsNeeded > RUDP::MaxUnsettledSpan)
+    {
+        return RUDP::EnqueueMessageResult_OutQueueFull;
+    }
+    
+    uint64_t now = RUDP::Clock::now();
+    uint64_t deadline = message->m_timeToLive > 0 ? now + message->m_timeToLive * 1000ULL : 0;
+    
+    // build the fragments on the side so a failure leaves the out queue untouched
+    RUDP::List<RUDP::Packet> fragments;
+    size_t dataLeft = message->m_dataLen;
     
-    uint16_t numPacketsEnqueued = 0;
-    for (size_t dataLeft = message->m_dataLen; dataLeft > 0; /* nada */)
+    for (size_t i = 0; i < numPacketsNeeded; i++)
     {
-        size_t toWriteLen = dataLeft;
-        header.m_packetId = packetId++;
+        size_t toWriteLen = dataLeft > spaceForMessage ? spaceForMessage : dataLeft;
         
-        if (start)
+        if (i == 0)
         {
             RUDP_BIT_SET(header.m_flags, RUDP::PacketFlag_StartOfMessage);
-            start = false;
+        }
+        else
+        {
+            RUDP_BIT_UNSET(header.m_flags, RUDP::PacketFlag_StartOfMessage);
         }
         
-        if (spaceForMessage > dataLeft)
+        if (i == numPacketsNeeded - 1)
         {
             RUDP_BIT_SET(header.m_flags, RUDP::PacketFlag_EndOfMessage);
         }
         else
         {
-            toWriteLen = spaceForMessage;
             RUDP_BIT_UNSET(header.m_flags, RUDP::PacketFlag_EndOfMessage);
         }
         
-        RUDP::Packet *writeBuffer = m_outQueue.push();
-        if (writeBuffer)
+        RUDP::Packet *writeBuffer = fragments.push();
+        if (!writeBuffer)
         {
-            writeBuffer->setWritePosition(0);
-            writeBuffer->setHeader(&header);
-            writeBuffer->write(toWrite, toWriteLen);
-            writeBuffer->setTargetAddr(message->m_peer->getAddress());
-            
-            dataLeft -= toWriteLen;
-            toWrite += toWriteLen;
-            numPacketsEnqueued++;
+            return RUDP::EnqueueMessageResult_OutQueueFull;
+        }
+        
+        writeBuffer->setWritePosition(0);
+        writeBuffer->setHeader(&header);
+        writeBuffer->setTargetAddr(&m_addr);
+        *writeBuffer->getPeerKey() = m_key;
+        writeBuffer->setSendPriority(channel->m_sendClass, channel->m_sendWeight);
+        writeBuffer->setChannel(channel);
+        writeBuffer->setDeadline(deadline);
+        
+        if (message->m_payload)
+        {
+            writeBuffer->setPayload(message->m_payload, message->m_dataLen - dataLeft, (uint16_t)toWriteLen);
         }
         else
         {
-            for (uint16_t i = 0; i < numPacketsEnqueued; i++)
+            for (size_t written = 0; written < toWriteLen; /* nada */)
             {
-                m_outQueue.pop();
+                size_t available = spans[spanIndex].m_dataLen - spanOffset;
+                size_t toCopy = toWriteLen - written < available ? toWriteLen - written : available;
+                
+                writeBuffer->write(spans[spanIndex].m_data + spanOffset, toCopy);
+                written += toCopy;
+                spanOffset += toCopy;
+                
+                if (spanOffset == spans[spanIndex].m_dataLen && spanIndex + 1 < numSpans)
+                {
+                    spanIndex++;
+                    spanOffset = 0;
+                }
             }
         }
+        
+        dataLeft -= toWriteLen;
+    }
+    
+    RUDP::List<RUDP::PendingMessage> pending;
+    
+    if (isReliable && !channel->stagePending(&pending, (uint16_t)numPacketsNeeded, message->m_userData, now))
+    {
+        return RUDP::EnqueueMessageResult_OutQueueFull;
+    }
+    
+    // the ids are taken once nothing can fail anymore, a reserved id that is never sent would leave
+    // the receiver waiting for it
+    RUDP::PacketId messageId = reservePacketsOnChannel(message->m_channel, (RUDP::PacketId)numPacketsNeeded);
+    RUDP::PacketId packetId = messageId;
+    
+    for (RUDP::Packet *pck = fragments.peek(); pck != NULL; pck = fragments.next(pck))
+    {
+        pck->getHeader()->m_packetId = packetId++;
+        pck->getHeader()->m_messageId = messageId;
     }
     
+    // registered before the fragments go out so nothing has to be taken back from the thread handling acks
+    if (isReliable)
+    {
+        channel->addPending(&pending, messageId);
+    }
+    
+    // one splice publishes every fragment, so concurrent senders never interleave them. older sequenced
+    // messages that haven't been sent yet are replaced by the socket's scheduler
+    m_outQueue.push(fragments.detach());
     return RUDP::EnqueueMessageResult_Success;
 }
 
-void RUDP::Peer::flushToSocket()
+bool RUDP::Peer::flushToSocket()
 {
-    m_socket->enqueueOutgoingPackets(&m_outQueue);
-    m_socket->enqueueAcknowledgments(&m_ackQueue);
+    RUDP::List<RUDP::Packet> toSend;
+    m_outQueue.popAll(&toSend);
+    
+    if (m_socket->enqueueOutgoingPackets(&toSend))
+    {
+        return true;
+    }
+    
+    // retried with the next flush, behind anything enqueued in the meantime
+    m_outQueue.push(toSend.detach());
+    return false;
 }
 
-bool RUDP::Peer::enqueueIncomingPacket(RUDP::Packet *newPck)
+void RUDP::Peer::receiveAcknowledgement(RUDP::Packet *ack)
 {
-    // look for our channel's queue
-    RUDP::PacketHeader *header = newPck->getHeader();
-    RUDP::Channel *channel = &m_inQueueChannels[header->m_channelId];
-    bool addChannel = channel->m_messages.peek() == NULL;
+    RUDP::PacketHeader *header = ack->getHeader();
+    RUDP::Channel *channel = getChannel(header->m_channelId, false);
+    void *userData = NULL;
+    
+    if (!channel)
+    {
+        return;
+    }
     
-    if (RUDP_BIT_HAS(header->m_flags, RUDP::PacketFlag_IsAck))
+    if (RUDP_BIT_HAS(header->m_flags, RUDP::PacketFlag_Stream))
     {
-        for (RUDP::Packet *pck = m_ackQueue.peek(); pck != NULL; pck = m_ackQueue.next(pck))
+        if (channel->m_streamInFlight > 0)
         {
-            if (memcmp(pck->getHeader(), header, sizeof(RUDP::PacketHeader)) == 0)
-            {
-                m_ackQueue.remove(pck);
-                break;
-            }
+            channel->m_streamInFlight--;
         }
         
-        return false;
+        return;
     }
     
-    RUDP::Packet *pck = channel->m_queue.peekEnd();
-    RUDP::MessageStart *msgAdded = NULL;
+    // an acknowledged skip settles the whole message as expired
+    bool isExpired = RUDP_BIT_HAS(header->m_flags, RUDP::PacketFlag_Skip);
+    bool isComplete = isExpired ? channel->removePending(header->m_messageId, &userData) : channel->acknowledgeFragment(header->m_messageId, &userData, ack->getTimestamp());
     
-    if (!pck)
+    if (isComplete && m_socket->m_acknowledgedCallback)
     {
-        newPck = channel->m_queue.push(newPck);
+        m_socket->m_acknowledgedCallback(this, header->m_channelId, userData, isExpired);
     }
-    else
+}
+
+size_t RUDP::Peer::writeStream(RUDP::ChannelId channelId, const char *data, size_t dataLen)
+{
+    RUDP::Channel *channel = getChannel(channelId, true);
+    size_t spaceForData = RUDP::PacketSize - sizeof(RUDP::PacketHeader);
+    size_t written = 0;
+    
+    RUDP::PacketHeader header = {};
+    header.m_channelId = channelId;
+    header.m_flags = (RUDP::PacketFlag)(RUDP::PacketFlag_Stream | RUDP::PacketFlag_ConfirmDelivery);
+    header.m_numFragments = 1;
+    
+    RUDP::List<RUDP::Packet> packets;
+    
+    while (written < dataLen && channel->m_streamInFlight < channel->m_streamWindow)
     {
-        // attempt to insert in-order
-        while (pck && pck->getHeader()->m_packetId > newPck->getHeader()->m_packetId)
+        RUDP::Packet *pck = packets.push();
+        if (!pck)
         {
-            pck = channel->m_queue.prev(pck);
+            break;
         }
         
-        if (pck)
-        {
-            newPck = channel->m_queue.pushAfter(pck, newPck);
-        }
-        else
-        {
-            newPck = channel->m_queue.pushBefore(channel->m_queue.peek(), newPck);
-        }
+        size_t toWrite = dataLen - written < spaceForData ? dataLen - written : spaceForData;
+        
+        header.m_packetId = channel->m_streamNextSend++;
+        header.m_messageId = header.m_packetId;
+        
+        pck->setWritePosition(0);
+        pck->setHeader(&header);
+        pck->write(data + written, toWrite);
+        pck->setTargetAddr(&m_addr);
+        *pck->getPeerKey() = m_key;
+        pck->setSendPriority(channel->m_sendClass, channel->m_sendWeight);
+        pck->setChannel(channel);
+        pck->setDeadline(0);
+        
+        channel->m_streamInFlight++;
+        written += toWrite;
     }
     
-    if (RUDP_BIT_HAS(header->m_flags, RUDP::PacketFlag_EndOfMessage | RUDP::PacketFlag_StartOfMessage))
+    m_outQueue.push(packets.detach());
+    return written;
+}
+
+size_t RUDP::Peer::readStream(RUDP::ChannelId channelId, char *buffer, size_t bufferLen)
+{
+    RUDP::Channel *channel = getChannel(channelId, false);
+    if (!channel)
     {
-        msgAdded = channel->addMessage(newPck, newPck);
+        return 0;
     }
     
-    else if (RUDP_BIT_HAS(header->m_flags, RUDP::PacketFlag_StartOfMessage))
+    RUDP::List<RUDP::Packet> consumed;
+    size_t numRead = channel->readStream(buffer, bufferLen, &consumed);
+    acknowledgeStream(&consumed);
+    return numRead;
+}
+
+void RUDP::Peer::setStreamWindow(RUDP::ChannelId channel, uint16_t numPackets)
+{
+    // ids are compared wrap-around aware, so the window has to stay below half the id space
+    getChannel(channel, true)->m_streamWindow = numPackets == 0 ? 1 : (numPackets > INT16_MAX ? INT16_MAX : numPackets);
+}
+
+void RUDP::Peer::receiveStream(RUDP::Packet *pck)
+{
+    RUDP::Channel *channel = getChannel(pck->getHeader()->m_channelId, true);
+    
+    // already read, so our earlier ack got lost
+    if (RUDP::PacketId_IsAfter(channel->m_streamNextRead, pck->getHeader()->m_packetId))
     {
-        RUDP::Packet *end = channel->findMessageEnd(newPck);
-        if (end)
+        RUDP::List<RUDP::Packet> consumed;
+        if (consumed.push(pck))
         {
-            msgAdded = channel->addMessage(newPck, end);
+            acknowledgeStream(&consumed);
         }
+        
+        return;
+    }
+    
+    channel->m_receiveCounters.begin();
+    channel->m_receiveCounters.add(RUDP::Counter_PacketsReceived, 1);
+    channel->m_receiveCounters.add(RUDP::Counter_BytesReceived, pck->getTotalSize());
+    channel->m_receiveCounters.end();
+    
+    channel->addStreamPacket(pck);
+}
+
+void RUDP::Peer::acknowledgeStream(RUDP::List<RUDP::Packet> *consumed)
+{
+    if (!consumed->peek())
+    {
+        return;
+    }
+    
+    // read packets are turned into their own acks
+    for (RUDP::Packet *pck = consumed->peek(); pck != NULL; pck = consumed->next(pck))
+    {
+        RUDP::PacketHeader header = *pck->getHeader();
+        RUDP_BIT_SET(header.m_flags, RUDP::PacketFlag_IsAck);
+        
+        RUDP::Channel *channel = getChannel(header.m_channelId, true);
+        
+        pck->setWritePosition(0);
+        pck->setHeader(&header);
+        pck->setTargetAddr(&m_addr);
+        *pck->getPeerKey() = m_key;
+        pck->setSendPriority(channel->m_sendClass, channel->m_sendWeight);
+        pck->setChannel(NULL);
+        pck->setDeadline(0);
     }
     
-    else if (RUDP_BIT_HAS(header->m_flags, RUDP::PacketFlag_EndOfMessage))
+    // acks that don't fit are dropped, the sender's retransmission gets acknowledged again
+    m_socket->enqueueOutgoingPackets(consumed);
+}
+
+void RUDP::Peer::acknowledgePacket(RUDP::Packet *pck, RUDP::List<RUDP::Packet> *acks)
+{
+    // an ack echoes the header of the packet it confirms and carries no data
+    RUDP::PacketHeader header = *pck->getHeader();
+    RUDP_BIT_SET(header.m_flags, RUDP::PacketFlag_IsAck);
+    
+    RUDP::Packet *ack = acks->push();
+    if (!ack)
     {
-        RUDP::Packet *start = channel->findMessageStart(newPck);
-        if (start)
+        return;
+    }
+    
+    RUDP::Channel *channel = getChannel(header.m_channelId, true);
+    
+    ack->setHeader(&header);
+    ack->setTargetAddr(&m_addr);
+    *ack->getPeerKey() = m_key;
+    ack->setSendPriority(channel->m_sendClass, channel->m_sendWeight);
+}
+
+RUDP::ReceiveResult RUDP::Peer::receiveSkip(RUDP::Packet *skip)
+{
+    RUDP::PacketHeader *header = skip->getHeader();
+    RUDP::Channel *channel = getChannel(header->m_channelId, true);
+    channel->markSettled(header->m_settledBefore);
+    
+    RUDP::ReceiveResult result = channel->skipMessage(header);
+    updateReady(channel);
+    return result;
+}
+
+RUDP::ReceiveResult RUDP::Peer::enqueueIncomingPacket(RUDP::Packet *newPck, bool isAdopted)
+{
+    // look for our channel's queue
+    RUDP::PacketHeader *header = newPck->getHeader();
+    uint16_t index = (uint16_t)(header->m_packetId - header->m_messageId);
+    if (index >= header->m_numFragments || header->m_numFragments > RUDP::MaxFragments)
+    {
+        return RUDP::ReceiveResult_Dropped;
+    }
+    
+    RUDP::Channel *channel = getChannel(header->m_channelId, true);
+    channel->markSettled(header->m_settledBefore);
+    
+    bool isNext = !channel->m_hasReceived || header->m_packetId == (RUDP::PacketId)(channel->m_lastAcknowledged + 1);
+    
+    // retransmissions whose ack got lost
+    if (channel->isDuplicate(header->m_packetId))
+    {
+        m_socket->m_numDuplicatesDropped++;
+        channel->m_receiveCounters.begin();
+        channel->m_receiveCounters.add(RUDP::Counter_Duplicates, 1);
+        channel->m_receiveCounters.end();
+        return RUDP::ReceiveResult_Known;
+    }
+    
+    channel->expireMessages();
+    
+    RUDP::MessageStart *msg = channel->findMessage(header->m_messageId);
+    if (!msg)
+    {
+        // late fragment of a message that was already delivered, skipped or given up
+        if (RUDP::PacketId_IsAfter(channel->m_nextMessageId, header->m_messageId))
         {
-            msgAdded = channel->addMessage(start, newPck);
+            return RUDP::ReceiveResult_Known;
         }
+        
+        msg = channel->addMessage(header, newPck->getTimestamp());
+        
+        while (!msg && channel->expireOldest())
+        {
+            msg = channel->addMessage(header, newPck->getTimestamp());
+        }
+        
+        if (!msg)
+        {
+            return RUDP::ReceiveResult_Dropped;
+        }
+    }
+    
+    if (msg->m_numFragments != header->m_numFragments)
+    {
+        return RUDP::ReceiveResult_Dropped;
+    }
+    
+    if (msg->m_isDelivered)
+    {
+        return RUDP::ReceiveResult_Known;
     }
     
+    if (msg->hasFragment(index))
+    {
+        m_socket->m_numDuplicatesDropped++;
+        channel->m_receiveCounters.begin();
+        channel->m_receiveCounters.add(RUDP::Counter_Duplicates, 1);
+        channel->m_receiveCounters.end();
+        return RUDP::ReceiveResult_Known;
+    }
+    
+    RUDP::Packet *pck = channel->m_queue.peekEnd();
+    
+    // attempt to insert in-order
+    while (pck && RUDP::PacketId_IsAfter(pck->getHeader()->m_packetId, header->m_packetId))
+    {
+        pck = channel->m_queue.prev(pck);
+    }
+    
+    if (isAdopted)
+    {
+        newPck = channel->m_queue.adoptAfter(pck, newPck);
+    }
+    else if (pck)
+    {
+        newPck = channel->m_queue.pushAfter(pck, newPck);
+    }
+    else if (channel->m_queue.peek())
+    {
+        newPck = channel->m_queue.pushBefore(channel->m_queue.peek(), newPck);
+    }
     else
     {
-        // look for the start
-        RUDP::Packet *start = channel->findMessageStart(newPck);
-        if (start)
-        {
-            RUDP::Packet *end = channel->findMessageEnd(newPck);
-            
-            if (end)
-            {
-                msgAdded = channel->addMessage(start, end);
-            }
-        }
+        newPck = channel->m_queue.push(newPck);
+    }
+    
+    if (!newPck)
+    {
+        return RUDP::ReceiveResult_Dropped;
+    }
+    
+    channel->markReceived(header->m_packetId);
+    
+    channel->m_receiveCounters.begin();
+    channel->m_receiveCounters.add(RUDP::Counter_PacketsReceived, 1);
+    channel->m_receiveCounters.add(RUDP::Counter_BytesReceived, newPck->getTotalSize());
+    channel->m_receiveCounters.add(RUDP::Counter_OutOfOrder, isNext ? 0 : 1);
+    channel->m_receiveCounters.end();
+    channel->updateQueueDepth(1);
+    
+    if (channel->addFragment(msg, newPck))
+    {
+        updateReady(channel);
+    }
+    
+    return RUDP::ReceiveResult_Kept;
+}
+
+bool RUDP::Peer::receiveMessage(RUDP::MessageView *view)
+{
+    RUDP::Channel *channel = selectReadyChannel();
+    if (!channel)
+    {
+        return false;
+    }
+    
+    RUDP::MessageStart *start = channel->peekMessage();
+    
+    if (m_deliveryPolicy == RUDP::DeliveryPolicy_WeightedFair)
+    {
+        channel->m_deficit -= start->m_size;
+    }
+    else if (m_deliveryPolicy == RUDP::DeliveryPolicy_RoundRobin)
+    {
+        m_deliveryCursor = channel->m_id + 1;
     }
     
-    if (addChannel)
+    holdMessage(channel, view);
+    return true;
+}
+
+bool RUDP::Peer::receiveMessage(RUDP::ChannelId channelId, RUDP::MessageView *view)
+{
+    // bypasses the delivery policy, the caller has already chosen the channel
+    RUDP::Channel *channel = getChannel(channelId, false);
+    if (!channel || !channel->peekMessage())
     {
-        m_inQueue.push(&channel);
+        return false;
     }
     
+    holdMessage(channel, view);
     return true;
 }
 
+void RUDP::Peer::holdMessage(RUDP::Channel *channel, RUDP::MessageView *view)
+{
+    RUDP::MessageStart *start = channel->peekMessage();
+    channel->holdMessage(start);
+    channel->recordLatency(RUDP::LatencyHistogram_ArrivalToDelivery, RUDP::Clock::now() - start->m_arrivalTime);
+    updateReady(channel);
+    
+    view->m_peer = this;
+    view->m_channel = channel;
+    view->m_message = start;
+}
+
 bool RUDP::Peer::receiveMessage(RUDP::PeerMessage *message)
 {
-    bool ret = false;
-    RUDP::Channel **channel = m_inQueue.peek();
+    RUDP::MessageView view;
+    if (!receiveMessage(&view))
+    {
+        return false;
+    }
     
-    if (channel)
+    message->m_dataLen = view.copyTo(message->m_data, message->m_dataLen);
+    message->m_channel = view.getChannel();
+    message->m_peer = this;
+    
+    view.release();
+    return true;
+}
+
+bool RUDP::MessageView::isValid()
+{
+    return m_message != NULL;
+}
+
+RUDP::Peer *RUDP::MessageView::getPeer()
+{
+    return m_peer;
+}
+
+RUDP::ChannelId RUDP::MessageView::getChannel()
+{
+    return m_channel ? m_channel->m_id : 0;
+}
+
+size_t RUDP::MessageView::getSize()
+{
+    return m_message ? m_message->m_size : 0;
+}
+
+uint16_t RUDP::MessageView::getNumSpans()
+{
+    return m_message ? m_message->m_numFragments : 0;
+}
+
+size_t RUDP::MessageView::getSpans(RUDP::MessageSpan *spans, size_t maxSpans)
+{
+    size_t numSpans = 0;
+    RUDP::Packet *pck = m_message ? m_message->m_first : NULL;
+    
+    while (pck && numSpans < maxSpans)
     {
-        RUDP::MessageStart *start = (*channel)->m_messages.peek();
+        spans[numSpans].m_data = pck->getUserDataPtr();
+        spans[numSpans].m_dataLen = pck->getUserDataSize();
+        numSpans++;
         
-        if (start)
+        pck = pck == m_message->m_last ? NULL : m_channel->m_queue.next(pck);
+    }
+    
+    return numSpans;
+}
+
+const char *RUDP::MessageView::getContiguous()
+{
+    if (m_message && m_message->m_first == m_message->m_last)
+    {
+        return m_message->m_first->getUserDataPtr();
+    }
+    
+    return NULL;
+}
+
+size_t RUDP::MessageView::copyTo(char *buffer, size_t bufferLen)
+{
+    size_t copied = 0;
+    RUDP::Packet *pck = m_message ? m_message->m_first : NULL;
+    
+    while (pck && copied < bufferLen)
+    {
+        size_t toCopy = bufferLen - copied > pck->getUserDataSize() ? pck->getUserDataSize() : bufferLen - copied;
+        memcpy(buffer + copied, pck->getUserDataPtr(), toCopy);
+        copied += toCopy;
+        
+        pck = pck == m_message->m_last ? NULL : m_channel->m_queue.next(pck);
+    }
+    
+    return copied;
+}
+
+void RUDP::MessageView::release()
+{
+    if (m_message)
+    {
+        // a shard owns the channel of the messages it hands out, it removes them once the view is back
+        if (m_peer->m_shard)
         {
-            RUDP::Packet *pck = start->m_first;
-            RUDP::Channel *channel = &m_inQueueChannels[pck->getHeader()->m_channelId];
-            char *buffer = message->m_data;
-            size_t bufferLen = message->m_dataLen;
-            
-            while (pck && bufferLen)
-            {
-                size_t toCopy = bufferLen > pck->getUserDataSize() ? pck->getUserDataSize() : bufferLen;
-                memcpy(buffer, pck->getUserDataPtr(), toCopy);
-                buffer += toCopy;
-                bufferLen -= toCopy;
-                
-                RUDP::Packet *toRemove = pck;
-                pck = channel->m_queue.next(pck);
-                channel->m_queue.remove(toRemove);
-            }
-            
-            ret = true;
-            channel->m_messages.pop();
+            m_peer->m_shard->returnView(this);
         }
-        
-        if ((*channel)->m_queue.peek() == NULL)
+        else
         {
-            m_inQueue.pop();
+            remove();
         }
+        
+        m_message = NULL;
+        m_channel = NULL;
+        m_peer = NULL;
     }
-    
-    return ret;
+}
+
+void RUDP::MessageView::remove()
+{
+    m_channel->removeMessage(m_message);
+    m_peer->updateReady(m_channel);
 }
\ No newline at end of file
@@ -0,0 +1,149 @@
+//
+//  runner.cpp
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+#include <RUDP/runner.h>
+#include <chrono>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+RUDP::Runner::Runner(RUDP::Socket *socket) :
+m_socket(socket),
+m_isRunning(false),
+m_numIterations(0),
+m_numIdle(0),
+m_busyTimeUs(0),
+m_idleTimeUs(0),
+m_maxIterationUs(0)
+{
+    
+}
+
+RUDP::Runner::~Runner()
+{
+    stop();
+}
+
+bool RUDP::Runner::start(const RUDP::RunnerOptions &options)
+{
+    if (m_isRunning.exchange(true))
+    {
+        return false;
+    }
+    
+    m_options = options;
+    
+    bool result = m_socket->setBufferSizes(options.m_receiveBufferSize, options.m_sendBufferSize);
+    
+    if (options.m_busyPollUs > 0)
+    {
+        result &= m_socket->setBusyPoll(options.m_busyPollUs, options.m_busyPollBudget, options.m_preferBusyPoll);
+    }
+    
+    m_thread = std::thread(&RUDP::Runner::run, this);
+    
+    if (options.m_affinityMask != 0)
+    {
+        result &= setAffinity(options.m_affinityMask);
+    }
+    
+    return result;
+}
+
+void RUDP::Runner::stop()
+{
+    m_isRunning = false;
+    
+    if (m_thread.joinable())
+    {
+        m_thread.join();
+    }
+}
+
+bool RUDP::Runner::setAffinity(uint64_t mask)
+{
+#if defined(_WIN32)
+    return SetThreadAffinityMask(m_thread.native_handle(), (DWORD_PTR)mask) != 0;
+#elif defined(__linux__)
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    
+    for (int cpu = 0; cpu < 64; cpu++)
+    {
+        if (RUDP_BIT_HAS(mask, 1ULL << cpu))
+        {
+            CPU_SET(cpu, &cpus);
+        }
+    }
+    
+    return pthread_setaffinity_np(m_thread.native_handle(), sizeof(cpus), &cpus) == 0;
+#else
+    // no hard affinity on this platform
+    return false;
+#endif
+}
+
+void RUDP::Runner::run()
+{
+    typedef std::chrono::steady_clock Clock;
+    
+    uint64_t numIterations = 0;
+    uint64_t numIdle = 0;
+    uint64_t busyTimeUs = 0;
+    uint64_t idleTimeUs = 0;
+    uint64_t maxIterationUs = 0;
+    
+    while (m_isRunning.load(std::memory_order_relaxed))
+    {
+        Clock::time_point begin = Clock::now();
+        bool isBusy = m_socket->step();
+        
+        if (!isBusy)
+        {
+            if (m_options.m_idlePolicy == RUDP::IdlePolicy_Yield)
+            {
+                std::this_thread::yield();
+            }
+            else if (m_options.m_idlePolicy == RUDP::IdlePolicy_Block)
+            {
+                m_socket->wait(m_options.m_blockTimeoutMs);
+            }
+        }
+        
+        uint64_t us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - begin).count();
+        numIterations++;
+        
+        if (isBusy)
+        {
+            busyTimeUs += us;
+            maxIterationUs = us > maxIterationUs ? us : maxIterationUs;
+        }
+        else
+        {
+            numIdle++;
+            idleTimeUs += us;
+        }
+        
+        // single writer, so plain stores are enough for readers on other threads
+        m_numIterations.store(numIterations, std::memory_order_relaxed);
+        m_numIdle.store(numIdle, std::memory_order_relaxed);
+        m_busyTimeUs.store(busyTimeUs, std::memory_order_relaxed);
+        m_idleTimeUs.store(idleTimeUs, std::memory_order_relaxed);
+        m_maxIterationUs.store(maxIterationUs, std::memory_order_relaxed);
+    }
+}
+
+void RUDP::Runner::getStats(RUDP::RunnerStats *stats)
+{
+    stats->m_numIterations = m_numIterations.load(std::memory_order_relaxed);
+    stats->m_numIdle = m_numIdle.load(std::memory_order_relaxed);
+    stats->m_busyTimeUs = m_busyTimeUs.load(std::memory_order_relaxed);
+    stats->m_idleTimeUs = m_idleTimeUs.load(std::memory_order_relaxed);
+    stats->m_maxIterationUs = m_maxIterationUs.load(std::memory_order_relaxed);
+}
\ No newline at end of file
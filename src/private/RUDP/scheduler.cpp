@@ -0,0 +1,217 @@
+//
+//  scheduler.cpp
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+#include <RUDP/scheduler.h>
+
+RUDP::SendScheduler::SendScheduler() :
+m_flows(64),
+m_current(NULL),
+m_numQueued(0)
+{
+    for (size_t i = 0; i < RUDP::SendPriority_Count; i++)
+    {
+        m_active[i] = NULL;
+        m_activeEnd[i] = NULL;
+    }
+}
+
+size_t RUDP::SendScheduler::enqueue(RUDP::List<RUDP::Packet> *packets)
+{
+    RUDP::FlowKey key;
+    RUDP::SendFlow *flow = NULL;
+    size_t numReplaced = 0;
+    
+    for (RUDP::Packet *packet = packets->peek(); packet != NULL; packet = packets->peek())
+    {
+        // fragments of one message arrive back to back, so the last flow is usually the right one
+        if (!flow || packet->getHeader()->m_channelId != key.m_channel || !packet->getPeerKey()->equals(&key.m_peer))
+        {
+            key.m_peer = *packet->getPeerKey();
+            key.m_channel = packet->getHeader()->m_channelId;
+            
+            flow = m_flows.find(&key);
+            if (!flow)
+            {
+                flow = m_flows.insert(&key);
+                if (flow)
+                {
+                    flow->m_key = key;
+                }
+            }
+        }
+        
+        if (!flow)
+        {
+            packets->pop();
+            continue;
+        }
+        
+        // the latest configuration of the channel wins, a class change waits until the flow drained
+        flow->m_weight = packet->getSendWeight() > 0 ? packet->getSendWeight() : 1;
+        
+        RUDP::PacketFlag flags = packet->getHeader()->m_flags;
+        
+        if (flow->m_isActive && RUDP_BIT_HAS(flags, RUDP::PacketFlag_Sequenced) && RUDP_BIT_HAS(flags, RUDP::PacketFlag_StartOfMessage))
+        {
+            numReplaced += replaceSequenced(flow);
+        }
+        
+        if (!flow->m_isActive)
+        {
+            flow->m_class = packet->getSendClass() < RUDP::SendPriority_Count ? (RUDP::SendPriority)packet->getSendClass() : RUDP::SendPriority_Background;
+            activate(flow);
+        }
+        
+        packets->popTo(&flow->m_queue);
+        m_numQueued++;
+    }
+    
+    return numReplaced;
+}
+
+size_t RUDP::SendScheduler::replaceSequenced(RUDP::SendFlow *flow)
+{
+    size_t numReplaced = 0;
+    
+    // a new sequenced message makes every queued one on the flow obsolete
+    for (RUDP::Packet *pck = flow->m_queue.peek(); pck != NULL;)
+    {
+        RUDP::Packet *next = flow->m_queue.next(pck);
+        
+        if (RUDP_BIT_HAS(pck->getHeader()->m_flags, RUDP::PacketFlag_Sequenced))
+        {
+            flow->m_queue.remove(pck);
+            numReplaced++;
+        }
+        
+        pck = next;
+    }
+    
+    // the flow stays active, the new message is queued on it right after
+    m_numQueued -= numReplaced;
+    return numReplaced;
+}
+
+void RUDP::SendScheduler::activate(RUDP::SendFlow *flow)
+{
+    flow->m_isActive = true;
+    flow->m_next = NULL;
+    
+    if (m_activeEnd[flow->m_class])
+    {
+        m_activeEnd[flow->m_class]->m_next = flow;
+    }
+    else
+    {
+        m_active[flow->m_class] = flow;
+    }
+    
+    m_activeEnd[flow->m_class] = flow;
+}
+
+void RUDP::SendScheduler::rotate(uint8_t priorityClass)
+{
+    RUDP::SendFlow *flow = m_active[priorityClass];
+    if (flow == m_activeEnd[priorityClass])
+    {
+        return;
+    }
+    
+    m_active[priorityClass] = flow->m_next;
+    flow->m_next = NULL;
+    m_activeEnd[priorityClass]->m_next = flow;
+    m_activeEnd[priorityClass] = flow;
+}
+
+RUDP::Packet *RUDP::SendScheduler::peek(uint64_t now, RUDP::List<RUDP::Packet> *expired)
+{
+    m_current = NULL;
+    
+    for (uint8_t priorityClass = 0; priorityClass < RUDP::SendPriority_Count; priorityClass++)
+    {
+        // a quantum always covers at least one full packet, so this settles within one round
+        for (RUDP::SendFlow *flow = m_active[priorityClass]; flow != NULL; flow = m_active[priorityClass])
+        {
+            RUDP::Packet *packet = flow->m_queue.peek();
+            
+            if (packet->isExpired(now))
+            {
+                flow->m_queue.popTo(expired);
+                m_numQueued--;
+                removeIfEmpty(flow);
+                continue;
+            }
+            
+            if (flow->m_deficit >= packet->getTotalSize())
+            {
+                m_current = flow;
+                return packet;
+            }
+            
+            if (!flow->m_hasQuantum)
+            {
+                flow->m_deficit += (size_t)flow->m_weight * RUDP::PacketSize;
+                flow->m_hasQuantum = true;
+                continue;
+            }
+            
+            // turn is over, the leftover deficit carries into the next round
+            flow->m_hasQuantum = false;
+            rotate(priorityClass);
+        }
+    }
+    
+    return NULL;
+}
+
+void RUDP::SendScheduler::pop(RUDP::List<RUDP::Packet> *keepIn)
+{
+    RUDP::SendFlow *flow = m_current;
+    if (!flow)
+    {
+        return;
+    }
+    
+    flow->m_deficit -= flow->m_queue.peek()->getTotalSize();
+    
+    if (keepIn)
+    {
+        flow->m_queue.popTo(keepIn);
+    }
+    else
+    {
+        flow->m_queue.pop();
+    }
+    
+    m_numQueued--;
+    m_current = NULL;
+    
+    removeIfEmpty(flow);
+}
+
+void RUDP::SendScheduler::removeIfEmpty(RUDP::SendFlow *flow)
+{
+    if (flow->m_queue.peek())
+    {
+        return;
+    }
+    
+    // the flow is at the head of its class. idle flows don't bank credit, so there is nothing to keep
+    // and flows of channels or peers that went quiet don't pile up in the map
+    m_active[flow->m_class] = flow->m_next;
+    if (!flow->m_next)
+    {
+        m_activeEnd[flow->m_class] = NULL;
+    }
+    
+    m_flows.remove(&flow->m_key);
+}
+
+size_t RUDP::SendScheduler::getNumQueued()
+{
+    return m_numQueued;
+}
\ No newline at end of file
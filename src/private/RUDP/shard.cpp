@@ -0,0 +1,222 @@
+//
+//  shard.cpp
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+#include <RUDP/shard.h>
+#include <RUDP/socket.h>
+#include <chrono>
+
+RUDP::Shard::Shard(RUDP::Socket *socket) :
+m_socket(socket),
+m_inbound(RUDP::ShardQueueSize),
+m_delivered(RUDP::ShardQueueSize),
+m_released(RUDP::ShardQueueSize),
+m_peers(64),
+m_numHeld(0),
+m_isRunning(false)
+{
+    
+}
+
+RUDP::Shard::~Shard()
+{
+    stop();
+    
+    // views still out point into m_peers and go with it
+    RUDP::Packet *pck;
+    while (m_inbound.pop(&pck))
+    {
+        RUDP::NodeStore<RUDP::Packet>::free(pck);
+    }
+}
+
+void RUDP::Shard::start()
+{
+    if (!m_isRunning.exchange(true))
+    {
+        m_thread = std::thread(&RUDP::Shard::run, this);
+    }
+}
+
+void RUDP::Shard::stop()
+{
+    m_isRunning = false;
+    
+    if (m_thread.joinable())
+    {
+        m_thread.join();
+    }
+}
+
+bool RUDP::Shard::enqueue(RUDP::Packet *pck)
+{
+    return m_inbound.push(pck);
+}
+
+bool RUDP::Shard::dequeue(RUDP::ShardMessage *msg)
+{
+    return m_delivered.pop(msg);
+}
+
+void RUDP::Shard::addReadyPeer(RUDP::Peer *peer)
+{
+    m_readyPeers.push_back(peer);
+}
+
+void RUDP::Shard::returnView(RUDP::MessageView *view)
+{
+    // never full, no more than its size are handed out at a time
+    m_released.push(*view);
+}
+
+size_t RUDP::Shard::removeReleased()
+{
+    size_t numRemoved = 0;
+    RUDP::MessageView view;
+    
+    while (m_released.pop(&view))
+    {
+        view.remove();
+        m_numHeld--;
+        numRemoved++;
+    }
+    
+    return numRemoved;
+}
+
+void RUDP::Shard::process(RUDP::Packet *pck, RUDP::List<RUDP::Packet> *acks)
+{
+    RUDP::Peer *peer = m_peers.find(pck->getPeerKey());
+    if (!peer)
+    {
+        peer = m_peers.insert(pck->getPeerKey(), m_socket, pck->getTargetAddr());
+        if (!peer)
+        {
+            RUDP::NodeStore<RUDP::Packet>::free(pck);
+            return;
+        }
+        
+        peer->m_shard = this;
+    }
+    
+    bool isSkip = RUDP_BIT_HAS(pck->getHeader()->m_flags, RUDP::PacketFlag_Skip);
+    RUDP::ReceiveResult result = isSkip ? peer->receiveSkip(pck) : peer->enqueueIncomingPacket(pck, true);
+    
+    if (isSkip && result == RUDP::ReceiveResult_Kept)
+    {
+        m_socket->m_numSkipsReceived++;
+    }
+    
+    if (result != RUDP::ReceiveResult_Dropped && RUDP_BIT_HAS(pck->getHeader()->m_flags, RUDP::PacketFlag_ConfirmDelivery))
+    {
+        peer->acknowledgePacket(pck, acks);
+    }
+    
+    // kept fragments are linked into their channel as they are
+    if (isSkip || result != RUDP::ReceiveResult_Kept)
+    {
+        RUDP::NodeStore<RUDP::Packet>::free(pck);
+    }
+}
+
+bool RUDP::Shard::deliver(RUDP::Peer *peer)
+{
+    RUDP::ShardMessage msg;
+    if (!peer->receiveMessage(&msg.m_view))
+    {
+        return false;
+    }
+    
+    msg.m_peer = NULL;
+    msg.m_key = *peer->getKey();
+    msg.m_addr = *peer->getAddress();
+    
+    // the caller checked for space and this thread is the only producer
+    m_delivered.push(msg);
+    m_numHeld++;
+    return true;
+}
+
+size_t RUDP::Shard::deliverReady()
+{
+    size_t numDelivered = 0;
+    
+    // same fairness as Socket::pollMessages, one message per peer per pass
+    // m_delivered has room as long as fewer views than its size are out
+    while (!m_readyPeers.empty() && m_numHeld < RUDP::ShardQueueSize)
+    {
+        for (size_t i = 0; i < m_readyPeers.size() && m_numHeld < RUDP::ShardQueueSize;)
+        {
+            RUDP::Peer *peer = m_readyPeers[i];
+            
+            if (deliver(peer))
+            {
+                numDelivered++;
+            }
+            
+            if (peer->hasReadyChannels())
+            {
+                i++;
+            }
+            else
+            {
+                peer->m_isReadyListed = false;
+                m_readyPeers[i] = m_readyPeers.back();
+                m_readyPeers.pop_back();
+            }
+        }
+    }
+    
+    return numDelivered;
+}
+
+void RUDP::Shard::run()
+{
+    uint32_t numIdle = 0;
+    
+    // fragments and message starts are secured and freed here at the packet rate
+    RUDP::NodeStore<RUDP::Packet>::attachCache();
+    RUDP::NodeStore<RUDP::MessageStart>::attachCache();
+    
+    while (m_isRunning.load(std::memory_order_acquire))
+    {
+        uint32_t numProcessed = 0;
+        RUDP::List<RUDP::Packet> acks;
+        RUDP::Packet *pck;
+        
+        size_t numRemoved = removeReleased();
+        
+        while (numProcessed < 256 && m_inbound.pop(&pck))
+        {
+            process(pck, &acks);
+            numProcessed++;
+        }
+        
+        // acks that don't fit are dropped, the sender's retransmission gets acknowledged again
+        m_socket->enqueueOutgoingPackets(&acks);
+        
+        if (deliverReady() > 0)
+        {
+            m_socket->m_readyEvent.signal();
+        }
+        
+        if (numProcessed > 0 || numRemoved > 0)
+        {
+            numIdle = 0;
+        }
+        else if (++numIdle < 1024)
+        {
+            std::this_thread::yield();
+        }
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    }
+    
+    RUDP::NodeStore<RUDP::Packet>::detachCache();
+    RUDP::NodeStore<RUDP::MessageStart>::detachCache();
+}
\ No newline at end of file
@@ -0,0 +1,252 @@
+//
+//  simulation.cpp
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+#include <RUDP/simulation.h>
+#include <RUDP/clock.h>
+#include <algorithm>
+
+namespace
+{
+    // passes an endpoint gets within one instant before the rest of its work moves a us on, so a
+    // socket that can't get rid of its queued sends doesn't stop time
+    const uint32_t MaxPassesPerInstant = 64;
+}
+
+RUDP::Simulation::Simulation(uint64_t seed) :
+m_network(seed),
+m_endpoints(256),
+m_random(seed ^ 0x5851f42d4c957f2dULL),
+m_stepCallback(NULL),
+m_stepContext(NULL),
+m_now(1000000),
+m_nextOrder(0),
+m_isStopped(false)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_network.setDeliveryCallback(&RUDP::Simulation::OnDelivery, this);
+    RUDP::Clock::setSource(&RUDP::Simulation::ReadClock, this);
+}
+
+RUDP::Simulation::~Simulation()
+{
+    RUDP::Clock::setSource(NULL, NULL);
+    m_network.setDeliveryCallback(NULL, NULL);
+}
+
+uint64_t RUDP::Simulation::ReadClock(void *context)
+{
+    return ((RUDP::Simulation*)context)->m_now;
+}
+
+void RUDP::Simulation::OnDelivery(RUDP::EmulatedTransport *target, uint64_t due, void *context)
+{
+    RUDP::Simulation *simulation = (RUDP::Simulation*)context;
+    Endpoint *endpoint = (Endpoint*)target->getUserData();
+    
+    // transports the simulation doesn't own are left to whoever reads them
+    if (endpoint)
+    {
+        simulation->push(due, endpoint, NULL, NULL, false);
+    }
+}
+
+RUDP::EmulatedNetwork *RUDP::Simulation::getNetwork()
+{
+    return &m_network;
+}
+
+RUDP::Random *RUDP::Simulation::getRandom()
+{
+    return &m_random;
+}
+
+RUDP::Socket *RUDP::Simulation::addEndpoint(uint32_t ipv4, uint16_t port)
+{
+    sockaddr_storage address;
+    RUDP::EmulatedNetwork::MakeAddress(&address, ipv4, port);
+    
+    RUDP::PeerKey key;
+    key.set(&address);
+    
+    if (m_endpoints.find(&key))
+    {
+        return NULL;
+    }
+    
+    Endpoint *endpoint = m_endpoints.insert(&key, &m_network, ipv4, port);
+    endpoint->m_transport.setUserData(endpoint);
+    endpoint->m_socket.open(&endpoint->m_transport);
+    m_endpointList.push_back(endpoint);
+    
+    return &endpoint->m_socket;
+}
+
+size_t RUDP::Simulation::getNumEndpoints()
+{
+    return m_endpointList.size();
+}
+
+RUDP::Socket *RUDP::Simulation::getEndpoint(size_t index)
+{
+    return index < m_endpointList.size() ? &m_endpointList[index]->m_socket : NULL;
+}
+
+RUDP::Simulation::Endpoint *RUDP::Simulation::find(RUDP::Socket *socket)
+{
+    RUDP::PeerKey key;
+    key.set(socket->getAddress());
+    return m_endpoints.find(&key);
+}
+
+void RUDP::Simulation::setStepCallback(RUDP::SimulationCallback callback, void *context)
+{
+    m_stepCallback = callback;
+    m_stepContext = context;
+}
+
+void RUDP::Simulation::schedule(uint64_t timeUs, RUDP::Socket *socket, RUDP::SimulationCallback callback, void *context)
+{
+    push(timeUs > m_now ? timeUs : m_now, socket ? find(socket) : NULL, callback, context, false);
+}
+
+uint64_t RUDP::Simulation::getTime()
+{
+    return m_now;
+}
+
+void RUDP::Simulation::stop()
+{
+    m_isStopped = true;
+}
+
+void RUDP::Simulation::getStats(RUDP::SimulationStats *stats)
+{
+    *stats = m_stats;
+    stats->m_time = m_now;
+}
+
+void RUDP::Simulation::push(uint64_t time, Endpoint *endpoint, RUDP::SimulationCallback callback, void *context, bool isTimer)
+{
+    Entry entry;
+    entry.m_time = time;
+    entry.m_order = m_nextOrder++;
+    entry.m_endpoint = endpoint;
+    entry.m_callback = callback;
+    entry.m_context = context;
+    entry.m_isTimer = isTimer;
+    
+    m_queue.push_back(entry);
+    std::push_heap(m_queue.begin(), m_queue.end(), LaterEntry());
+}
+
+void RUDP::Simulation::makeReady(Endpoint *endpoint)
+{
+    if (!endpoint->m_isReady)
+    {
+        endpoint->m_isReady = true;
+        m_ready.push_back(endpoint);
+    }
+}
+
+void RUDP::Simulation::step(Endpoint *endpoint)
+{
+    if (endpoint->m_instant != m_now)
+    {
+        endpoint->m_instant = m_now;
+        endpoint->m_numPasses = 0;
+    }
+    
+    endpoint->m_numPasses++;
+    endpoint->m_socket.step();
+    endpoint->m_socket.updatePeers();
+    m_stats.m_numSteps++;
+    
+    if (m_stepCallback)
+    {
+        m_stepCallback(this, &endpoint->m_socket, m_stepContext);
+    }
+    
+    // arrivals past what one pass reads are still due now, later ones already have their entries
+    uint64_t next = endpoint->m_socket.getNextEventTime();
+    uint64_t nextDue = endpoint->m_transport.getNextDue();
+    next = nextDue <= m_now && nextDue < next ? nextDue : next;
+    
+    if (next <= m_now && endpoint->m_numPasses < MaxPassesPerInstant)
+    {
+        makeReady(endpoint);
+        return;
+    }
+    
+    next = next <= m_now ? m_now + 1 : next;
+    
+    // a timer that is already queued for the same time is kept, stale ones are skipped when they come up
+    if (next != UINT64_MAX && next != endpoint->m_timer)
+    {
+        endpoint->m_timer = next;
+        push(next, endpoint, NULL, NULL, true);
+    }
+}
+
+uint64_t RUDP::Simulation::run(uint64_t us)
+{
+    uint64_t end = m_now + us;
+    m_isStopped = false;
+    
+    while (!m_isStopped)
+    {
+        if (m_ready.empty())
+        {
+            if (m_queue.empty() || m_queue.front().m_time > end)
+            {
+                m_now = end;
+                break;
+            }
+            
+            m_now = m_queue.front().m_time;
+            
+            // everything due at this instant is taken at once, the endpoints are stepped after
+            while (!m_queue.empty() && m_queue.front().m_time <= m_now)
+            {
+                std::pop_heap(m_queue.begin(), m_queue.end(), LaterEntry());
+                Entry entry = m_queue.back();
+                m_queue.pop_back();
+                m_stats.m_numEvents++;
+                
+                if (entry.m_callback)
+                {
+                    entry.m_callback(this, entry.m_endpoint ? &entry.m_endpoint->m_socket : NULL, entry.m_context);
+                }
+                else if (entry.m_isTimer)
+                {
+                    if (entry.m_endpoint->m_timer != entry.m_time)
+                    {
+                        continue;
+                    }
+                    
+                    entry.m_endpoint->m_timer = UINT64_MAX;
+                }
+                
+                if (entry.m_endpoint)
+                {
+                    makeReady(entry.m_endpoint);
+                }
+            }
+        }
+        
+        m_stepping.swap(m_ready);
+        
+        for (size_t i = 0; i < m_stepping.size(); i++)
+        {
+            m_stepping[i]->m_isReady = false;
+            step(m_stepping[i]);
+        }
+        
+        m_stepping.clear();
+    }
+    
+    return m_now;
+}
\ No newline at end of file
@@ -7,7 +7,7 @@
 //
 
 #include <RUDP/socket.h>
-#include <fcntl.h>
+#include <RUDP/clock.h>
 #include <stdio.h>
 #include <errno.h>
 #include <atomic>
@@ -40,11 +40,35 @@ void RUDP::Socket::PrintLastSocketError(const char *context)
 #endif
 }
 
+void RUDP::AckKey::set(RUDP::Packet *pck)
+{
+    m_peerKey = *pck->getPeerKey();
+    m_packetId = pck->getHeader()->m_packetId;
+    m_channelId = pck->getHeader()->m_channelId;
+    m_kind = pck->getHeader()->m_flags & (RUDP::PacketFlag_Skip | RUDP::PacketFlag_Stream);
+}
+
 RUDP::Socket::Socket() :
-m_ackTimeout(1000),
-m_port(0),
-m_handle(0),
-m_peerList(RUDP::Map<RUDP::Peer>(256))
+m_peerList(256),
+m_ackIndex(256),
+m_numAckShadowed(0),
+m_outQueue(RUDP::SocketQueueSize),
+m_inQueue(RUDP::SocketQueueSize),
+m_newPeersIndex(0),
+m_acknowledgedCallback(NULL),
+m_numExpiredUnsent(0),
+m_numExpiredUnacknowledged(0),
+m_numSkipsSent(0),
+m_numSkipsReceived(0),
+m_numSequencedReplaced(0),
+m_numPacketsReceived(0),
+m_numDuplicatesDropped(0),
+m_numShardOverflows(0),
+m_ackTimeout(1000000),
+m_now(0),
+m_sendBudget(0),
+m_transport(&m_udp),
+m_port(0)
 {
 #ifdef _WIN32
     WSADATA wsaData;
@@ -54,11 +78,27 @@ m_peerList(RUDP::Map<RUDP::Peer>(256))
         PrintLastSocketError("WinSock Startup");
     }
 #endif
+    
+    m_readyEvent.open();
+    m_sendEvent.open();
 }
 
 RUDP::Socket::~Socket()
 {
-    RUDP_CLOSESOCKET(m_handle);
+    setNumShards(0);
+    
+    RUDP::List<RUDP::Packet> unused;
+    RUDP::Chain<RUDP::Packet> chain;
+    
+    while (m_outQueue.pop(&chain))
+    {
+        unused.attach(chain);
+    }
+    
+    while (m_inQueue.pop(&chain))
+    {
+        unused.attach(chain);
+    }
 }
 
 bool RUDP::Socket::open(uint16_t port, uint32_t addr)
@@ -84,40 +124,49 @@ bool RUDP::Socket::open(sockaddr_in6 *target)
 
 bool RUDP::Socket::open(sockaddr *target, socklen_t targetSize)
 {
-    m_handle = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    if(m_handle <= 0)
+    if (!m_udp.open(target, targetSize))
     {
-        PrintLastSocketError("Creating socket");
         return false;
     }
     
-    int bindResult = bind(m_handle, (const sockaddr*)target, targetSize);
-    if(bindResult < 0)
-    {
-        PrintLastSocketError("Binding Socket");
-        return false;
-    }
+    m_transport = &m_udp;
+    memcpy(&m_address, target, targetSize > sizeof(sockaddr_storage) ? sizeof(sockaddr_storage) : targetSize);
     
-    // non-blocking
-#ifdef _WIN32
-    u_long iMode = 1;
-    if (ioctlsocket(m_handle, FIONBIO, &iMode) != NO_ERROR)
-#else
-        if(fcntl(m_handle, F_SETFL, O_NONBLOCK, 1) == -1)
-#endif
-        {
-            PrintLastSocketError("Setting Socket to Non-Blocking");
-            return false;
-        }
+    return true;
+}
+
+bool RUDP::Socket::open(RUDP::Transport *transport)
+{
+    m_transport = transport;
+    m_transport->getAddress(&m_address);
     
-    memcpy(&m_address, target, targetSize > sizeof(sockaddr_storage) ? sizeof(sockaddr_storage) : targetSize);
+    switch (m_address.ss_family)
+    {
+        case AF_INET:
+            m_port = ((sockaddr_in*)&m_address)->sin_port;
+            break;
+        
+        case AF_INET6:
+            m_port = ((sockaddr_in6*)&m_address)->sin6_port;
+            break;
+    }
     
     return true;
 }
 
+bool RUDP::Socket::setBufferSizes(int receiveSize, int sendSize)
+{
+    return m_transport == &m_udp && m_udp.setBufferSizes(receiveSize, sendSize);
+}
+
+bool RUDP::Socket::setBusyPoll(uint32_t us, uint32_t budget, bool prefer)
+{
+    return m_transport == &m_udp && m_udp.setBusyPoll(us, budget, prefer);
+}
+
 RUDP::SocketHandle RUDP::Socket::getHandle()
 {
-    return m_handle;
+    return m_udp.getHandle();
 }
 
 sockaddr_storage *RUDP::Socket::getAddress()
@@ -130,97 +179,413 @@ uint16_t RUDP::Socket::getPort()
     return m_port;
 }
 
-bool RUDP::Socket::flush()
+bool RUDP::Socket::flush(uint32_t budget)
 {
     bool sent = false;
     RUDP::List<RUDP::Packet> toSend = {};
-    m_outQueueLock.lock();
-    toSend.inheritFrom(&m_outQueue);
-    m_outQueueLock.unlock();
+    RUDP::Chain<RUDP::Packet> chain;
     
-    for (RUDP::Packet *packet = toSend.peek(); packet != NULL; packet = toSend.peek())
+    while (m_outQueue.pop(&chain))
     {
+        toSend.attach(chain);
+    }
+    
+    m_numSequencedReplaced += m_sendScheduler.enqueue(&toSend);
+    
+    uint64_t now = m_now;
+    RUDP::List<RUDP::Packet> expired;
+    
+    // unsent packets stay with the scheduler, so anything more urgent enqueued
+    // before the next flush goes out ahead of them
+    for (uint32_t numSent = 0; budget == 0 || numSent < budget; numSent++)
+    {
+        RUDP::Packet *packet = m_sendScheduler.peek(now, &expired);
+        if (!packet || !sendPacket(packet))
+        {
+            break;
+        }
+        
         sent = true;
-        if(sendPacket(packet))
+        
+        // reliable packets are kept for retransmission until the peer acknowledges them. stamped with the
+        // time they actually went out, so a burst times out as spread out as it was sent
+        if (RUDP_BIT_HAS(packet->getHeader()->m_flags, RUDP::PacketFlag_ConfirmDelivery) && !RUDP_BIT_HAS(packet->getHeader()->m_flags, RUDP::PacketFlag_IsAck))
         {
-            toSend.pop();
+            packet->setTimestamp(RUDP::Clock::now());
+            m_sendScheduler.pop(&m_ackQueue);
+            trackAcknowledgement(packet);
         }
         else
         {
-            break;
+            m_sendScheduler.pop();
         }
     }
     
+    // fragments of a message sit next to each other in their flow, so expired ones arrive grouped
+    for (RUDP::Packet *packet = expired.peek(), *last = NULL; packet != NULL; packet = expired.next(packet))
+    {
+        if (!last || !IsSameMessage(last, packet))
+        {
+            sendSkip(packet, now);
+        }
+        
+        m_numExpiredUnsent++;
+        last = packet;
+    }
+    
     return sent;
 }
 
+bool RUDP::Socket::IsSameMessage(RUDP::Packet *a, RUDP::Packet *b)
+{
+    return a->getHeader()->m_messageId == b->getHeader()->m_messageId &&
+           a->getHeader()->m_channelId == b->getHeader()->m_channelId &&
+           a->getPeerKey()->equals(b->getPeerKey());
+}
+
+void RUDP::Socket::sendSkip(RUDP::Packet *expired, uint64_t now)
+{
+    // the skip is reliable itself and is told apart from the first fragment's ack by its flag
+    RUDP::PacketHeader header = *expired->getHeader();
+    header.m_packetId = header.m_messageId;
+    header.m_flags = (RUDP::PacketFlag)(RUDP::PacketFlag_Skip | RUDP::PacketFlag_ConfirmDelivery | (header.m_flags & RUDP::PacketFlag_InOrder));
+    
+    RUDP::Packet *skip = m_ackQueue.push();
+    if (!skip)
+    {
+        return;
+    }
+    
+    skip->setWritePosition(0);
+    skip->setHeader(&header);
+    skip->setTargetAddr(expired->getTargetAddr());
+    *skip->getPeerKey() = *expired->getPeerKey();
+    skip->setChannel(expired->getChannel());
+    skip->setTimestamp(now);
+    trackAcknowledgement(skip);
+    
+    m_numSkipsSent++;
+    sendPacket(skip);
+}
+
 bool RUDP::Socket::listen(uint32_t attempts)
 {
     RUDP::List<RUDP::Packet> receivedPackets = {};
-    RUDP::Packet packet = {};
+    RUDP::Packet overflow = {};
+    
+    // datagrams are read straight into a pool node, which is then linked wherever it goes without a copy.
+    // overflow only takes them while the pool is out of nodes, so acks are still read
+    RUDP::Packet *packet = NULL;
     
     for (uint32_t i = 0; i < attempts; i++)
     {
-        if(receivePacket(&packet))
+        if (!packet || packet == &overflow)
+        {
+            RUDP::Node<RUDP::Packet> *node = RUDP::NodeStore<RUDP::Packet>::secure();
+            packet = node ? &node->m_obj : &overflow;
+        }
+        
+        if(receivePacket(packet))
         {
-            receivedPackets.push(&packet);
+            RUDP::PacketHeader *header = packet->getHeader();
+            m_numPacketsReceived++;
+            
+            // arrival time for the latency histograms, and for acks the time they settle a message
+            packet->setTimestamp(m_now);
+            
+            bool isAck = RUDP_BIT_HAS(header->m_flags, RUDP::PacketFlag_IsAck);
+            bool isFirstAck = isAck && receiveAcknowledgement(packet);
+            
+            m_counters.begin();
+            m_counters.add(RUDP::Counter_PacketsReceived, 1);
+            m_counters.add(RUDP::Counter_BytesReceived, packet->getTotalSize());
+            m_counters.add(RUDP::Counter_AcksReceived, isFirstAck ? 1 : 0);
+            m_counters.set(RUDP::Counter_KernelDrops, m_transport->getNumDropped());
+            m_counters.end();
+            
+            // only the first ack for a packet is passed on to its peer, the node is read into again
+            if (isAck && !isFirstAck)
+            {
+                continue;
+            }
+            
+            // out of packets, dropped like a full queue would and retransmitted
+            if (packet == &overflow)
+            {
+                continue;
+            }
+            
+            bool isMessage = !RUDP_BIT_HAS_ANY(header->m_flags, RUDP::PacketFlag_IsAck | RUDP::PacketFlag_Stream);
+            
+            if (isMessage && !m_shards.empty())
+            {
+                // the upper half of the hash picks the shard, the shard's map buckets by the lower half
+                RUDP::Shard *shard = m_shards[(packet->getPeerKey()->hash() >> 32) % m_shards.size()];
+                
+                // the sender retransmits it once the shard caught up
+                if (!shard->enqueue(packet))
+                {
+                    m_numShardOverflows++;
+                    continue;
+                }
+            }
+            else
+            {
+                // acknowledged once its peer took it
+                receivedPackets.adoptAfter(receivedPackets.peekEnd(), packet);
+            }
+            
+            packet = NULL;
+        }
+        else
+        {
+            // drained, or a runt that the next pass reads past. an idle pass costs one read, not attempts
+            break;
         }
     }
     
+    if (packet && packet != &overflow)
+    {
+        RUDP::NodeStore<RUDP::Packet>::free(packet);
+    }
+    
     bool received = receivedPackets.peek() != NULL;
+    m_inBacklog.inheritFrom(&receivedPackets);
     
-    m_inQueueLock.lock();
-    m_inQueue.inheritFrom(&receivedPackets);
-    m_inQueueLock.unlock();
+    // if updatePeers is behind the packets wait here and go out with the next batch
+    if (m_inBacklog.peek())
+    {
+        RUDP::Chain<RUDP::Packet> chain = m_inBacklog.detach();
+        
+        if (m_inQueue.push(chain))
+        {
+            m_readyEvent.signal();
+        }
+        else
+        {
+            m_inBacklog.attach(chain);
+        }
+    }
     
     return received;
 }
 
+void RUDP::Socket::getStats(RUDP::SocketStats *stats)
+{
+    stats->m_numExpiredUnsent = m_numExpiredUnsent.load();
+    stats->m_numExpiredUnacknowledged = m_numExpiredUnacknowledged.load();
+    stats->m_numSkipsSent = m_numSkipsSent.load();
+    stats->m_numSkipsReceived = m_numSkipsReceived.load();
+    stats->m_numSequencedReplaced = m_numSequencedReplaced.load();
+    stats->m_numPacketsReceived = m_numPacketsReceived.load();
+    stats->m_numDuplicatesDropped = m_numDuplicatesDropped.load();
+    stats->m_numShardOverflows = m_numShardOverflows.load();
+}
+
+void RUDP::Socket::getCounters(RUDP::SocketCounters *counters)
+{
+    counters->m_traffic.clear();
+    m_counters.read(&counters->m_traffic);
+    
+    counters->m_packets.m_numUsed = RUDP::NodeStore<RUDP::Packet>::getNumSecured();
+    counters->m_packets.m_numTotal = RUDP::NodeStore<RUDP::Packet>::getNumTotal();
+    counters->m_messages.m_numUsed = RUDP::NodeStore<RUDP::MessageStart>::getNumSecured();
+    counters->m_messages.m_numTotal = RUDP::NodeStore<RUDP::MessageStart>::getNumTotal();
+    counters->m_pending.m_numUsed = RUDP::NodeStore<RUDP::PendingMessage>::getNumSecured();
+    counters->m_pending.m_numTotal = RUDP::NodeStore<RUDP::PendingMessage>::getNumTotal();
+}
+
+void RUDP::Socket::setSendBudget(uint32_t numPackets)
+{
+    m_sendBudget = numPackets;
+}
+
 void RUDP::Socket::setAckTimeout(uint64_t ms)
 {
-    m_ackTimeout = ms;
+    m_ackTimeout = ms * 1000;
 }
 
-bool RUDP::Socket::acknowledge()
+bool RUDP::Socket::receiveAcknowledgement(RUDP::Packet *ack)
 {
-    bool sentAny = false;
+    RUDP::AckKey key;
+    key.set(ack);
     
-    RUDP::List<RUDP::Packet> toSend = {};
-    m_ackQueueLock.lock();
-    toSend.inheritFrom(&m_ackQueue);
-    m_ackQueueLock.unlock();
+    RUDP::Packet **tracked = m_ackIndex.find(&key);
+    if (!tracked)
+    {
+        return false;
+    }
+    
+    RUDP::Packet *pck = *tracked;
+    RUDP::Channel *channel = pck->getChannel();
+    
+    if (channel)
+    {
+        channel->m_sendCounters.begin();
+        channel->m_sendCounters.add(RUDP::Counter_AcksReceived, 1);
+        channel->m_sendCounters.end();
+        
+        // karn: an ack can't be matched to one send of a retransmitted packet. stream acks
+        // wait for the reader, so they don't time the network
+        if (!pck->isResent() && !RUDP_BIT_HAS(pck->getHeader()->m_flags, RUDP::PacketFlag_Stream))
+        {
+            channel->recordLatency(RUDP::LatencyHistogram_RoundTrip, m_now - pck->getTimestamp());
+        }
+    }
     
-    for (RUDP::Packet *pck = toSend.peek(); pck != NULL; pck = toSend.next(pck))
+    untrackAcknowledgement(pck);
+    return true;
+}
+
+void RUDP::Socket::trackAcknowledgement(RUDP::Packet *pck)
+{
+    RUDP::AckKey key;
+    key.set(pck);
+    
+    // a packet id still in flight after the sequence wrapped keeps the older entry, the newer
+    // one is indexed once that leaves
+    if (m_ackIndex.find(&key))
     {
-        uint64_t time = RUDP_GETTIMEMS_LOCAL();
+        m_numAckShadowed++;
+        return;
+    }
+    
+    m_ackIndex.insert(&key, pck);
+}
+
+void RUDP::Socket::untrackAcknowledgement(RUDP::Packet *pck)
+{
+    RUDP::AckKey key;
+    key.set(pck);
+    
+    RUDP::Packet **tracked = m_ackIndex.find(&key);
+    if (!tracked || *tracked != pck)
+    {
+        m_numAckShadowed--;
+        m_ackQueue.remove(pck);
+        return;
+    }
+    
+    m_ackIndex.remove(&key);
+    m_ackQueue.remove(pck);
+    
+    if (m_numAckShadowed == 0)
+    {
+        return;
+    }
+    
+    for (RUDP::Packet *other = m_ackQueue.peek(); other != NULL; other = m_ackQueue.next(other))
+    {
+        RUDP::AckKey otherKey;
+        otherKey.set(other);
+        
+        if (otherKey.equals(&key))
+        {
+            m_numAckShadowed--;
+            m_ackIndex.insert(&otherKey, other);
+            return;
+        }
+    }
+}
+
+uint32_t RUDP::Socket::acknowledge(uint32_t budget)
+{
+    uint32_t numResent = 0;
+    RUDP::Packet lastExpired;
+    bool hasExpired = false;
+    uint64_t time = m_now;
+    
+    for (RUDP::Packet *pck = m_ackQueue.peek(), *next = NULL; pck != NULL && numResent < budget; pck = next)
+    {
+        next = m_ackQueue.next(pck);
+        
         uint64_t pckTime = pck->getTimestamp();
         uint64_t diff = time - pckTime;
         
         //RUDP_PRINTF("check ack: %lld %lld %lld\n", time, pckTime, diff);
         
+        if (pck->isExpired(time))
+        {
+            // one skip covers every fragment of the message
+            if (!hasExpired || !IsSameMessage(&lastExpired, pck))
+            {
+                sendSkip(pck, time);
+                lastExpired.setHeader(pck->getHeader());
+                *lastExpired.getPeerKey() = *pck->getPeerKey();
+                hasExpired = true;
+            }
+            
+            m_numExpiredUnacknowledged++;
+            untrackAcknowledgement(pck);
+            continue;
+        }
+        
         if (diff > m_ackTimeout)
         {
-            pck->setTimestamp(time);
-            sentAny = true;
-            sendPacket(pck);
+            // a resend that didn't go out is retried first thing next time
+            if (!sendPacket(pck))
+            {
+                break;
+            }
+            
+            pck->setTimestamp(RUDP::Clock::now());
+            pck->setResent(true);
+            numResent++;
+            
+            m_counters.begin();
+            m_counters.add(RUDP::Counter_Retransmits, 1);
+            m_counters.end();
+            
+            if (pck->getChannel())
+            {
+                pck->getChannel()->m_sendCounters.begin();
+                pck->getChannel()->m_sendCounters.add(RUDP::Counter_Retransmits, 1);
+                pck->getChannel()->m_sendCounters.end();
+            }
         }
     }
     
-    return sentAny;
+    return numResent;
+}
+
+bool RUDP::Socket::step()
+{
+    // one clock read per pass, every packet handled in it shares the timestamp except the send
+    // stamps of reliable packets
+    m_now = RUDP::Clock::now();
+    
+    bool isBusy = listen(256);
+    
+    // retransmissions go ahead of new data and use up the budget first. packets still due once it
+    // ran out keep their place and are resent first thing next pass
+    uint32_t numResent = acknowledge(m_sendBudget == 0 ? RUDP::DefaultResendBudget : m_sendBudget);
+    isBusy |= numResent > 0;
+    
+    if (m_sendBudget == 0 || numResent < m_sendBudget)
+    {
+        isBusy |= flush(m_sendBudget == 0 ? 0 : m_sendBudget - numResent);
+    }
+    
+    return isBusy;
 }
 
 uint64_t RUDP::Socket::update(uint64_t msTimeout)
 {
-    uint64_t time = RUDP_GETTIMEMS_LOCAL();
+    uint64_t time = RUDP::Clock::now() / 1000;
     uint64_t target = msTimeout + time;
     
     do
     {
-        listen(256);
-        acknowledge();
-        flush();
+        bool isBusy = step();
+        time = RUDP::Clock::now() / 1000;
         
-        time = RUDP_GETTIMEMS_LOCAL();
+        // sleep through idle stretches until a datagram or an outgoing batch shows up, short
+        // enough that retransmissions still go out on time
+        if (!isBusy && target > time)
+        {
+            wait(target - time < 10 ? target - time : 10);
+            time = RUDP::Clock::now() / 1000;
+        }
         //RUDP_PRINTF("check socket: %lld %lld\n", time, target);
     }
     while (target > time);
@@ -228,40 +593,100 @@ uint64_t RUDP::Socket::update(uint64_t msTimeout)
     return time >= target? 0 : target - time;
 }
 
+void RUDP::Socket::wait(uint64_t ms)
+{
+    m_sendEvent.reset();
+    if (!m_outQueue.isEmpty())
+    {
+        return;
+    }
+    
+    m_transport->wait(&m_sendEvent, ms);
+}
+
+uint64_t RUDP::Socket::getNextEventTime()
+{
+    if (!m_outQueue.isEmpty() || m_sendScheduler.getNumQueued() > 0)
+    {
+        return m_now;
+    }
+    
+    uint64_t next = UINT64_MAX;
+    
+    for (RUDP::Packet *pck = m_ackQueue.peek(); pck != NULL; pck = m_ackQueue.next(pck))
+    {
+        // acknowledge resends once a packet has waited longer than the timeout
+        uint64_t resend = pck->getTimestamp() + m_ackTimeout + 1;
+        next = resend < next ? resend : next;
+        
+        uint64_t deadline = pck->getDeadline();
+        next = deadline != 0 && deadline < next ? deadline : next;
+    }
+    
+    return next;
+}
+
 bool RUDP::Socket::sendPacket(RUDP::Packet *toWrite)
 {
-    sockdataptr_t data = (sockdataptr_t)toWrite->getDataPtr();
     size_t dataLen = toWrite->getTotalSize();
-    sockaddr *target = (sockaddr*)toWrite->getTargetAddr();
+    
+    // read as the packet leaves, so a retransmission carries the newest one
+    if (toWrite->getChannel() && !RUDP_BIT_HAS(toWrite->getHeader()->m_flags, RUDP::PacketFlag_IsAck))
+    {
+        toWrite->getHeader()->m_settledBefore = toWrite->getChannel()->getSettledBefore();
+    }
     
     toWrite->getHeader()->m_packetId = htons(toWrite->getHeader()->m_packetId);
+    toWrite->getHeader()->m_messageId = htons(toWrite->getHeader()->m_messageId);
+    toWrite->getHeader()->m_numFragments = htons(toWrite->getHeader()->m_numFragments);
+    toWrite->getHeader()->m_settledBefore = htons(toWrite->getHeader()->m_settledBefore);
     
-    ssize_t sentBytes = 0;
+    // header from the packet, body straight from the shared payload if there is one
+    RUDP::TransportBuffer buffers[2];
+    size_t numBuffers = 1;
     
-    switch(target->sa_family)
+    if (toWrite->getPayload())
     {
-        case AF_INET:
-            sentBytes = sendto(m_handle, data, dataLen, 0, target, sizeof(sockaddr_in));
-            break;
-            
-        case AF_INET6:
-            sentBytes = sendto(m_handle, data, dataLen, 0, target, sizeof(sockaddr_in6));
-            break;
-            
-        default:
-            sentBytes = sendto(m_handle, data, dataLen, 0, target, sizeof(sockaddr_storage));
-            break;
+        buffers[0].m_data = (const char*)toWrite->getDataPtr();
+        buffers[0].m_dataLen = sizeof(RUDP::PacketHeader);
+        buffers[1].m_data = (const char*)toWrite->getUserDataPtr();
+        buffers[1].m_dataLen = toWrite->getUserDataSize();
+        numBuffers = 2;
+    }
+    else
+    {
+        buffers[0].m_data = (const char*)toWrite->getDataPtr();
+        buffers[0].m_dataLen = dataLen;
     }
     
+    bool isSent = m_transport->send(buffers, numBuffers, toWrite->getTargetAddr());
+    
     toWrite->getHeader()->m_packetId = ntohs(toWrite->getHeader()->m_packetId);
+    toWrite->getHeader()->m_messageId = ntohs(toWrite->getHeader()->m_messageId);
+    toWrite->getHeader()->m_numFragments = ntohs(toWrite->getHeader()->m_numFragments);
+    toWrite->getHeader()->m_settledBefore = ntohs(toWrite->getHeader()->m_settledBefore);
     
-    if(sentBytes != dataLen)
+    if(!isSent)
     {
-        PrintLastSocketError("Sending Packet");
         return false;
     }
     else
     {
+        m_counters.begin();
+        m_counters.add(RUDP::Counter_PacketsSent, 1);
+        m_counters.add(RUDP::Counter_BytesSent, dataLen);
+        m_counters.add(RUDP::Counter_AcksSent, RUDP_BIT_HAS(toWrite->getHeader()->m_flags, RUDP::PacketFlag_IsAck) ? 1 : 0);
+        m_counters.end();
+        
+        if (toWrite->getChannel())
+        {
+            toWrite->getChannel()->m_sendCounters.begin();
+            toWrite->getChannel()->m_sendCounters.add(RUDP::Counter_PacketsSent, 1);
+            toWrite->getChannel()->m_sendCounters.add(RUDP::Counter_BytesSent, dataLen);
+            toWrite->getChannel()->m_sendCounters.end();
+        }
+
+#ifdef RUDP_TRACE_PACKETS
         RUDP::PacketHeader *header = toWrite->getHeader();
         uint32_t size = toWrite->getUserDataSize();
         
@@ -277,6 +702,7 @@ bool RUDP::Socket::sendPacket(RUDP::Packet *toWrite)
                        //toWrite->getUserDataPtr(),
                        //toWrite->getUserDataSize()
                        );
+#endif
         
         return true;
     }
@@ -288,18 +714,19 @@ bool RUDP::Socket::receivePacket(RUDP::Packet *userBuffer)
     socklen_t senderSize = sizeof(sender);
     memset(&sender, 0, senderSize);
     
-    ssize_t bytesRead = recvfrom(m_handle, (char*)userBuffer->getDataPtr(), RUDP::PacketSize, 0, (sockaddr*)&sender, &senderSize);
+    ssize_t bytesRead = m_transport->receive((char*)userBuffer->getDataPtr(), RUDP::PacketSize, &sender);
     
-    if (bytesRead == -1)
-    {
-        PrintLastSocketError("Receiving Packet");
-    }
-    else if(bytesRead > 0)
+    if(bytesRead >= (ssize_t)sizeof(RUDP::PacketHeader))
     {
         userBuffer->setWritePosition((uint16_t)(bytesRead - sizeof(RUDP::PacketHeader)));
         userBuffer->setTargetAddr(&sender);
+        userBuffer->getPeerKey()->set(&sender);
         userBuffer->getHeader()->m_packetId = ntohs(userBuffer->getHeader()->m_packetId);
-        
+        userBuffer->getHeader()->m_messageId = ntohs(userBuffer->getHeader()->m_messageId);
+        userBuffer->getHeader()->m_numFragments = ntohs(userBuffer->getHeader()->m_numFragments);
+        userBuffer->getHeader()->m_settledBefore = ntohs(userBuffer->getHeader()->m_settledBefore);
+
+#ifdef RUDP_TRACE_PACKETS
         RUDP::PacketHeader *header = userBuffer->getHeader();
         
         RUDP::Print::f("received packet on channel %d:%d:%d -> (%d, %d)\n\n",
@@ -322,29 +749,186 @@ bool RUDP::Socket::receivePacket(RUDP::Packet *userBuffer)
          }
          
          RUDP_PRINTF("\n");*/
+#endif
     }
     
-    return bytesRead > 0;
+    return bytesRead >= (ssize_t)sizeof(RUDP::PacketHeader);
 }
 
 void RUDP::Socket::updatePeers()
 {
     RUDP::List<RUDP::Packet> packetsToSort = {};
+    RUDP::List<RUDP::Packet> acks = {};
     
-    m_inQueueLock.lock();
-    packetsToSort.inheritFrom(&m_inQueue);
-    m_inQueueLock.unlock();
+    RUDP::Chain<RUDP::Packet> chain;
+    
+    m_readyEvent.reset();
+    
+    while (m_inQueue.pop(&chain))
+    {
+        packetsToSort.attach(chain);
+    }
     
     for (RUDP::Packet *packet = packetsToSort.peek(); packet != NULL; packet = packetsToSort.peek())
     {
-        RUDP::Peer *peer = getPeer(packet->getTargetAddr());
+        RUDP::Peer *peer = m_peerList.find(packet->getPeerKey());
+        
+        if (!peer && !RUDP_BIT_HAS(packet->getHeader()->m_flags, RUDP::PacketFlag_IsAck))
+        {
+            peer = getPeer(packet->getPeerKey(), packet->getTargetAddr());
+            if (peer)
+            {
+                m_newPeers.push_back(peer);
+            }
+        }
+        
         if (peer)
         {
-            peer->enqueueIncomingPacket(packet);
+            if (RUDP_BIT_HAS(packet->getHeader()->m_flags, RUDP::PacketFlag_IsAck))
+            {
+                peer->receiveAcknowledgement(packet);
+            }
+            else if (RUDP_BIT_HAS(packet->getHeader()->m_flags, RUDP::PacketFlag_Stream))
+            {
+                peer->receiveStream(packet);
+            }
+            else
+            {
+                bool isSkip = RUDP_BIT_HAS(packet->getHeader()->m_flags, RUDP::PacketFlag_Skip);
+                RUDP::ReceiveResult result = isSkip ? peer->receiveSkip(packet) : peer->enqueueIncomingPacket(packet, false);
+                
+                m_numSkipsReceived += isSkip && result == RUDP::ReceiveResult_Kept ? 1 : 0;
+                
+                // only once the packet is held or was already, anything dropped is retransmitted
+                if (result != RUDP::ReceiveResult_Dropped && RUDP_BIT_HAS(packet->getHeader()->m_flags, RUDP::PacketFlag_ConfirmDelivery))
+                {
+                    peer->acknowledgePacket(packet, &acks);
+                }
+            }
         }
         
         packetsToSort.pop();
     }
+    
+    // acks that don't fit are dropped, the sender's retransmission gets acknowledged again
+    enqueueOutgoingPackets(&acks);
+}
+
+void RUDP::Socket::addReadyPeer(RUDP::Peer *peer)
+{
+    m_readyPeers.push_back(peer);
+}
+
+size_t RUDP::Socket::pollMessages(RUDP::MessageView *views, size_t maxViews)
+{
+    size_t numViews = 0;
+    
+    // one message per peer per pass so a busy peer can't starve the others,
+    // every step either fills a view or drops a peer from the ready list
+    while (numViews < maxViews && !m_readyPeers.empty())
+    {
+        for (size_t i = 0; i < m_readyPeers.size() && numViews < maxViews;)
+        {
+            RUDP::Peer *peer = m_readyPeers[i];
+            
+            if (peer->receiveMessage(&views[numViews]))
+            {
+                numViews++;
+            }
+            
+            if (peer->hasReadyChannels())
+            {
+                i++;
+            }
+            else
+            {
+                peer->m_isReadyListed = false;
+                m_readyPeers[i] = m_readyPeers.back();
+                m_readyPeers.pop_back();
+            }
+        }
+    }
+    
+    return numViews;
+}
+
+void RUDP::Socket::setNumShards(uint32_t numShards)
+{
+    for (size_t i = 0; i < m_shards.size(); i++)
+    {
+        delete m_shards[i];
+    }
+    
+    m_shards.clear();
+    
+    for (uint32_t i = 0; i < numShards; i++)
+    {
+        m_shards.push_back(new RUDP::Shard(this));
+        m_shards.back()->start();
+    }
+}
+
+size_t RUDP::Socket::pollShardMessages(RUDP::ShardMessage *messages, size_t maxMessages)
+{
+    size_t numMessages = 0;
+    bool received = true;
+    
+    while (numMessages < maxMessages && received)
+    {
+        received = false;
+        
+        for (size_t i = 0; i < m_shards.size() && numMessages < maxMessages; i++)
+        {
+            RUDP::ShardMessage *msg = &messages[numMessages];
+            if (!m_shards[i]->dequeue(msg))
+            {
+                continue;
+            }
+            
+            msg->m_peer = m_peerList.find(&msg->m_key);
+            if (!msg->m_peer)
+            {
+                msg->m_peer = getPeer(&msg->m_key, &msg->m_addr);
+                if (msg->m_peer)
+                {
+                    m_newPeers.push_back(msg->m_peer);
+                }
+            }
+            
+            numMessages++;
+            received = true;
+        }
+    }
+    
+    return numMessages;
+}
+
+RUDP::EventHandle RUDP::Socket::getReadyHandle()
+{
+    return m_readyEvent.getHandle();
+}
+
+RUDP::Peer *RUDP::Socket::acceptPeer()
+{
+    if (m_newPeersIndex == m_newPeers.size())
+    {
+        return NULL;
+    }
+    
+    RUDP::Peer *peer = m_newPeers[m_newPeersIndex++];
+    
+    if (m_newPeersIndex == m_newPeers.size())
+    {
+        m_newPeers.clear();
+        m_newPeersIndex = 0;
+    }
+    
+    return peer;
+}
+
+void RUDP::Socket::setMessageAcknowledgedCallback(RUDP::MessageAcknowledgedCallback callback)
+{
+    m_acknowledgedCallback = callback;
 }
 
 RUDP::Peer *RUDP::Socket::getPeer(uint32_t ipv4, uint16_t port)
@@ -360,26 +944,38 @@ RUDP::Peer *RUDP::Socket::getPeer(uint32_t ipv4, uint16_t port)
 
 RUDP::Peer *RUDP::Socket::getPeer(sockaddr_storage *addr)
 {
-    RUDP::Peer key(this, addr);
-    RUDP::Peer *result = m_peerList.find(&key);
+    RUDP::PeerKey key;
+    key.set(addr);
+    
+    return getPeer(&key, addr);
+}
+
+RUDP::Peer *RUDP::Socket::getPeer(RUDP::PeerKey *key, sockaddr_storage *addr)
+{
+    RUDP::Peer *result = m_peerList.find(key);
     if (!result)
     {
-        result = m_peerList.insert(&key);
+        result = m_peerList.insert(key, this, addr);
     }
     
     return result;
 }
 
-void RUDP::Socket::enqueueAcknowledgments(RUDP::List<RUDP::Packet> *list)
+bool RUDP::Socket::enqueueOutgoingPackets(RUDP::List<RUDP::Packet> *list)
 {
-    m_ackQueueLock.lock();
-    m_ackQueue.inheritFrom(list);
-    m_ackQueueLock.unlock();
-}
-
-void RUDP::Socket::enqueueOutgoingPackets(RUDP::List<RUDP::Packet> *list)
-{
-    m_outQueueLock.lock();
-    m_outQueue.inheritFrom(list);
-    m_outQueueLock.unlock();
+    if (!list->peek())
+    {
+        return true;
+    }
+    
+    RUDP::Chain<RUDP::Packet> chain = list->detach();
+    
+    if (!m_outQueue.push(chain))
+    {
+        list->attach(chain);
+        return false;
+    }
+    
+    m_sendEvent.signal();
+    return true;
 }
\ No newline at end of file
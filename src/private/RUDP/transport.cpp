@@ -0,0 +1,302 @@
+//
+//  transport.cpp
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+#include <RUDP/transport.h>
+#include <RUDP/socket.h>
+#include <fcntl.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
+#ifdef __linux__
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET 70
+#endif
+#ifndef SO_RXQ_OVFL
+#define SO_RXQ_OVFL 40
+#endif
+#endif
+
+RUDP::UdpTransport::UdpTransport() :
+m_handle(0),
+m_numDropped(0),
+m_isOpen(false)
+{
+    memset(&m_address, 0, sizeof(m_address));
+}
+
+RUDP::UdpTransport::~UdpTransport()
+{
+    close();
+}
+
+bool RUDP::UdpTransport::open(sockaddr *target, socklen_t targetSize)
+{
+    // the family of the address to bind decides between an ipv4 and an ipv6 socket
+    m_handle = socket(target->sa_family, SOCK_DGRAM, IPPROTO_UDP);
+    if(m_handle <= 0)
+    {
+        RUDP::Socket::PrintLastSocketError("Creating socket");
+        return false;
+    }
+    
+    m_isOpen = true;
+    
+    int bindResult = bind(m_handle, (const sockaddr*)target, targetSize);
+    if(bindResult < 0)
+    {
+        RUDP::Socket::PrintLastSocketError("Binding Socket");
+        return false;
+    }
+    
+    // non-blocking
+#ifdef _WIN32
+    u_long iMode = 1;
+    if (ioctlsocket(m_handle, FIONBIO, &iMode) != NO_ERROR)
+#else
+        if(fcntl(m_handle, F_SETFL, O_NONBLOCK, 1) == -1)
+#endif
+        {
+            RUDP::Socket::PrintLastSocketError("Setting Socket to Non-Blocking");
+            return false;
+        }
+
+#ifdef __linux__
+    // every read then reports how many datagrams the kernel dropped for lack of buffer space
+    int reportDrops = 1;
+    if (setsockopt(m_handle, SOL_SOCKET, SO_RXQ_OVFL, &reportDrops, sizeof(reportDrops)) != 0)
+    {
+        RUDP::Socket::PrintLastSocketError("Setting SO_RXQ_OVFL");
+    }
+#endif
+    
+    memcpy(&m_address, target, targetSize > sizeof(sockaddr_storage) ? sizeof(sockaddr_storage) : targetSize);
+    
+    return true;
+}
+
+void RUDP::UdpTransport::close()
+{
+    if (m_isOpen)
+    {
+        RUDP_CLOSESOCKET(m_handle);
+        m_isOpen = false;
+    }
+}
+
+bool RUDP::UdpTransport::setBufferSizes(int receiveSize, int sendSize)
+{
+    if (!m_isOpen)
+    {
+        return false;
+    }
+    
+    bool result = true;
+    
+    if (receiveSize > 0 && setsockopt(m_handle, SOL_SOCKET, SO_RCVBUF, (const char*)&receiveSize, sizeof(receiveSize)) != 0)
+    {
+        RUDP::Socket::PrintLastSocketError("Setting SO_RCVBUF");
+        result = false;
+    }
+    
+    if (sendSize > 0 && setsockopt(m_handle, SOL_SOCKET, SO_SNDBUF, (const char*)&sendSize, sizeof(sendSize)) != 0)
+    {
+        RUDP::Socket::PrintLastSocketError("Setting SO_SNDBUF");
+        result = false;
+    }
+    
+    return result;
+}
+
+bool RUDP::UdpTransport::setBusyPoll(uint32_t us, uint32_t budget, bool prefer)
+{
+#ifdef __linux__
+    if (!m_isOpen)
+    {
+        return false;
+    }
+    
+    int value = (int)us;
+    if (setsockopt(m_handle, SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value)) != 0)
+    {
+        RUDP::Socket::PrintLastSocketError("Setting SO_BUSY_POLL");
+        return false;
+    }
+    
+    // both need a 5.11 kernel, older ones only get the plain busy poll
+    bool result = true;
+    
+    value = prefer ? 1 : 0;
+    if (setsockopt(m_handle, SOL_SOCKET, SO_PREFER_BUSY_POLL, &value, sizeof(value)) != 0)
+    {
+        result = false;
+    }
+    
+    value = (int)budget;
+    if (budget > 0 && setsockopt(m_handle, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &value, sizeof(value)) != 0)
+    {
+        result = false;
+    }
+    
+    return result;
+#else
+    return us == 0;
+#endif
+}
+
+RUDP::SocketHandle RUDP::UdpTransport::getHandle()
+{
+    return m_handle;
+}
+
+void RUDP::UdpTransport::getAddress(sockaddr_storage *address)
+{
+    memcpy(address, &m_address, sizeof(m_address));
+}
+
+uint64_t RUDP::UdpTransport::getNumDropped()
+{
+    return m_numDropped;
+}
+
+bool RUDP::UdpTransport::send(const RUDP::TransportBuffer *buffers, size_t numBuffers, const sockaddr_storage *target)
+{
+    socklen_t targetLen = sizeof(sockaddr_storage);
+    
+    switch(target->ss_family)
+    {
+        case AF_INET:
+            targetLen = sizeof(sockaddr_in);
+            break;
+        
+        case AF_INET6:
+            targetLen = sizeof(sockaddr_in6);
+            break;
+    }
+    
+    size_t dataLen = 0;
+    ssize_t sentBytes = 0;
+    
+    if (numBuffers > 1)
+    {
+        // gathered straight from the pieces, e.g. a header and a shared payload
+#ifdef _WIN32
+        WSABUF parts[4];
+        DWORD numParts = 0;
+        
+        for (; numParts < numBuffers && numParts < RUDP_ARRAYSIZE(parts); numParts++)
+        {
+            parts[numParts].buf = (char*)buffers[numParts].m_data;
+            parts[numParts].len = (ULONG)buffers[numParts].m_dataLen;
+            dataLen += buffers[numParts].m_dataLen;
+        }
+        
+        DWORD numSent = 0;
+        sentBytes = WSASendTo(m_handle, parts, numParts, &numSent, 0, (const sockaddr*)target, targetLen, NULL, NULL) == 0 ? (ssize_t)numSent : -1;
+#else
+        iovec parts[4];
+        size_t numParts = 0;
+        
+        for (; numParts < numBuffers && numParts < RUDP_ARRAYSIZE(parts); numParts++)
+        {
+            parts[numParts].iov_base = (void*)buffers[numParts].m_data;
+            parts[numParts].iov_len = buffers[numParts].m_dataLen;
+            dataLen += buffers[numParts].m_dataLen;
+        }
+        
+        msghdr msg = {};
+        msg.msg_name = (void*)target;
+        msg.msg_namelen = targetLen;
+        msg.msg_iov = parts;
+        msg.msg_iovlen = numParts;
+        
+        sentBytes = sendmsg(m_handle, &msg, 0);
+#endif
+    }
+    else
+    {
+        dataLen = buffers[0].m_dataLen;
+        sentBytes = sendto(m_handle, (sockdataptr_t)buffers[0].m_data, dataLen, 0, (const sockaddr*)target, targetLen);
+    }
+    
+    if (sentBytes != (ssize_t)dataLen)
+    {
+        RUDP::Socket::PrintLastSocketError("Sending Packet");
+        return false;
+    }
+    
+    return true;
+}
+
+ssize_t RUDP::UdpTransport::receive(char *buffer, size_t bufferLen, sockaddr_storage *sender)
+{
+    socklen_t senderSize = sizeof(sockaddr_storage);
+
+#ifdef __linux__
+    iovec part;
+    part.iov_base = buffer;
+    part.iov_len = bufferLen;
+    
+    char control[CMSG_SPACE(sizeof(uint32_t))];
+    msghdr msg = {};
+    msg.msg_name = sender;
+    msg.msg_namelen = senderSize;
+    msg.msg_iov = &part;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    
+    ssize_t bytesRead = recvmsg(m_handle, &msg, 0);
+    
+    // the kernel only attaches the running drop count once it is above zero
+    for (cmsghdr *cmsg = bytesRead == -1 ? NULL : CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+        {
+            uint32_t numDropped = 0;
+            memcpy(&numDropped, CMSG_DATA(cmsg), sizeof(numDropped));
+            m_numDropped = numDropped;
+        }
+    }
+#else
+    ssize_t bytesRead = recvfrom(m_handle, buffer, (int)bufferLen, 0, (sockaddr*)sender, &senderSize);
+#endif
+    
+    if (bytesRead == -1)
+    {
+        RUDP::Socket::PrintLastSocketError("Receiving Packet");
+    }
+    
+    return bytesRead;
+}
+
+void RUDP::UdpTransport::wait(RUDP::Event *wakeup, uint64_t ms)
+{
+#ifdef _WIN32
+    // select can't wait on the event, so it is only picked up once the short timeout runs out
+    fd_set readSet;
+    FD_ZERO(&readSet);
+    FD_SET(m_handle, &readSet);
+    timeval timeout = { 0, ms > 1 ? 1000 : (long)ms * 1000 };
+    select(0, &readSet, NULL, NULL, &timeout);
+#else
+    pollfd fds[2] = {};
+    fds[0].fd = m_handle;
+    fds[0].events = POLLIN;
+    fds[1].fd = wakeup->getHandle();
+    fds[1].events = POLLIN;
+    ::poll(fds, 2, (int)ms);
+#endif
+}
\ No newline at end of file
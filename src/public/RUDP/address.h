@@ -0,0 +1,74 @@
+//
+//  address.h
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+#ifndef RUDP_address_h
+#define RUDP_address_h
+
+#include <stdint.h>
+#include <string.h>
+#include <RUDP/platform.h>
+
+namespace RUDP
+{
+    // 64x64 -> 128 bit multiply folded back to 64 bits, the core of wyhash
+    inline uint64_t hashMix(uint64_t a, uint64_t b)
+    {
+#if defined(__SIZEOF_INT128__)
+        __uint128_t r = (__uint128_t)a * b;
+        return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+        uint64_t ha = a >> 32, la = (uint32_t)a;
+        uint64_t hb = b >> 32, lb = (uint32_t)b;
+        uint64_t hh = ha * hb, hl = ha * lb, lh = la * hb, ll = la * lb;
+        uint64_t mid = (ll >> 32) + (uint32_t)hl + (uint32_t)lh;
+        uint64_t lo = (mid << 32) | (uint32_t)ll;
+        uint64_t hi = hh + (hl >> 32) + (lh >> 32) + (mid >> 32);
+        return lo ^ hi;
+#endif
+    }
+    
+    // canonical compact form of a peer address: port + ipv4 (6 bytes) or port + ipv6 (18 bytes)
+    struct PeerKey
+    {
+        uint8_t m_family;
+        uint8_t m_length;
+        uint8_t m_data[18];
+        
+        PeerKey() : m_family(0), m_length(0)
+        {
+            memset(m_data, 0, sizeof(m_data));
+        }
+        
+        void set(const sockaddr_storage *addr);
+        
+        uint64_t hash() const
+        {
+            static const uint64_t s0 = 0xa0761d6478bd642fULL;
+            static const uint64_t s1 = 0xe7037ed1a0b428dbULL;
+            static const uint64_t s2 = 0x8ebc6af09c88c6e3ULL;
+            
+            uint64_t a = 0, b = 0, c = 0;
+            memcpy(&a, m_data, 8);
+            
+            if (m_length > 8)
+            {
+                memcpy(&b, m_data + 8, 8);
+                memcpy(&c, m_data + 16, 2);
+            }
+            
+            uint64_t seed = hashMix(a ^ s0, b ^ s1 ^ m_family);
+            return hashMix(seed ^ c ^ s2, (uint64_t)m_length ^ s1);
+        }
+        
+        bool equals(const PeerKey *other) const
+        {
+            return memcmp(this, other, sizeof(PeerKey)) == 0;
+        }
+    };
+}
+
+#endif
\ No newline at end of file
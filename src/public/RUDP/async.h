@@ -0,0 +1,172 @@
+//
+//  async.h
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+#ifndef RUDP_async_h
+#define RUDP_async_h
+
+// optional coroutine layer, only available when the compiler supports C++20 coroutines
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define RUDP_HAS_COROUTINES 1
+#endif
+#endif
+
+#ifdef RUDP_HAS_COROUTINES
+
+#include <RUDP/socket.h>
+#include <coroutine>
+#include <exception>
+#include <vector>
+
+namespace RUDP
+{
+    // size classed free lists for coroutine frames, frames are recycled per thread
+    // instead of going back to the heap after every operation
+    class FramePool
+    {
+    public:
+        static const size_t Granularity = 64;
+        static const size_t NumClasses = 32;
+        
+        static void *allocate(size_t size);
+        static void deallocate(void *ptr, size_t size);
+    };
+    
+    class Executor;
+    
+    // fire and forget coroutine, started and owned by an Executor once spawned
+    class Task
+    {
+    public:
+        struct promise_type
+        {
+            Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+            std::suspend_always initial_suspend() noexcept { return std::suspend_always(); }
+            std::suspend_never final_suspend() noexcept { return std::suspend_never(); }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+            
+            static void *operator new(size_t size) { return RUDP::FramePool::allocate(size); }
+            static void operator delete(void *ptr, size_t size) { RUDP::FramePool::deallocate(ptr, size); }
+        };
+        
+        Task(Task &&other) noexcept : m_handle(other.m_handle) { other.m_handle = nullptr; }
+        ~Task() { if (m_handle) { m_handle.destroy(); } }
+        
+    private:
+        friend class Executor;
+        
+        std::coroutine_handle<promise_type> m_handle;
+        
+        explicit Task(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+        Task(const Task &other) = delete;
+        Task &operator=(const Task &other) = delete;
+    };
+    
+    // resumes with the next message on one channel of a peer, the view must be released by the caller
+    class ReceiveAwaiter
+    {
+        friend class Executor;
+        
+    private:
+        RUDP::Executor *m_executor;
+        RUDP::Peer *m_peer;
+        RUDP::ChannelId m_channel;
+        RUDP::MessageView m_view;
+        std::coroutine_handle<> m_handle;
+        RUDP::ReceiveAwaiter *m_next;
+        
+    public:
+        ReceiveAwaiter(RUDP::Executor *executor, RUDP::Peer *peer, RUDP::ChannelId channel) :
+        m_executor(executor), m_peer(peer), m_channel(channel), m_next(nullptr) {}
+        
+        bool await_ready() { return m_peer->receiveMessage(m_channel, &m_view); }
+        void await_suspend(std::coroutine_handle<> handle);
+        RUDP::MessageView await_resume() { return m_view; }
+    };
+    
+    // enqueues a reliable message and resumes once the peer has acknowledged every fragment
+    class SendAwaiter
+    {
+        friend class Executor;
+        
+    private:
+        RUDP::Executor *m_executor;
+        RUDP::PeerMessage *m_message;
+        RUDP::EnqueueMessageOption m_options;
+        RUDP::EnqueueMessageResult m_result;
+        std::coroutine_handle<> m_handle;
+        
+    public:
+        SendAwaiter(RUDP::Executor *executor, RUDP::PeerMessage *message, RUDP::EnqueueMessageOption options) :
+        m_executor(executor), m_message(message), m_options(options), m_result(RUDP::EnqueueMessageResult_Success) {}
+        
+        bool await_ready() { return false; }
+        bool await_suspend(std::coroutine_handle<> handle);
+        RUDP::EnqueueMessageResult await_resume() { return m_result; }
+    };
+    
+    // resumes with the next peer that contacted us first
+    class AcceptAwaiter
+    {
+        friend class Executor;
+        
+    private:
+        RUDP::Executor *m_executor;
+        RUDP::Peer *m_peer;
+        std::coroutine_handle<> m_handle;
+        RUDP::AcceptAwaiter *m_next;
+        
+    public:
+        AcceptAwaiter(RUDP::Executor *executor);
+        
+        bool await_ready() { return m_peer != nullptr; }
+        void await_suspend(std::coroutine_handle<> handle);
+        RUDP::Peer *await_resume() { return m_peer; }
+    };
+    
+    // single threaded executor, all coroutines and all calls into it must stay on one thread.
+    // runOnce drives the socket itself, poll can be used instead when another thread calls Socket::update
+    class Executor
+    {
+        friend class ReceiveAwaiter;
+        friend class SendAwaiter;
+        friend class AcceptAwaiter;
+        
+    private:
+        RUDP::Socket *m_socket;
+        std::vector<std::coroutine_handle<>> m_ready;
+        std::vector<std::coroutine_handle<>> m_running;
+        
+        // waiting operations, kept in arrival order
+        RUDP::ReceiveAwaiter *m_receivers;
+        RUDP::ReceiveAwaiter **m_receiversEnd;
+        RUDP::AcceptAwaiter *m_acceptors;
+        RUDP::AcceptAwaiter **m_acceptorsEnd;
+        
+        Executor(const Executor &other) = delete;
+        Executor &operator=(const Executor &other) = delete;
+        
+        static void OnMessageAcknowledged(RUDP::Peer *peer, RUDP::ChannelId channel, void *userData, bool isExpired);
+        
+    public:
+        Executor(RUDP::Socket *socket);
+        ~Executor();
+        
+        void spawn(RUDP::Task task);
+        size_t poll();
+        size_t runOnce(uint64_t msTimeout);
+        
+        RUDP::ReceiveAwaiter receive(RUDP::Peer *peer, RUDP::ChannelId channel);
+        RUDP::SendAwaiter sendReliable(RUDP::PeerMessage *message, RUDP::EnqueueMessageOption options = RUDP::EnqueueMessageOption_InOrder);
+        RUDP::AcceptAwaiter accept();
+    };
+}
+
+#endif
+
+#endif
\ No newline at end of file
@@ -10,22 +10,185 @@
 #define RUDP_channel_h
 
 #include <RUDP/list.h>
+#include <RUDP/map.h>
+#include <RUDP/address.h>
+#include <RUDP/queue.h>
 #include <RUDP/packet.h>
+#include <RUDP/scheduler.h>
+#include <RUDP/counters.h>
+#include <RUDP/histogram.h>
+#include <atomic>
 
 namespace RUDP
 {
+    // packet ids remembered per channel for duplicate suppression
+    const uint16_t DuplicateWindow = 1024;
+    
+    // ids a channel may run past its oldest unsettled reliable message, the receiver has to tell them
+    // apart from ids it already passed
+    const uint16_t MaxUnsettledSpan = RUDP::MaxFragments - RUDP::DuplicateWindow;
+    
+    // what became of a received fragment or skip. known ones were received or passed before and are
+    // acknowledged again, dropped ones are left for the sender to retransmit
+    enum ReceiveResult
+    {
+        ReceiveResult_Kept,
+        ReceiveResult_Known,
+        ReceiveResult_Dropped
+    };
+    
+    // send side record of a reliable message, complete once every fragment has been acknowledged
+    struct PendingMessage
+    {
+        RUDP::PacketId m_messageId;
+        uint16_t m_numRemaining;
+        void *m_userData;
+        uint64_t m_enqueueTime; // us
+    };
+    
+    struct PendingKey
+    {
+        RUDP::PacketId m_messageId;
+        
+        uint64_t hash() const
+        {
+            return RUDP::hashMix(m_messageId, 0x9e3779b97f4a7c15ULL);
+        }
+        
+        bool equals(const PendingKey *other) const
+        {
+            return m_messageId == other->m_messageId;
+        }
+    };
+    
     struct Channel
     {
         RUDP::List<RUDP::Packet> m_queue;
         RUDP::List<RUDP::MessageStart> m_messages;
+        RUDP::List<RUDP::PendingMessage> m_pending;     // owned by the thread handling acks
+        RUDP::ChainStack<RUDP::PendingMessage> m_newPending; // added by sending threads, moved into m_pending on use
+        RUDP::Map<RUDP::PendingKey, RUDP::PendingMessage*> m_pendingIndex; // m_pending by message id
+        uint32_t m_numPendingShadowed; // pending messages whose id an older one still holds
+        uint32_t m_numPending;         // in m_pending
+        
+        // reliable messages from staging until acknowledged or skipped, counted by every thread involved.
+        // while the count matches m_pending the oldest of them is published for the receiver
+        std::atomic<uint32_t> m_numUnsettled;
+        std::atomic<RUDP::PacketId> m_settledBefore;
+        
+        // stream mode, packet ids count stream packets instead of fragments. the receiver acknowledges
+        // a packet only once it has been read, so the sender's window also bounds the receive buffer
+        RUDP::List<RUDP::Packet> m_stream;
+        RUDP::PacketId m_streamNextRead;
+        RUDP::PacketId m_streamNextSend;
+        uint16_t m_streamInFlight;
+        uint16_t m_streamWindow;
+        
+        // newest packet id received and a ring bitmap of the DuplicateWindow ids up to it
         RUDP::PacketId m_lastAcknowledged;
+        uint64_t m_receivedWindow[RUDP::DuplicateWindow / 64];
+        bool m_hasReceived;
+        
+        // every message before m_nextMessageId was delivered, skipped or given up. gaps the sender still
+        // retransmits into wait, the rest are moved past once they leave the duplicate window
+        RUDP::PacketId m_nextMessageId;
+        RUDP::PacketId m_peerSettledBefore; // newest m_settledBefore the sender announced
+        uint32_t m_numAvailable;
+        std::atomic<RUDP::PacketId> m_nextPacketId;
+        
+        // receive side delivery scheduling
+        RUDP::ChannelId m_id;
+        uint16_t m_weight;
+        size_t m_deficit;
+        
+        // send side scheduling, see RUDP::SendScheduler
+        RUDP::SendPriority m_sendClass;
+        uint16_t m_sendWeight;
+        
+        RUDP::CounterSlot m_sendCounters;    // written by the socket's update thread
+        RUDP::CounterSlot m_receiveCounters; // written by the thread receiving the channel, or its shard
+        uint32_t m_numQueued;                // fragments in m_queue
+        
+        // allocated on the first sample, each kind is recorded by one thread: round trips by the update
+        // thread, ack latency by the thread handling acks, the rest by the thread receiving the channel
+        std::atomic<RUDP::Histogram*> m_histograms[RUDP::LatencyHistogram_Count];
+        
+        Channel(RUDP::ChannelId id) :
+        m_pendingIndex(64),
+        m_numPendingShadowed(0),
+        m_numPending(0),
+        m_streamNextRead(0),
+        m_streamNextSend(0),
+        m_streamInFlight(0),
+        m_streamWindow(RUDP::DefaultStreamWindow),
+        m_lastAcknowledged(0),
+        m_hasReceived(false),
+        m_nextMessageId(0),
+        m_peerSettledBefore(0),
+        m_numAvailable(0),
+        m_id(id),
+        m_weight(1),
+        m_deficit(0),
+        m_sendClass(RUDP::SendPriority_Normal),
+        m_sendWeight(1),
+        m_numQueued(0)
+        {
+            m_numUnsettled = 0;
+            m_settledBefore = 0;
+            m_nextPacketId = 0;
+            memset(m_receivedWindow, 0, sizeof(m_receivedWindow));
+            
+            for (int i = 0; i < RUDP::LatencyHistogram_Count; i++)
+            {
+                m_histograms[i] = NULL;
+            }
+        }
+        
+        ~Channel();
+        
+        void recordLatency(RUDP::LatencyHistogram histogram, uint64_t us);
+        
+        // any thread, false when nothing was recorded yet
+        bool readLatency(RUDP::LatencyHistogram histogram, RUDP::HistogramSnapshot *snapshot);
+        
+        bool isDuplicate(RUDP::PacketId packetId);
+        void markSettled(RUDP::PacketId settledBefore);
+        void markReceived(RUDP::PacketId packetId);
+        
+        RUDP::MessageStart *findMessage(RUDP::PacketId messageId);
+        RUDP::MessageStart *addMessage(RUDP::PacketHeader *header, uint64_t arrivalTime);
+        bool addFragment(RUDP::MessageStart *msg, RUDP::Packet *pck);
+        void updateQueueDepth(int32_t delta);
+        
+        RUDP::MessageStart *peekMessage();
+        void holdMessage(RUDP::MessageStart *msg);
+        void removeMessage(RUDP::MessageStart *msg);
+        RUDP::ReceiveResult skipMessage(RUDP::PacketHeader *header);
+        void expireMessages();
+        bool expireOldest();
         
-        Channel() : m_lastAcknowledged(0) {}
+        // sending threads allocate the record on the side and publish it once the message has its ids
+        RUDP::PendingMessage *stagePending(RUDP::List<RUDP::PendingMessage> *staged, uint16_t numFragments, void *userData, uint64_t enqueueTime);
+        void addPending(RUDP::List<RUDP::PendingMessage> *staged, RUDP::PacketId messageId);
+        bool removePending(RUDP::PacketId messageId, void **userData);
+        bool acknowledgeFragment(RUDP::PacketId messageId, void **userData, uint64_t ackTime);
+        RUDP::PacketId getSettledBefore();
         
-        RUDP::MessageStart *addMessage(RUDP::Packet *start, RUDP::Packet *end);
+        bool addStreamPacket(RUDP::Packet *pck);
+        size_t readStream(char *buffer, size_t bufferLen, RUDP::List<RUDP::Packet> *consumed);
+    
+    private:
+        Channel(const Channel &other);
+        Channel &operator=(const Channel &other);
         
-        RUDP::Packet *findMessageEnd(RUDP::Packet *newPck);
-        RUDP::Packet *findMessageStart(RUDP::Packet *newPck);
+        void advance(RUDP::PacketId giveUpBefore);
+        void collectPending();
+        RUDP::PendingMessage *findPending(RUDP::PacketId messageId);
+        void erasePending(RUDP::PendingMessage *pending);
+        void updateSettledBefore();
+        void supersede(RUDP::MessageStart *msg);
+        void freeFragments(RUDP::MessageStart *msg);
+        void eraseMessage(RUDP::MessageStart *msg);
     };
 }
 
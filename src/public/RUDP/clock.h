@@ -0,0 +1,47 @@
+//
+//  clock.h
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+#ifndef RUDP_clock_h
+#define RUDP_clock_h
+
+#include <stdint.h>
+#include <atomic>
+
+namespace RUDP
+{
+    typedef uint64_t (*ClockSource)(void *context);
+    
+    // monotonic microseconds from an arbitrary start, unaffected by wall clock adjustments. the socket
+    // reads it once per update pass and once per reliable packet sent
+    class Clock
+    {
+    private:
+        static std::atomic<RUDP::ClockSource> s_source;
+        static void *s_sourceContext;
+        static std::atomic<bool> s_useTsc;
+        static double s_usPerTick;
+        static uint64_t s_tscBase;
+        static uint64_t s_usBase;
+        
+        static uint64_t readSystem();
+    
+    public:
+        static uint64_t now();
+        
+        // switches now() to the cpu's timestamp counter, calibrated against the system clock for
+        // calibrationMs. only taken when the counter is invariant across cores and power states,
+        // false leaves the system clock in use
+        static bool enableTsc(uint32_t calibrationMs = 20);
+        static bool isTscEnabled();
+        
+        // hands now() over to source for the whole process, e.g. a simulation's virtual time. NULL goes
+        // back to the system clock or the counter. only while no socket is being updated
+        static void setSource(RUDP::ClockSource source, void *context);
+    };
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,130 @@
+//
+//  counters.h
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+#ifndef RUDP_counters_h
+#define RUDP_counters_h
+
+#include <RUDP/util.h>
+#include <RUDP/queue.h>
+#include <stdint.h>
+#include <atomic>
+
+namespace RUDP
+{
+    enum Counter : uint8_t
+    {
+        Counter_PacketsSent = 0,     // datagrams written, retransmissions included
+        Counter_BytesSent,           // header and payload
+        Counter_PacketsReceived,     // datagrams read, or fragments kept for reassembly on a channel
+        Counter_BytesReceived,
+        Counter_Retransmits,         // reliable packets sent again after the ack timeout
+        Counter_Duplicates,          // fragments that had already been received
+        Counter_OutOfOrder,          // fragments that arrived ahead of or behind the next expected id
+        Counter_AcksSent,
+        Counter_AcksReceived,        // only the first ack for a packet counts
+        Counter_ReassemblyDepth,     // gauge, fragments buffered in the channel until their message is released
+        Counter_KernelDrops,         // gauge, datagrams the kernel or transport dropped because the receive buffer was full
+        Counter_Count
+    };
+    
+    inline const char *Counter_ToString(Counter counter)
+    {
+        switch(counter)
+        {
+                RUDP_STRINGIFY_CASE(Counter_PacketsSent);
+                RUDP_STRINGIFY_CASE(Counter_BytesSent);
+                RUDP_STRINGIFY_CASE(Counter_PacketsReceived);
+                RUDP_STRINGIFY_CASE(Counter_BytesReceived);
+                RUDP_STRINGIFY_CASE(Counter_Retransmits);
+                RUDP_STRINGIFY_CASE(Counter_Duplicates);
+                RUDP_STRINGIFY_CASE(Counter_OutOfOrder);
+                RUDP_STRINGIFY_CASE(Counter_AcksSent);
+                RUDP_STRINGIFY_CASE(Counter_AcksReceived);
+                RUDP_STRINGIFY_CASE(Counter_ReassemblyDepth);
+                RUDP_STRINGIFY_CASE(Counter_KernelDrops);
+                RUDP_STRINGIFY_CASE(Counter_Count);
+        }
+        
+        return "UNKNOWN";
+    }
+    
+    struct CounterSnapshot
+    {
+        uint64_t m_values[RUDP::Counter_Count];
+        
+        CounterSnapshot()
+        {
+            clear();
+        }
+        
+        void clear();
+        void add(const RUDP::CounterSnapshot &other);
+        uint64_t get(RUDP::Counter counter) const { return m_values[counter]; }
+    };
+    
+    // counters with exactly one writing thread, padded so neighbouring slots written by other threads
+    // never share a cache line. updates between begin and end become visible together: readers copy the
+    // values and retry if the version moved meanwhile, the writer never waits for them
+    class CounterSlot
+    {
+    private:
+        char m_pad0[RUDP::CacheLineSize];
+        std::atomic<uint32_t> m_version; // odd while the writer is between begin and end
+        std::atomic<uint64_t> m_values[RUDP::Counter_Count];
+        char m_pad1[RUDP::CacheLineSize];
+        
+        CounterSlot(const CounterSlot &other);
+        CounterSlot &operator=(const CounterSlot &other);
+        
+    public:
+        CounterSlot();
+        
+        // writer only
+        inline void begin()
+        {
+            m_version.store(m_version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+        
+        // writer only, plain load and store since nobody else writes the slot
+        inline void add(RUDP::Counter counter, uint64_t amount)
+        {
+            m_values[counter].store(m_values[counter].load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+        }
+        
+        // writer only
+        inline void set(RUDP::Counter counter, uint64_t value)
+        {
+            m_values[counter].store(value, std::memory_order_relaxed);
+        }
+        
+        // writer only
+        inline void end()
+        {
+            m_version.store(m_version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+        
+        // any thread, adds the slot's values to the snapshot
+        void read(RUDP::CounterSnapshot *snapshot);
+    };
+    
+    struct PoolUsage
+    {
+        size_t m_numUsed;
+        size_t m_numTotal;
+    };
+    
+    struct SocketCounters
+    {
+        RUDP::CounterSnapshot m_traffic; // every datagram through the socket, acks and skips included
+        RUDP::PoolUsage m_packets;
+        RUDP::PoolUsage m_messages;  // reassembly table entries
+        RUDP::PoolUsage m_pending;   // reliable messages awaiting acks
+    };
+}
+
+#endif
\ No newline at end of file
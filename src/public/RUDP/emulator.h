@@ -0,0 +1,246 @@
+//
+//  emulator.h
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+#ifndef RUDP_emulator_h
+#define RUDP_emulator_h
+
+#include <RUDP/transport.h>
+#include <RUDP/address.h>
+#include <RUDP/map.h>
+#include <RUDP/util.h>
+#include <RUDP/packet.h>
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+#include <atomic>
+
+namespace RUDP
+{
+    class EmulatedTransport;
+    
+    typedef void (*DeliveryCallback)(RUDP::EmulatedTransport *target, uint64_t due, void *context);
+    
+    // impairments applied to one direction of a link, everything off by default
+    struct LinkConditions
+    {
+        // gilbert-elliott loss: datagrams are lost with m_lossRate in the good state and m_badLossRate
+        // in the bad one, the link moves between them with m_goodToBad and m_badToGood per datagram.
+        // with m_goodToBad at 0 the link never leaves the good state, which is plain bernoulli loss
+        double m_lossRate;
+        double m_badLossRate;
+        double m_goodToBad;
+        double m_badToGood;
+        
+        // every datagram takes m_delayUs plus a uniform 0 to m_jitterUs, so jitter reorders as well.
+        // m_reorderRate of them are held back another m_reorderDelayUs and overtaken by later ones
+        uint64_t m_delayUs;
+        uint64_t m_jitterUs;
+        double m_reorderRate;
+        uint64_t m_reorderDelayUs;
+        
+        double m_duplicateRate;
+        
+        // serialization at m_bytesPerSecond, 0 for no cap. datagrams that would wait behind more
+        // than m_queueBytes of earlier ones are tail dropped, 0 lets the queue grow without bound
+        uint64_t m_bytesPerSecond;
+        uint64_t m_queueBytes;
+        
+        // larger datagrams are dropped, 0 for no limit
+        uint32_t m_mtu;
+        
+        LinkConditions() :
+        m_lossRate(0),
+        m_badLossRate(0),
+        m_goodToBad(0),
+        m_badToGood(0),
+        m_delayUs(0),
+        m_jitterUs(0),
+        m_reorderRate(0),
+        m_reorderDelayUs(0),
+        m_duplicateRate(0),
+        m_bytesPerSecond(0),
+        m_queueBytes(0),
+        m_mtu(0)
+        {
+        }
+    };
+    
+    struct LinkStats
+    {
+        uint64_t m_numSent;       // datagrams handed to the link
+        uint64_t m_numBytesSent;
+        uint64_t m_numDelivered;  // copies scheduled for delivery, duplicates included
+        uint64_t m_numLost;       // random loss and datagrams to addresses nobody is bound to
+        uint64_t m_numOversized;  // above the mtu
+        uint64_t m_numQueueDrops; // tail dropped at the bandwidth cap
+        uint64_t m_numDuplicated;
+        uint64_t m_numReordered;
+        
+        void clear()
+        {
+            memset(this, 0, sizeof(*this));
+        }
+        
+        void add(const LinkStats &other)
+        {
+            m_numSent += other.m_numSent;
+            m_numBytesSent += other.m_numBytesSent;
+            m_numDelivered += other.m_numDelivered;
+            m_numLost += other.m_numLost;
+            m_numOversized += other.m_numOversized;
+            m_numQueueDrops += other.m_numQueueDrops;
+            m_numDuplicated += other.m_numDuplicated;
+            m_numReordered += other.m_numReordered;
+        }
+    };
+    
+    struct LinkKey
+    {
+        RUDP::PeerKey m_from;
+        RUDP::PeerKey m_to;
+        
+        uint64_t hash() const
+        {
+            return hashMix(m_from.hash() ^ 0x9e3779b97f4a7c15ULL, m_to.hash());
+        }
+        
+        bool equals(const LinkKey *other) const
+        {
+            return m_from.equals(&other->m_from) && m_to.equals(&other->m_to);
+        }
+    };
+    
+    struct EmulatedDatagram
+    {
+        uint64_t m_due; // us
+        uint64_t m_order; // keeps datagrams due at the same time in the order they were sent
+        sockaddr_storage m_source;
+        uint32_t m_size;
+        char m_data[RUDP::PacketSize];
+    };
+    
+    // an in-process network for EmulatedTransports. each direction between two addresses is a link
+    // with its own LinkConditions, links without their own use the default ones. every random
+    // decision comes from one seeded generator, so a single threaded run repeats exactly
+    class EmulatedNetwork
+    {
+        friend class EmulatedTransport;
+    
+    private:
+        struct Link
+        {
+            RUDP::LinkConditions m_conditions;
+            RUDP::LinkStats m_stats;
+            uint64_t m_busyUntil; // us, when the last datagram finishes serializing
+            bool m_isBad;
+            bool m_hasOwnConditions;
+            
+            Link(const RUDP::LinkConditions &conditions) : m_conditions(conditions), m_busyUntil(0), m_isBad(false), m_hasOwnConditions(false)
+            {
+                m_stats.clear();
+            }
+        };
+        
+        struct Endpoint
+        {
+            RUDP::EmulatedTransport *m_transport;
+            
+            Endpoint(RUDP::EmulatedTransport *transport) : m_transport(transport) {}
+        };
+        
+        std::mutex m_lock;
+        RUDP::Map<RUDP::LinkKey, Link> m_links;
+        std::vector<Link*> m_linkList; // owned by m_links, kept for getStats
+        RUDP::Map<RUDP::PeerKey, Endpoint> m_endpoints;
+        std::vector<RUDP::EmulatedDatagram*> m_freeDatagrams;
+        RUDP::LinkConditions m_defaultConditions;
+        RUDP::DeliveryCallback m_deliveryCallback;
+        void *m_deliveryContext;
+        RUDP::Random m_random;
+        uint64_t m_nextOrder;
+        uint64_t m_numQueued;
+        uint64_t m_maxQueued;
+        
+        EmulatedNetwork(const EmulatedNetwork &other);
+        EmulatedNetwork &operator=(const EmulatedNetwork &other);
+        
+        Link *getLink(const RUDP::LinkKey *key);
+        void attach(RUDP::EmulatedTransport *transport);
+        void detach(RUDP::EmulatedTransport *transport);
+        void send(RUDP::EmulatedTransport *source, const RUDP::TransportBuffer *buffers, size_t numBuffers, const sockaddr_storage *target);
+        void deliver(RUDP::EmulatedTransport *target, const RUDP::EmulatedDatagram *datagram);
+        void recycle(RUDP::EmulatedDatagram *datagram);
+    
+    public:
+        EmulatedNetwork(uint64_t seed = 1);
+        ~EmulatedNetwork();
+        
+        // for every link that wasn't given its own conditions
+        void setDefaultConditions(const RUDP::LinkConditions &conditions);
+        
+        // one direction only, set both from -> to and to -> from for a symmetric link
+        void setConditions(const sockaddr_storage *from, const sockaddr_storage *to, const RUDP::LinkConditions &conditions);
+        
+        bool getLinkStats(const sockaddr_storage *from, const sockaddr_storage *to, RUDP::LinkStats *stats);
+        void getStats(RUDP::LinkStats *stats);
+        
+        // datagrams in flight right now and the most there ever were
+        uint64_t getNumQueued();
+        uint64_t getMaxQueued();
+        
+        // called with the network locked for every datagram put in an inbox, with the time it is due.
+        // lets a simulation wake the receiver exactly then
+        void setDeliveryCallback(RUDP::DeliveryCallback callback, void *context);
+        
+        static void MakeAddress(sockaddr_storage *address, uint32_t ipv4, uint16_t port);
+    };
+    
+    // a socket's end of an EmulatedNetwork, passed to Socket::open(transport)
+    class EmulatedTransport : public RUDP::Transport
+    {
+        friend class EmulatedNetwork;
+    
+    private:
+        RUDP::EmulatedNetwork *m_network;
+        sockaddr_storage m_address;
+        RUDP::PeerKey m_key;
+        
+        // min heap on due time, guarded by the network's lock. m_nextDue is the top's due time or
+        // UINT64_MAX, it lets receive skip the lock while nothing is due
+        std::vector<RUDP::EmulatedDatagram*> m_inbox;
+        std::atomic<uint64_t> m_nextDue;
+        size_t m_inboxLimit;
+        std::atomic<uint64_t> m_numDropped;
+        RUDP::Event m_arrivalEvent;
+        void *m_userData;
+        
+        EmulatedTransport(const EmulatedTransport &other);
+        EmulatedTransport &operator=(const EmulatedTransport &other);
+    
+    public:
+        EmulatedTransport(RUDP::EmulatedNetwork *network, const sockaddr_storage *address);
+        EmulatedTransport(RUDP::EmulatedNetwork *network, uint32_t ipv4, uint16_t port);
+        ~EmulatedTransport();
+        
+        // datagrams waiting to be received before new ones are dropped like a full receive buffer, 0 for no limit
+        void setReceiveLimit(size_t numDatagrams);
+        
+        // due time of the next datagram to receive, UINT64_MAX while the inbox is empty
+        uint64_t getNextDue();
+        
+        void setUserData(void *userData);
+        void *getUserData();
+        
+        bool send(const RUDP::TransportBuffer *buffers, size_t numBuffers, const sockaddr_storage *target);
+        ssize_t receive(char *buffer, size_t bufferLen, sockaddr_storage *sender);
+        void wait(RUDP::Event *wakeup, uint64_t ms);
+        uint64_t getNumDropped();
+        void getAddress(sockaddr_storage *address);
+    };
+}
+
+#endif
\ No newline at end of file
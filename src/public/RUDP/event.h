@@ -0,0 +1,45 @@
+//
+//  event.h
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+#ifndef RUDP_event_h
+#define RUDP_event_h
+
+#include <RUDP/platform.h>
+#include <atomic>
+
+namespace RUDP
+{
+    // waitable handle the application can hand to epoll/kqueue/WaitForMultipleObjects,
+    // an eventfd on linux, a non-blocking pipe on other posix systems and a manual reset event on windows
+    class Event
+    {
+    private:
+        RUDP::EventHandle m_handle;
+#if !defined(_WIN32) && !defined(__linux__)
+        RUDP::EventHandle m_writeHandle;
+#endif
+        std::atomic<bool> m_isSignaled;
+        
+        Event(const Event &other);
+        Event &operator=(const Event &other);
+        
+    public:
+        Event();
+        ~Event();
+        
+        bool open();
+        void close();
+        
+        // repeated signals before the next reset only touch the handle once
+        void signal();
+        void reset();
+        
+        RUDP::EventHandle getHandle();
+    };
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,104 @@
+//
+//  histogram.h
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+#ifndef RUDP_histogram_h
+#define RUDP_histogram_h
+
+#include <RUDP/util.h>
+#include <stdint.h>
+#include <atomic>
+
+namespace RUDP
+{
+    // log bucketed: every power of two is split into 2^HistogramSubBucketBits linear buckets, so a
+    // recorded value is known to within 1/16 of itself. values of 2^32 and above land in the last bucket
+    const uint32_t HistogramSubBucketBits = 4;
+    const uint32_t HistogramSubBuckets = 1 << RUDP::HistogramSubBucketBits;
+    const uint32_t HistogramNumBuckets = (32 - RUDP::HistogramSubBucketBits + 1) * RUDP::HistogramSubBuckets;
+    
+    enum LatencyHistogram : uint8_t
+    {
+        LatencyHistogram_EnqueueToAck = 0,     // enqueueMessage until the last fragment's ack, reliable messages only
+        LatencyHistogram_ArrivalToDelivery,    // first fragment received until the message is handed out by receiveMessage
+        LatencyHistogram_Reassembly,           // first fragment received until the message is complete
+        LatencyHistogram_RoundTrip,            // send until ack of packets that were only sent once
+        LatencyHistogram_Count
+    };
+    
+    inline const char *LatencyHistogram_ToString(LatencyHistogram histogram)
+    {
+        switch(histogram)
+        {
+                RUDP_STRINGIFY_CASE(LatencyHistogram_EnqueueToAck);
+                RUDP_STRINGIFY_CASE(LatencyHistogram_ArrivalToDelivery);
+                RUDP_STRINGIFY_CASE(LatencyHistogram_Reassembly);
+                RUDP_STRINGIFY_CASE(LatencyHistogram_RoundTrip);
+                RUDP_STRINGIFY_CASE(LatencyHistogram_Count);
+        }
+        
+        return "UNKNOWN";
+    }
+    
+    inline uint32_t Histogram_BucketOf(uint64_t value)
+    {
+        uint32_t clamped = value > UINT32_MAX ? UINT32_MAX : (uint32_t)value;
+        if (clamped < RUDP::HistogramSubBuckets)
+        {
+            return clamped;
+        }
+        
+        uint32_t shift = RUDP::highestBit32(clamped) - RUDP::HistogramSubBucketBits;
+        return (shift + 1) * RUDP::HistogramSubBuckets + ((clamped >> shift) & (RUDP::HistogramSubBuckets - 1));
+    }
+    
+    // a plain copy of one or more histograms, merged with add
+    struct HistogramSnapshot
+    {
+        uint64_t m_counts[RUDP::HistogramNumBuckets];
+        
+        HistogramSnapshot()
+        {
+            clear();
+        }
+        
+        void clear();
+        void add(const RUDP::HistogramSnapshot &other);
+        
+        uint64_t getCount() const;
+        uint64_t getMax() const;
+        
+        // highest value that falls into the same bucket as the percentile's sample, 0 when empty.
+        // percentile is 0-100, so p999 is 99.9
+        uint64_t getPercentile(double percentile) const;
+    };
+    
+    // written by one thread with plain loads and stores, read by any thread at any time. a reader may see
+    // a sample in one bucket before another sample recorded earlier, never a torn count
+    class Histogram
+    {
+    private:
+        std::atomic<uint64_t> m_counts[RUDP::HistogramNumBuckets];
+        
+        Histogram(const Histogram &other);
+        Histogram &operator=(const Histogram &other);
+        
+    public:
+        Histogram();
+        
+        // writer only
+        inline void record(uint64_t value)
+        {
+            std::atomic<uint64_t> &count = m_counts[RUDP::Histogram_BucketOf(value)];
+            count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+        
+        // any thread, adds the histogram's counts to the snapshot
+        void read(RUDP::HistogramSnapshot *snapshot);
+    };
+}
+
+#endif
\ No newline at end of file
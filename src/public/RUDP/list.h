@@ -16,13 +16,21 @@
 
 namespace RUDP
 {
+    // a run of nodes taken out of a list, two pointers that can be handed to another thread
+    template <typename Type>
+    struct Chain
+    {
+        RUDP::Node<Type> *m_head;
+        RUDP::Node<Type> *m_end;
+    };
+    
     template <typename Type>
     class List
     {
     private:
         RUDP::Node<Type> *m_head;
         RUDP::Node<Type> *m_end;
-        
+    
     public:
         List() : m_head(NULL), m_end(NULL) {}
         
@@ -75,6 +83,24 @@ namespace RUDP
             other->m_end = NULL;
         }
         
+        // empties the list without freeing its nodes
+        RUDP::Chain<Type> detach()
+        {
+            RUDP::Chain<Type> chain = { m_head, m_end };
+            m_head = NULL;
+            m_end = NULL;
+            return chain;
+        }
+        
+        // appends a chain from detach, the list takes ownership of its nodes
+        void attach(RUDP::Chain<Type> chain)
+        {
+            RUDP::List<Type> other;
+            other.m_head = chain.m_head;
+            other.m_end = chain.m_end;
+            inheritFrom(&other);
+        }
+        
         Type *peek()
         {
             if (m_head)
@@ -147,6 +173,42 @@ namespace RUDP
             return false;
         }
         
+        // moves the head node onto the end of another list without copying its object
+        bool popTo(RUDP::List<Type> *other)
+        {
+            if (!m_head)
+            {
+                return false;
+            }
+            
+            RUDP::Node<Type> *node = m_head;
+            m_head = node->m_next;
+            
+            if (m_head)
+            {
+                m_head->m_prev = NULL;
+            }
+            else
+            {
+                m_end = NULL;
+            }
+            
+            node->m_next = NULL;
+            node->m_prev = other->m_end;
+            
+            if (other->m_end)
+            {
+                other->m_end->m_next = node;
+            }
+            else
+            {
+                other->m_head = node;
+            }
+            
+            other->m_end = node;
+            return true;
+        }
+        
         void remove(Type* obj)
         {
             if (RUDP::NodeStore<Type>::isValid(obj))
@@ -214,6 +276,10 @@ namespace RUDP
             {
                 RUDP::Node<Type> *afterNode = (RUDP::Node<Type>*)after;
                 RUDP::Node<Type> *objNode = RUDP::NodeStore<Type>::secure();
+                if (!objNode)
+                {
+                    return NULL;
+                }
                 
                 if (obj)
                 {
@@ -246,6 +312,10 @@ namespace RUDP
             {
                 RUDP::Node<Type> *beforeNode = (RUDP::Node<Type>*)before;
                 RUDP::Node<Type> *objNode = RUDP::NodeStore<Type>::secure();
+                if (!objNode)
+                {
+                    return NULL;
+                }
                 
                 if (obj)
                 {
@@ -271,6 +341,84 @@ namespace RUDP
             
             return NULL;
         }
+        
+        // links obj, a node taken with NodeStore::secure that is in no list, after after or at the front
+        // when after is NULL. unlike the push functions nothing is copied
+        Type *adoptAfter(Type *after, Type *obj)
+        {
+            RUDP::Node<Type> *afterNode = (RUDP::Node<Type>*)after;
+            RUDP::Node<Type> *objNode = (RUDP::Node<Type>*)obj;
+            
+            objNode->m_prev = afterNode;
+            objNode->m_next = afterNode ? afterNode->m_next : m_head;
+            
+            if (objNode->m_next)
+            {
+                objNode->m_next->m_prev = objNode;
+            }
+            else
+            {
+                m_end = objNode;
+            }
+            
+            if (afterNode)
+            {
+                afterNode->m_next = objNode;
+            }
+            else
+            {
+                m_head = objNode;
+            }
+            
+            return obj;
+        }
+        
+        // relinks obj in front of before, both already in this list
+        void moveBefore(Type *before, Type *obj)
+        {
+            RUDP::Node<Type> *beforeNode = (RUDP::Node<Type>*)before;
+            RUDP::Node<Type> *objNode = (RUDP::Node<Type>*)obj;
+            
+            if (beforeNode == objNode || beforeNode->m_prev == objNode)
+            {
+                return;
+            }
+            
+            if (objNode->m_prev)
+            {
+                objNode->m_prev->m_next = objNode->m_next;
+            }
+            
+            if (objNode->m_next)
+            {
+                objNode->m_next->m_prev = objNode->m_prev;
+            }
+            
+            if (objNode == m_head)
+            {
+                m_head = objNode->m_next;
+            }
+            
+            if (objNode == m_end)
+            {
+                m_end = objNode->m_prev;
+            }
+            
+            objNode->m_prev = beforeNode->m_prev;
+            objNode->m_next = beforeNode;
+            
+            if (beforeNode->m_prev)
+            {
+                beforeNode->m_prev->m_next = objNode;
+            }
+            
+            if (beforeNode == m_head)
+            {
+                m_head = objNode;
+            }
+            
+            beforeNode->m_prev = objNode;
+        }
     };
 }
 
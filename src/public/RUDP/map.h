@@ -10,133 +10,335 @@
 #define RUDP_map_h
 
 #include <RUDP/util.h>
-#include <RUDP/nodestore.h>
 #include <stdint.h>
 #include <vector>
+#include <utility>
 
 namespace RUDP
 {
+    // values are boxed so pointers to them stay valid across resizes
     template <typename Type>
-    struct MapEntry
+    struct MapValue
     {
-        Type m_obj;
-        MapEntry *m_next;
-        uint32_t m_hash;
+        Type *m_obj;
+        
+        MapValue() : m_obj(NULL) {}
+        
+        template <typename... Args>
+        void create(Args&&... args)
+        {
+            m_obj = new Type(std::forward<Args>(args)...);
+        }
+        
+        void destroy()
+        {
+            delete m_obj;
+            m_obj = NULL;
+        }
         
-        MapEntry() : m_next(NULL), m_hash(0) {}
+        Type *get()
+        {
+            return m_obj;
+        }
     };
     
+    // pointers are kept in the slot itself, indexes into other containers don't allocate per entry
     template <typename Type>
-    class Map
+    struct MapValue<Type*>
     {
-    private:
-        std::vector<MapEntry<Type>*> m_buckets;
-        uint32_t m_numEntries;
+        Type *m_obj;
         
-    public:
-        Map(uint32_t numEntries) : m_numEntries(0)
+        MapValue() : m_obj(NULL) {}
+        
+        void create(Type *obj)
         {
-            m_buckets.resize(numEntries);
+            m_obj = obj;
         }
         
-        ~Map()
+        void destroy()
+        {
+            m_obj = NULL;
+        }
+        
+        Type **get()
+        {
+            return &m_obj;
+        }
+    };
+    
+    template <typename Key, typename Type>
+    struct MapSlot
+    {
+        Key m_key;
+        uint32_t m_hash;
+        uint32_t m_distance; // probe distance + 1, 0 when the slot is empty
+        RUDP::MapValue<Type> m_value;
+        
+        MapSlot() : m_hash(0), m_distance(0) {}
+    };
+    
+    // open addressing robin hood map, keys live inline in the slots. values are stored out of line
+    // so pointers stay valid across resizes, except pointer values: what find returns for those
+    // is only valid until the map changes
+    template <typename Key, typename Type>
+    class Map
+    {
+    private:
+        struct Table
         {
-            for (size_t i = 0; i < m_buckets.size(); i++)
+            std::vector<RUDP::MapSlot<Key, Type>> m_slots;
+            uint32_t m_mask;
+            uint32_t m_numEntries;
+            
+            Table() : m_mask(0), m_numEntries(0) {}
+            
+            void allocate(uint32_t capacity)
+            {
+                m_slots.assign(capacity, RUDP::MapSlot<Key, Type>());
+                m_mask = capacity - 1;
+                m_numEntries = 0;
+            }
+            
+            void release()
+            {
+                std::vector<RUDP::MapSlot<Key, Type>>().swap(m_slots);
+                m_mask = 0;
+                m_numEntries = 0;
+            }
+            
+            bool isAllocated()
             {
-                RUDP::MapEntry<Type> **bucket = &m_buckets[i];
-                while (*bucket)
+                return !m_slots.empty();
+            }
+            
+            int64_t find(uint32_t hash, const Key *key)
+            {
+                if (m_numEntries == 0)
                 {
-                    RUDP::MapEntry<Type> *node = *bucket;
-                    *bucket = node->m_next;
-                    RUDP::NodeStore<RUDP::MapEntry<Type>>::free(node);
+                    return -1;
+                }
+                
+                uint32_t index = hash & m_mask;
+                
+                for (uint32_t distance = 1; ; distance++)
+                {
+                    RUDP::MapSlot<Key, Type> *slot = &m_slots[index];
+                    
+                    // robin hood invariant, anything further away would have displaced this slot
+                    if (slot->m_distance < distance)
+                    {
+                        return -1;
+                    }
+                    
+                    if (slot->m_hash == hash && slot->m_key.equals(key))
+                    {
+                        return index;
+                    }
+                    
+                    index = (index + 1) & m_mask;
                 }
             }
-        }
-        
-        bool remove(Type *key)
-        {
-            if (m_buckets.size() > 0)
+            
+            // the index the new entry landed at
+            uint32_t insert(uint32_t hash, const Key &key, const RUDP::MapValue<Type> &value)
             {
-                uint32_t hash = key->hash();
-                int index = hash % m_buckets.size();
+                RUDP::MapSlot<Key, Type> toInsert;
+                toInsert.m_key = key;
+                toInsert.m_value = value;
+                toInsert.m_hash = hash;
+                toInsert.m_distance = 1;
                 
-                RUDP::MapEntry<Type> *prev = NULL;
-                for (RUDP::MapEntry<Type> *entry = m_buckets[index]; entry != NULL; entry = entry->m_next)
+                uint32_t index = hash & m_mask;
+                uint32_t inserted = UINT32_MAX;
+                
+                while (true)
                 {
-                    if (entry->m_hash == hash && entry->m_obj.equals(key))
+                    RUDP::MapSlot<Key, Type> *slot = &m_slots[index];
+                    
+                    if (slot->m_distance == 0)
+                    {
+                        *slot = toInsert;
+                        m_numEntries++;
+                        return inserted == UINT32_MAX ? index : inserted;
+                    }
+                    
+                    if (slot->m_distance < toInsert.m_distance)
                     {
-                        if (prev == NULL)
-                        {
-                            m_buckets[index] = entry->m_next;
-                        }
-                        else
-                        {
-                            prev->m_next = entry->m_next;
-                        }
-                        
-                        RUDP::NodeStore<RUDP::MapEntry<Type>>::free(entry);
-                        m_numEntries--;
-                        return true;
+                        RUDP::MapSlot<Key, Type> displaced = *slot;
+                        *slot = toInsert;
+                        toInsert = displaced;
+                        inserted = inserted == UINT32_MAX ? index : inserted;
                     }
                     
-                    prev = entry;
+                    index = (index + 1) & m_mask;
+                    toInsert.m_distance++;
                 }
             }
             
-            return false;
+            void erase(uint32_t index)
+            {
+                // backward shift deletion, no tombstones
+                uint32_t next = (index + 1) & m_mask;
+                
+                while (m_slots[next].m_distance > 1)
+                {
+                    m_slots[index] = m_slots[next];
+                    m_slots[index].m_distance--;
+                    index = next;
+                    next = (next + 1) & m_mask;
+                }
+                
+                m_slots[index] = RUDP::MapSlot<Key, Type>();
+                m_numEntries--;
+            }
+        };
+        
+        // while resizing entries are moved from m_old to m_table a few at a time
+        Table m_table;
+        Table m_old;
+        uint32_t m_migrateIndex;
+        
+        Map(const Map &other);
+        Map &operator=(const Map &other);
+        
+        static const uint32_t MigrateStepsPerOperation = 8;
+        
+        static uint32_t fold(uint64_t hash)
+        {
+            return (uint32_t)(hash ^ (hash >> 32));
         }
         
-        Type *insert(Type *value)
+        static uint32_t capacityFor(uint32_t numEntries)
         {
-            if (m_numEntries >= m_buckets.size())
+            uint32_t capacity = 16;
+            while (capacity / 8 * 7 < numEntries)
             {
-                return NULL;
+                capacity <<= 1;
             }
             
-            // hashmap insert
-            RUDP::MapEntry<Type> *entry = (RUDP::MapEntry<Type>*)RUDP::NodeStore<RUDP::MapEntry<Type>>::secure();
-            if (!entry)
+            return capacity;
+        }
+        
+        void migrate(uint32_t steps)
+        {
+            while (m_old.m_numEntries > 0 && steps > 0)
             {
-                return NULL;
+                RUDP::MapSlot<Key, Type> *slot = &m_old.m_slots[m_migrateIndex];
+                
+                if (slot->m_distance == 0)
+                {
+                    m_migrateIndex = (m_migrateIndex + 1) & m_old.m_mask;
+                    continue;
+                }
+                
+                // erasing shifts the following entry into this index, so don't advance
+                m_table.insert(slot->m_hash, slot->m_key, slot->m_value);
+                m_old.erase(m_migrateIndex);
+                steps--;
             }
             
-            m_numEntries++;
+            if (m_old.isAllocated() && m_old.m_numEntries == 0)
+            {
+                m_old.release();
+            }
+        }
+        
+        void grow()
+        {
+            // finish any pending migration before starting the next one
+            migrate(UINT32_MAX);
             
-            entry->m_next = NULL;
-            entry->m_obj = *value;
-            entry->m_hash = value->hash();
+            uint32_t capacity = (uint32_t)m_table.m_slots.size() * 2;
+            m_old.m_slots.swap(m_table.m_slots);
+            m_old.m_mask = m_table.m_mask;
+            m_old.m_numEntries = m_table.m_numEntries;
+            m_table.allocate(capacity);
+            m_migrateIndex = 0;
+        }
+        
+    public:
+        Map(uint32_t numEntries) : m_migrateIndex(0)
+        {
+            m_table.allocate(capacityFor(numEntries));
+        }
+        
+        ~Map()
+        {
+            for (size_t i = 0; i < m_table.m_slots.size(); i++)
+            {
+                m_table.m_slots[i].m_value.destroy();
+            }
             
-            size_t index = entry->m_hash % m_buckets.size();
-            if (m_buckets[index] == NULL)
+            for (size_t i = 0; i < m_old.m_slots.size(); i++)
             {
-                m_buckets[index] = entry;
+                m_old.m_slots[i].m_value.destroy();
+            }
+        }
+        
+        uint32_t size()
+        {
+            return m_table.m_numEntries + m_old.m_numEntries;
+        }
+        
+        bool remove(const Key *key)
+        {
+            uint32_t hash = fold(key->hash());
+            bool isRemoved = false;
+            
+            int64_t index = m_table.find(hash, key);
+            if (index >= 0)
+            {
+                m_table.m_slots[(size_t)index].m_value.destroy();
+                m_table.erase((uint32_t)index);
+                isRemoved = true;
             }
             else
             {
-                for (RUDP::MapEntry<Type> *bucket = m_buckets[index]; bucket != NULL; bucket = bucket->m_next)
+                index = m_old.find(hash, key);
+                if (index >= 0)
                 {
-                    if (bucket->m_next == NULL)
-                    {
-                        bucket->m_next = entry;
-                        break;
-                    }
+                    m_old.m_slots[(size_t)index].m_value.destroy();
+                    m_old.erase((uint32_t)index);
+                    isRemoved = true;
                 }
             }
             
-            return &entry->m_obj;
+            migrate(MigrateStepsPerOperation);
+            return isRemoved;
+        }
+        
+        template <typename... Args>
+        Type *insert(const Key *key, Args&&... args)
+        {
+            if ((uint64_t)(m_table.m_numEntries + 1) * 8 > (uint64_t)m_table.m_slots.size() * 7)
+            {
+                grow();
+            }
+            
+            // migrated first, so nothing moves the new entry before it is returned
+            migrate(MigrateStepsPerOperation);
+            
+            RUDP::MapValue<Type> value;
+            value.create(std::forward<Args>(args)...);
+            
+            uint32_t index = m_table.insert(fold(key->hash()), *key, value);
+            return m_table.m_slots[index].m_value.get();
         }
         
-        Type *find(Type *key)
+        Type *find(const Key *key)
         {
-            uint32_t hash = key->hash();
-            int index = hash % m_buckets.size();
+            uint32_t hash = fold(key->hash());
             
-            for (RUDP::MapEntry<Type> *entry = m_buckets[index]; entry != NULL; entry = entry->m_next)
+            int64_t index = m_table.find(hash, key);
+            if (index >= 0)
             {
-                if (entry->m_hash == hash && entry->m_obj.equals(key))
-                {
-                    return &entry->m_obj;
-                }
+                return m_table.m_slots[(size_t)index].m_value.get();
+            }
+            
+            index = m_old.find(hash, key);
+            if (index >= 0)
+            {
+                return m_old.m_slots[(size_t)index].m_value.get();
             }
             
             return NULL;
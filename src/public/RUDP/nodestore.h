@@ -11,6 +11,8 @@
 
 #include <stdlib.h>
 #include <RUDP/util.h>
+#include <RUDP/platform.h>
+#include <atomic>
 
 namespace RUDP
 {
@@ -31,10 +33,57 @@ namespace RUDP
     private:
         static RUDP::Node<Type> *s_nodes;
         static RUDP::Node<Type> *s_nodeFreeList;
-        static size_t s_numUsed;
+        static std::atomic<size_t> s_numUsed; // read without the lock by the fast paths
         static size_t s_max;
         static std::mutex s_lock;
-        static bool s_initialized;
+        static std::atomic<bool> s_initialized;
+        
+        // free nodes kept by a thread that called attachCache, they go through the lock CacheBatch at a time
+        static RUDP_THREADLOCAL RUDP::Node<Type> *s_cache;
+        static RUDP_THREADLOCAL size_t s_numCached;
+        static RUDP_THREADLOCAL bool s_isCaching;
+        static const size_t CacheBatch = 64;
+        
+        static bool refillCache()
+        {
+            s_lock.lock();
+            
+            while (s_nodeFreeList && s_numCached < CacheBatch)
+            {
+                RUDP::Node<Type> *node = s_nodeFreeList;
+                s_nodeFreeList = node->m_next;
+                node->m_next = s_cache;
+                s_cache = node;
+                s_numCached++;
+            }
+            
+            s_lock.unlock();
+            return s_cache != NULL;
+        }
+        
+        static void flushCache(size_t num)
+        {
+            if (num == 0)
+            {
+                return;
+            }
+            
+            RUDP::Node<Type> *head = s_cache;
+            RUDP::Node<Type> *tail = head;
+            
+            for (size_t i = 1; i < num; i++)
+            {
+                tail = tail->m_next;
+            }
+            
+            s_cache = tail->m_next;
+            s_numCached -= num;
+            
+            s_lock.lock();
+            tail->m_next = s_nodeFreeList;
+            s_nodeFreeList = head;
+            s_lock.unlock();
+        }
         
     public:
         static bool isValid(void *obj)
@@ -47,9 +96,10 @@ namespace RUDP
             return s_numUsed < s_max;
         }
         
+        // 0 until the store is set up, s_max is only safe to read from other threads after that
         static size_t getNumTotal()
         {
-            return s_max;
+            return s_initialized ? s_max : 0;
         }
         
         static size_t getNumSecured()
@@ -107,6 +157,26 @@ namespace RUDP
         {
             if (isValid(node))
             {
+                // reset outside the lock, so anything the object holds is released now and
+                // secure() hands out a default object
+                node->m_obj = Type();
+                
+                if (s_isCaching)
+                {
+                    node->m_active = false;
+                    node->m_next = s_cache;
+                    s_cache = node;
+                    s_numCached++;
+                    s_numUsed--;
+                    
+                    if (s_numCached >= 2 * CacheBatch)
+                    {
+                        flushCache(CacheBatch);
+                    }
+                    
+                    return;
+                }
+                
                 s_lock.lock();
                 
                 node->m_active = false;
@@ -124,14 +194,37 @@ namespace RUDP
         {
             initialize(256);
             
+            if (s_isCaching)
+            {
+                if (!s_cache && !refillCache())
+                {
+                    return NULL;
+                }
+                
+                RUDP::Node<Type> *node = s_cache;
+                s_cache = node->m_next;
+                s_numCached--;
+                
+                node->m_next = NULL;
+                node->m_prev = NULL;
+                node->m_active = true;
+                s_numUsed++;
+                return node;
+            }
+            
             if (s_numUsed < s_max)
             {
                 s_lock.lock();
                 
                 RUDP::Node<Type> *node = s_nodeFreeList;
+                if (!node)
+                {
+                    s_lock.unlock();
+                    return NULL;
+                }
+                
                 s_nodeFreeList = node->m_next;
                 
-                node->m_obj = Type();
                 node->m_next = NULL;
                 node->m_prev = NULL;
                 node->m_active = true;
@@ -147,6 +240,20 @@ namespace RUDP
             return NULL;
         }
         
+        // lets the calling thread keep a few free nodes of its own, for worker threads that secure and free
+        // at a high rate. the thread has to call detachCache before it exits or the nodes it holds are lost
+        static void attachCache()
+        {
+            initialize(256);
+            s_isCaching = true;
+        }
+        
+        static void detachCache()
+        {
+            flushCache(s_numCached);
+            s_isCaching = false;
+        }
+        
         static void deinitialize()
         {
             delete[] s_nodes;
@@ -160,16 +267,25 @@ namespace RUDP
     RUDP::Node<Type> *RUDP::NodeStore<Type>::s_nodeFreeList = NULL;
     
     template <typename Type>
-    size_t RUDP::NodeStore<Type>::s_numUsed = 0;
+    std::atomic<size_t> RUDP::NodeStore<Type>::s_numUsed(0);
     
     template <typename Type>
     size_t RUDP::NodeStore<Type>::s_max = 0;
     
     template <typename Type>
-    bool RUDP::NodeStore<Type>::s_initialized = false;
+    std::atomic<bool> RUDP::NodeStore<Type>::s_initialized(false);
     
     template <typename Type>
     std::mutex RUDP::NodeStore<Type>::s_lock;
+    
+    template <typename Type>
+    RUDP_THREADLOCAL RUDP::Node<Type> *RUDP::NodeStore<Type>::s_cache = NULL;
+    
+    template <typename Type>
+    RUDP_THREADLOCAL size_t RUDP::NodeStore<Type>::s_numCached = 0;
+    
+    template <typename Type>
+    RUDP_THREADLOCAL bool RUDP::NodeStore<Type>::s_isCaching = false;
 }
 
 #endif
\ No newline at end of file
@@ -14,6 +14,8 @@
 #include <string.h>
 #include <RUDP/util.h>
 #include <RUDP/platform.h>
+#include <RUDP/address.h>
+#include <atomic>
 
 namespace RUDP
 {
@@ -22,15 +24,25 @@ namespace RUDP
     
     const size_t PacketSize = 512;
     const size_t MaxChannels = UINT8_MAX;
+    const uint16_t DefaultStreamWindow = 64; // packets in flight per stream
+    
+    // ids are compared wrap-around aware, so a message has to span less than half the id space
+    const uint16_t MaxFragments = INT16_MAX;
+    
+    // reassembly bits kept in the MessageStart itself, larger messages take a pooled RUDP::FragmentBitmap
+    const uint16_t InlineFragments = 256;
     
     enum PacketFlag : uint8_t
     {
         PacketFlag_None            = 0,
         PacketFlag_ConfirmDelivery = 1,
+        PacketFlag_Sequenced       = 1 << 1, // latest only, see EnqueueMessageOption_Sequenced
         PacketFlag_IsAck           = 1 << 2,
         PacketFlag_InOrder         = 1 << 3,
         PacketFlag_EndOfMessage    = 1 << 4,
-        PacketFlag_StartOfMessage  = 1 << 5
+        PacketFlag_StartOfMessage  = 1 << 5,
+        PacketFlag_Skip            = 1 << 6, // the sender gave up on the message, see Channel::skipMessage
+        PacketFlag_Stream          = 1 << 7  // part of a channel's byte stream, see Peer::writeStream
     };
     
     inline const char *PacketFlag_ToString(PacketFlag flag)
@@ -43,11 +55,20 @@ namespace RUDP
                 RUDP_STRINGIFY_CASE(PacketFlag_EndOfMessage);
                 RUDP_STRINGIFY_CASE(PacketFlag_StartOfMessage);
                 RUDP_STRINGIFY_CASE(PacketFlag_InOrder);
+                RUDP_STRINGIFY_CASE(PacketFlag_Skip);
+                RUDP_STRINGIFY_CASE(PacketFlag_Sequenced);
+                RUDP_STRINGIFY_CASE(PacketFlag_Stream);
         }
         
         return "UNKNOWN";
     }
     
+    // wrap-around aware ordering of packet ids
+    inline bool PacketId_IsAfter(RUDP::PacketId a, RUDP::PacketId b)
+    {
+        return (int16_t)(a - b) > 0;
+    }
+    
     inline void operator |=(PacketFlag &a, const PacketFlag &b)
     {
         a = (PacketFlag)(((uint8_t)a) | ((uint8_t)b));
@@ -69,24 +90,95 @@ namespace RUDP
                           RUDP::PacketId m_packetId;
                           RUDP::ChannelId m_channelId;
                           RUDP::PacketFlag m_flags;
+                          RUDP::PacketId m_messageId; // packet id of the message's first fragment
+                          uint16_t m_numFragments;
+                          RUDP::PacketId m_settledBefore; // every reliable message of the channel before it was acknowledged or skipped
                       });
     
+    struct MessageSpan
+    {
+        const char *m_data;
+        size_t m_dataLen;
+    };
+    
+    // reference counted message body that can be enqueued to many peers, packets point
+    // into it instead of copying their fragment
+    class SharedPayload
+    {
+    private:
+        std::atomic<uint32_t> m_refCount;
+        char *m_data;
+        size_t m_dataLen;
+        
+        SharedPayload(size_t dataLen);
+        ~SharedPayload();
+        SharedPayload(const SharedPayload &other);
+        SharedPayload &operator=(const SharedPayload &other);
+    
+    public:
+        static RUDP::SharedPayload *create(const char *data, size_t dataLen);
+        static RUDP::SharedPayload *create(const RUDP::MessageSpan *spans, size_t numSpans);
+        
+        void acquire();
+        void release();
+        
+        const char *getData();
+        size_t getDataLen();
+    };
+    
+    struct Channel;
+    
     class Packet
     {
     private:
         char m_buffer[RUDP::PacketSize];
         sockaddr_storage m_targetAddr;
+        RUDP::PeerKey m_peerKey;
         uint64_t m_timestamp;
+        uint64_t m_deadline;
+        RUDP::SharedPayload *m_payload;
+        const char *m_payloadData;
+        RUDP::Channel *m_channel;
         uint16_t m_readPosition;
         uint16_t m_writePosition;
-        
+        uint16_t m_sendWeight;
+        uint8_t m_sendClass;
+        bool m_isResent;
+    
     public:
-        Packet() : m_readPosition(0), m_writePosition(0), m_timestamp(0)
+        Packet() : m_timestamp(0), m_deadline(0), m_payload(NULL), m_payloadData(NULL), m_channel(NULL), m_readPosition(0), m_writePosition(0), m_sendWeight(1), m_sendClass(0), m_isResent(false)
         {
             memset(&m_targetAddr, 0, sizeof(m_targetAddr));
         }
         
-        void setTimestamp(uint64_t ms);
+        Packet(const Packet &other);
+        Packet &operator=(const Packet &other);
+        ~Packet();
+        
+        // user data is the given fragment of a shared payload rather than the packet's own buffer
+        void setPayload(RUDP::SharedPayload *payload, size_t offset, uint16_t len);
+        RUDP::SharedPayload *getPayload();
+        
+        // local scheduling hints for the socket's send scheduler, never sent
+        void setSendPriority(uint8_t priorityClass, uint16_t weight);
+        uint8_t getSendClass();
+        uint16_t getSendWeight();
+        
+        // local, the channel the socket charges the packet's counters and round trip samples to. NULL for acks
+        void setChannel(RUDP::Channel *channel);
+        RUDP::Channel *getChannel();
+        
+        // local, set once a reliable packet was retransmitted, its ack then can't be timed
+        void setResent(bool isResent);
+        bool isResent();
+        
+        // local clock time in us after which the packet is dropped instead of sent, 0 never expires
+        void setDeadline(uint64_t us);
+        uint64_t getDeadline();
+        bool isExpired(uint64_t now);
+        
+        // local clock time in us of the last send, or of the update pass that received the packet
+        void setTimestamp(uint64_t us);
         uint64_t getTimestamp();
         
         void setHeader(RUDP::PacketHeader *header);
@@ -94,6 +186,7 @@ namespace RUDP
         
         void setTargetAddr(sockaddr_storage *addr);
         sockaddr_storage * getTargetAddr();
+        RUDP::PeerKey *getPeerKey();
         
         uint16_t read(RUDP::Packet *buffer, size_t len);
         uint16_t write(RUDP::Packet *buffer, size_t len);
@@ -146,14 +239,72 @@ namespace RUDP
         bool setReadPosition(uint16_t len);
     };
     
+    struct FragmentBitmap
+    {
+        uint64_t m_bits[(RUDP::MaxFragments + 64) / 64];
+    };
+    
+    // reassembly state of a single message, keyed by the id of its first fragment
     struct MessageStart
     {
         RUDP::Packet *m_first;
         RUDP::Packet *m_last;
+        uint64_t m_received[RUDP::InlineFragments / 64];
+        RUDP::FragmentBitmap *m_overflow; // replaces m_received above InlineFragments fragments
+        size_t m_size;
+        uint64_t m_arrivalTime; // us, update pass that received the first fragment
+        RUDP::PacketId m_messageId;
+        uint16_t m_numFragments;
+        uint16_t m_numReceived;
+        RUDP::PacketFlag m_flags; // of the first fragment received
         bool m_isAvailable;
+        bool m_isDelivered;
+        bool m_isHeld; // handed out through a MessageView and not yet released
+        
+        MessageStart() :
+        m_first(NULL),
+        m_last(NULL),
+        m_overflow(NULL),
+        m_size(0),
+        m_arrivalTime(0),
+        m_messageId(0),
+        m_numFragments(0),
+        m_numReceived(0),
+        m_flags(RUDP::PacketFlag_None),
+        m_isAvailable(false),
+        m_isDelivered(false),
+        m_isHeld(false)
+        {
+            memset(m_received, 0, sizeof(m_received));
+        }
+        
+        bool isComplete()
+        {
+            return m_numFragments > 0 && m_numReceived == m_numFragments;
+        }
+        
+        // missing fragments of reliable messages are retransmitted or skipped, so they're waited for
+        bool isReliable()
+        {
+            return RUDP_BIT_HAS(m_flags, RUDP::PacketFlag_ConfirmDelivery);
+        }
+        
+        // false when a large message finds the overflow pool empty
+        bool initFragments(uint16_t numFragments);
+        void releaseFragments();
         
-        MessageStart() : m_first(NULL), m_last(NULL), m_isAvailable(false) {}
+        bool hasFragment(uint16_t index)
+        {
+            uint64_t *bits = m_overflow ? m_overflow->m_bits : m_received;
+            return RUDP_BIT_HAS(bits[index / 64], 1ULL << (index % 64));
+        }
+        
+        void setFragment(uint16_t index)
+        {
+            uint64_t *bits = m_overflow ? m_overflow->m_bits : m_received;
+            RUDP_BIT_SET(bits[index / 64], 1ULL << (index % 64));
+        }
     };
 }
 
-#endif
+#endif
\ No newline at end of file
@@ -15,8 +15,10 @@
 #include <RUDP/packet.h>
 #include <RUDP/map.h>
 #include <RUDP/channel.h>
+#include <RUDP/queue.h>
 #include <vector>
 #include <atomic>
+#include <mutex>
 
 namespace RUDP
 {
@@ -24,13 +26,27 @@ namespace RUDP
     {
         EnqueueMessageOption_None = 0,
         EnqueueMessageOption_ConfirmDelivery = 1,
-        EnqueueMessageOption_InOrder = 1 << 2
+        EnqueueMessageOption_InOrder = 1 << 2,
+        
+        // unreliable and latest only: the receiver drops anything older than the newest complete message
+        // on the channel, and a newer message replaces older ones that haven't been sent yet.
+        // overrides ConfirmDelivery and InOrder
+        EnqueueMessageOption_Sequenced = 1 << 3
     };
     
     enum EnqueueMessageResult
     {
         EnqueueMessageResult_Success = 1,
-        EnqueueMessageResult_OutQueueFull = 0
+        EnqueueMessageResult_OutQueueFull = 0,
+        EnqueueMessageResult_MessageTooLarge = 2,
+        EnqueueMessageResult_Expired = 3 // only reported for reliable messages once the receiver confirmed the skip
+    };
+    
+    enum DeliveryPolicy : uint8_t
+    {
+        DeliveryPolicy_RoundRobin = 0,   // ready channels take turns, one message each
+        DeliveryPolicy_Priority = 1,     // lower channel ids are always delivered first
+        DeliveryPolicy_WeightedFair = 2  // deficit round robin over message bytes, see Peer::setChannelWeight
     };
     
     class Peer;
@@ -39,34 +55,117 @@ namespace RUDP
     {
         char *m_data;
         size_t m_dataLen;
+        const RUDP::MessageSpan *m_spans;
+        size_t m_numSpans;
+        RUDP::SharedPayload *m_payload;
         RUDP::Peer *m_peer;
         RUDP::ChannelId m_channel;
+        void *m_userData; // handed to the socket's acknowledged callback for reliable messages
+        uint32_t m_timeToLive; // ms after enqueueMessage before unsent fragments are dropped, 0 never expires
         
         void prepareForSending(char *dataToSend, size_t dataLen, RUDP::Peer *target, RUDP::ChannelId channel);
+        void prepareForSending(const RUDP::MessageSpan *spans, size_t numSpans, RUDP::Peer *target, RUDP::ChannelId channel);
+        void prepareForSending(RUDP::SharedPayload *payload, RUDP::Peer *target, RUDP::ChannelId channel);
         void prepareForReceiving(char *messageBuffer, size_t bufferLen);
     };
     
+    class Shard;
+    
+    // read-only view of a received message, its fragments stay in the channel's packet queue
+    // until release() is called
+    class MessageView
+    {
+        friend class Peer;
+        friend class Shard;
+        
+    private:
+        RUDP::Peer *m_peer;
+        RUDP::Channel *m_channel;
+        RUDP::MessageStart *m_message;
+        
+        void remove();
+        
+    public:
+        MessageView() : m_peer(NULL), m_channel(NULL), m_message(NULL) {}
+        
+        bool isValid();
+        RUDP::Peer *getPeer();
+        RUDP::ChannelId getChannel();
+        size_t getSize();
+        
+        uint16_t getNumSpans();
+        size_t getSpans(RUDP::MessageSpan *spans, size_t maxSpans);
+        const char *getContiguous();
+        size_t copyTo(char *buffer, size_t bufferLen);
+        
+        void release();
+    };
+    
+    // channels ordered by id and indexed by the number of bits set below that id in m_mask
+    struct ChannelDirectory
+    {
+        uint64_t m_mask[4];
+        std::vector<RUDP::Channel*> m_channels;
+        
+        ChannelDirectory()
+        {
+            memset(m_mask, 0, sizeof(m_mask));
+        }
+        
+        uint32_t indexOf(RUDP::ChannelId channel);
+        RUDP::Channel *find(RUDP::ChannelId channel);
+        void insert(RUDP::Channel *channel);
+    };
+    
     class Socket;
     
     class Peer
     {
+        friend class MessageView;
         friend class Socket;
+        friend class Shard;
         
     private:
         sockaddr_storage m_addr;
-        uint32_t m_hash;
-        std::vector<RUDP::Channel> m_inQueueChannels;
-        RUDP::List<RUDP::Channel*> m_inQueue;
-        RUDP::List<RUDP::Packet> m_outQueue;
-        RUDP::List<RUDP::Packet> m_ackQueue;
+        RUDP::PeerKey m_key;
+        
+        // channels are created on first use. a new channel replaces the whole directory under m_channelLock,
+        // so sending threads look channels up without taking a lock
+        std::atomic<RUDP::ChannelDirectory*> m_directory;
+        std::vector<RUDP::ChannelDirectory*> m_oldDirectories;
+        std::mutex m_channelLock;
+        
+        // channels with at least one message ready to be received
+        uint64_t m_readyMask[4];
+        RUDP::DeliveryPolicy m_deliveryPolicy;
+        RUDP::ChannelId m_deliveryCursor;
+        bool m_isReadyListed;
+        
+        RUDP::ChainStack<RUDP::Packet> m_outQueue; // whole messages staged by any number of sending threads
         
         RUDP::Socket *m_socket;
-        std::atomic<RUDP::PacketId> *m_ChannelPacketIds;
+        RUDP::Shard *m_shard; // set when a pipeline shard owns this peer's receive side
+        
+        Peer(const Peer &other);
+        Peer &operator=(const Peer &other);
+        
+        RUDP::Channel *getChannel(RUDP::ChannelId channel, bool create);
+        RUDP::Channel *selectReadyChannel();
+        void updateReady(RUDP::Channel *channel);
+        bool hasReadyChannels();
         
         bool sendPacket(RUDP::Packet *toWrite);
         RUDP::PacketId reservePacketsOnChannel(RUDP::ChannelId channel, RUDP::PacketId numNeeded);
         
-        bool enqueueIncomingPacket(RUDP::Packet *pck);
+        // with isAdopted pck is a pool node of its own that is linked into the channel instead of copied,
+        // the channel owns it when the result is ReceiveResult_Kept
+        RUDP::ReceiveResult enqueueIncomingPacket(RUDP::Packet *pck, bool isAdopted);
+        void receiveAcknowledgement(RUDP::Packet *ack);
+        RUDP::ReceiveResult receiveSkip(RUDP::Packet *skip);
+        void receiveStream(RUDP::Packet *pck);
+        void acknowledgeStream(RUDP::List<RUDP::Packet> *consumed);
+        void acknowledgePacket(RUDP::Packet *pck, RUDP::List<RUDP::Packet> *acks);
+        void holdMessage(RUDP::Channel *channel, RUDP::MessageView *view);
         
     public:
         Peer();
@@ -74,16 +173,40 @@ namespace RUDP
         ~Peer();
         
         sockaddr_storage *getAddress();
+        RUDP::PeerKey *getKey();
+        size_t getNumChannels();
+        
+        // safe from any thread while the socket runs. the peer's counters are the sum of its channels',
+        // each channel's send and receive side are consistent on their own
+        void getCounters(RUDP::CounterSnapshot *snapshot);
+        bool getChannelCounters(RUDP::ChannelId channel, RUDP::CounterSnapshot *snapshot);
+        
+        // latency distributions in us, same rules as the counters. snapshots of several peers or
+        // channels can be merged with HistogramSnapshot::add
+        void getLatency(RUDP::LatencyHistogram histogram, RUDP::HistogramSnapshot *snapshot);
+        bool getChannelLatency(RUDP::ChannelId channel, RUDP::LatencyHistogram histogram, RUDP::HistogramSnapshot *snapshot);
+        
+        void setDeliveryPolicy(RUDP::DeliveryPolicy policy);
+        void setChannelWeight(RUDP::ChannelId channel, uint16_t weight);
+        void setChannelSendPriority(RUDP::ChannelId channel, RUDP::SendPriority priorityClass, uint16_t weight = 1);
         
-        void enqueueAcknowledgement(RUDP::Packet *ack);
+        // enqueueMessage and flushToSocket can be called from several threads at once, receiving and
+        // the stream calls below belong to one thread
         RUDP::EnqueueMessageResult enqueueMessage(RUDP::PeerMessage *message, RUDP::EnqueueMessageOption options);
         bool peekMessage(size_t &msgSize);
         bool receiveMessage(RUDP::PeerMessage *message);
+        bool receiveMessage(RUDP::MessageView *view);
+        bool receiveMessage(RUDP::ChannelId channel, RUDP::MessageView *view);
         
-        void flushToSocket();
+        // stream mode: the channel carries one reliable ordered byte stream instead of messages.
+        // writeStream accepts as much as the window allows and returns the number of bytes taken,
+        // readStream returns contiguous bytes as they arrive. a stream channel should not carry messages
+        size_t writeStream(RUDP::ChannelId channel, const char *data, size_t dataLen);
+        size_t readStream(RUDP::ChannelId channel, char *buffer, size_t bufferLen);
+        void setStreamWindow(RUDP::ChannelId channel, uint16_t numPackets);
         
-        uint32_t hash();
-        bool equals(Peer *peer);
+        // false when the socket's out queue is full, the packets stay queued here until the next flush
+        bool flushToSocket();
     };
 }
 
@@ -20,8 +20,11 @@ typedef char *sockdataptr_t;
 namespace RUDP
 {
     typedef ::SOCKET SocketHandle;
+    typedef ::HANDLE EventHandle;
 }
 
+#define RUDP_INVALIDEVENT NULL
+
 #define RUDP_CLOSESOCKET(x) ::closesocket(x)
 
 #define RUDP_STRERROR(err, buff, len) ::strerror_s(buff, len, err)
@@ -35,6 +38,7 @@ namespace RUDP
 #else
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <sys/time.h>
 #include <cmath>
@@ -45,6 +49,7 @@ typedef void *sockdataptr_t;
 namespace RUDP
 {
     typedef int SocketHandle;
+    typedef int EventHandle;
     
     inline uint64_t getUnixMS()
     {
@@ -56,6 +61,8 @@ namespace RUDP
     }
 }
 
+#define RUDP_INVALIDEVENT -1
+
 #define RUDP_CLOSESOCKET(x) ::close(x)
 
 #define RUDP_STRERROR(err, buff, len) ::strerror_r(err, buff, len)
@@ -0,0 +1,316 @@
+//
+//  queue.h
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+#ifndef RUDP_queue_h
+#define RUDP_queue_h
+
+#include <RUDP/util.h>
+#include <RUDP/list.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <atomic>
+
+namespace RUDP
+{
+    const size_t CacheLineSize = 64;
+    
+    // bounded ring for exactly one producer and one consumer thread. the indices sit on their own
+    // cache lines and each side keeps a private copy of the other's index so it only touches the
+    // shared line when the ring looks full or empty
+    template <typename Type>
+    class SpscQueue
+    {
+    private:
+        std::vector<Type> m_slots;
+        size_t m_mask;
+        char m_pad0[RUDP::CacheLineSize];
+        
+        std::atomic<size_t> m_head; // next slot to read, written by the consumer
+        size_t m_cachedTail;
+        char m_pad1[RUDP::CacheLineSize];
+        
+        std::atomic<size_t> m_tail; // next slot to write, written by the producer
+        size_t m_cachedHead;
+        char m_pad2[RUDP::CacheLineSize];
+        
+        SpscQueue(const SpscQueue &other);
+        SpscQueue &operator=(const SpscQueue &other);
+        
+    public:
+        // capacity is rounded up to a power of two
+        SpscQueue(size_t capacity) : m_mask(0), m_head(0), m_cachedTail(0), m_tail(0), m_cachedHead(0)
+        {
+            size_t size = 2;
+            while (size < capacity)
+            {
+                size <<= 1;
+            }
+            
+            m_slots.resize(size);
+            m_mask = size - 1;
+        }
+        
+        // producer only
+        bool push(const Type &obj)
+        {
+            size_t tail = m_tail.load(std::memory_order_relaxed);
+            
+            if (tail - m_cachedHead > m_mask)
+            {
+                m_cachedHead = m_head.load(std::memory_order_acquire);
+                if (tail - m_cachedHead > m_mask)
+                {
+                    return false;
+                }
+            }
+            
+            m_slots[tail & m_mask] = obj;
+            m_tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+        
+        // producer only
+        bool isFull()
+        {
+            size_t tail = m_tail.load(std::memory_order_relaxed);
+            
+            if (tail - m_cachedHead > m_mask)
+            {
+                m_cachedHead = m_head.load(std::memory_order_acquire);
+            }
+            
+            return tail - m_cachedHead > m_mask;
+        }
+        
+        // consumer only
+        Type *peek()
+        {
+            size_t head = m_head.load(std::memory_order_relaxed);
+            
+            if (head == m_cachedTail)
+            {
+                m_cachedTail = m_tail.load(std::memory_order_acquire);
+                if (head == m_cachedTail)
+                {
+                    return NULL;
+                }
+            }
+            
+            return &m_slots[head & m_mask];
+        }
+        
+        // consumer only, frees the slot returned by peek
+        void pop()
+        {
+            m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+        
+        bool pop(Type *obj)
+        {
+            Type *slot = peek();
+            if (!slot)
+            {
+                return false;
+            }
+            
+            *obj = *slot;
+            pop();
+            return true;
+        }
+        
+        size_t getCapacity()
+        {
+            return m_mask + 1;
+        }
+    };
+    
+    // bounded ring for any number of producer threads and one consumer thread. every slot carries a
+    // sequence number telling whose turn it is, so producers only contend on the tail index and a
+    // full ring fails the push instead of blocking
+    template <typename Type>
+    class MpscQueue
+    {
+    private:
+        struct Slot
+        {
+            std::atomic<size_t> m_sequence;
+            Type m_obj;
+        };
+        
+        Slot *m_slots;
+        size_t m_mask;
+        char m_pad0[RUDP::CacheLineSize];
+        
+        std::atomic<size_t> m_tail; // next slot to claim, shared by the producers
+        char m_pad1[RUDP::CacheLineSize];
+        
+        size_t m_head; // next slot to read, only touched by the consumer
+        char m_pad2[RUDP::CacheLineSize];
+        
+        MpscQueue(const MpscQueue &other);
+        MpscQueue &operator=(const MpscQueue &other);
+        
+    public:
+        // capacity is rounded up to a power of two
+        MpscQueue(size_t capacity) : m_slots(NULL), m_mask(0), m_tail(0), m_head(0)
+        {
+            size_t size = 2;
+            while (size < capacity)
+            {
+                size <<= 1;
+            }
+            
+            m_slots = new Slot[size];
+            m_mask = size - 1;
+            
+            for (size_t i = 0; i < size; i++)
+            {
+                m_slots[i].m_sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+        
+        ~MpscQueue()
+        {
+            delete[] m_slots;
+        }
+        
+        bool push(const Type &obj)
+        {
+            size_t tail = m_tail.load(std::memory_order_relaxed);
+            Slot *slot = NULL;
+            
+            for (;;)
+            {
+                slot = &m_slots[tail & m_mask];
+                intptr_t diff = (intptr_t)slot->m_sequence.load(std::memory_order_acquire) - (intptr_t)tail;
+                
+                if (diff == 0)
+                {
+                    if (m_tail.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    // the consumer hasn't freed this slot from the previous lap yet
+                    return false;
+                }
+                else
+                {
+                    tail = m_tail.load(std::memory_order_relaxed);
+                }
+            }
+            
+            slot->m_obj = obj;
+            slot->m_sequence.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+        
+        // consumer only
+        bool pop(Type *obj)
+        {
+            Slot *slot = &m_slots[m_head & m_mask];
+            if (slot->m_sequence.load(std::memory_order_acquire) != m_head + 1)
+            {
+                return false;
+            }
+            
+            *obj = slot->m_obj;
+            slot->m_sequence.store(m_head + m_mask + 1, std::memory_order_release);
+            m_head++;
+            return true;
+        }
+        
+        // consumer only
+        bool isEmpty()
+        {
+            return m_slots[m_head & m_mask].m_sequence.load(std::memory_order_acquire) != m_head + 1;
+        }
+        
+        size_t getCapacity()
+        {
+            return m_mask + 1;
+        }
+    };
+    
+    // unbounded lock-free stack of chains for any number of producer threads. a push publishes a whole
+    // chain with one compare and swap so its nodes stay together, popAll takes everything at once and
+    // hands it back in push order. the chains are linked through their head node's m_prev, which is
+    // free while they're staged
+    template <typename Type>
+    class ChainStack
+    {
+    private:
+        std::atomic<RUDP::Node<Type>*> m_top;
+        
+        ChainStack(const ChainStack &other);
+        ChainStack &operator=(const ChainStack &other);
+        
+    public:
+        ChainStack() : m_top(NULL) {}
+        
+        ~ChainStack()
+        {
+            RUDP::List<Type> unused;
+            popAll(&unused);
+        }
+        
+        void push(RUDP::Chain<Type> chain)
+        {
+            if (!chain.m_head)
+            {
+                return;
+            }
+            
+            RUDP::Node<Type> *top = m_top.load(std::memory_order_relaxed);
+            
+            do
+            {
+                chain.m_head->m_prev = top;
+            }
+            while (!m_top.compare_exchange_weak(top, chain.m_head, std::memory_order_release, std::memory_order_relaxed));
+        }
+        
+        // appends every staged node to list, safe to call from several threads
+        void popAll(RUDP::List<Type> *list)
+        {
+            RUDP::Node<Type> *top = m_top.exchange(NULL, std::memory_order_acquire);
+            RUDP::List<Type> ordered;
+            
+            // newest chain first, so each one goes in front of the ones collected so far
+            while (top)
+            {
+                RUDP::Node<Type> *older = top->m_prev;
+                RUDP::Chain<Type> chain = { top, top };
+                
+                top->m_prev = NULL;
+                while (chain.m_end->m_next)
+                {
+                    chain.m_end = chain.m_end->m_next;
+                }
+                
+                RUDP::List<Type> front;
+                front.attach(chain);
+                front.inheritFrom(&ordered);
+                ordered.inheritFrom(&front);
+                
+                top = older;
+            }
+            
+            list->inheritFrom(&ordered);
+        }
+        
+        bool isEmpty()
+        {
+            return m_top.load(std::memory_order_acquire) == NULL;
+        }
+    };
+}
+
+#endif
\ No newline at end of file
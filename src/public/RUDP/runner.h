@@ -0,0 +1,94 @@
+//
+//  runner.h
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+#ifndef RUDP_runner_h
+#define RUDP_runner_h
+
+#include <RUDP/socket.h>
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+
+namespace RUDP
+{
+    // what the I/O thread does when a pass found nothing to do
+    enum IdlePolicy : uint8_t
+    {
+        IdlePolicy_Spin = 0,  // goes straight into the next pass and never gives up its core
+        IdlePolicy_Yield = 1, // lets other threads on the core run first
+        IdlePolicy_Block = 2  // sleeps in Socket::wait until there's something to do
+    };
+    
+    struct RunnerOptions
+    {
+        uint64_t m_affinityMask;    // bit n allows cpu n, 0 leaves placement to the OS
+        RUDP::IdlePolicy m_idlePolicy;
+        uint32_t m_blockTimeoutMs;  // longest sleep with IdlePolicy_Block, bounds how late a retransmission goes out
+        uint32_t m_busyPollUs;      // SO_BUSY_POLL, 0 leaves busy polling off
+        uint32_t m_busyPollBudget;  // SO_BUSY_POLL_BUDGET, 0 keeps the kernel's default
+        bool m_preferBusyPoll;      // SO_PREFER_BUSY_POLL
+        int m_receiveBufferSize;    // SO_RCVBUF in bytes, 0 keeps the default
+        int m_sendBufferSize;       // SO_SNDBUF in bytes, 0 keeps the default
+        
+        RunnerOptions() :
+        m_affinityMask(0),
+        m_idlePolicy(RUDP::IdlePolicy_Block),
+        m_blockTimeoutMs(10),
+        m_busyPollUs(0),
+        m_busyPollBudget(0),
+        m_preferBusyPoll(false),
+        m_receiveBufferSize(0),
+        m_sendBufferSize(0)
+        {
+            
+        }
+    };
+    
+    struct RunnerStats
+    {
+        uint64_t m_numIterations;
+        uint64_t m_numIdle;         // passes that found nothing to do
+        uint64_t m_busyTimeUs;      // summed over the passes that did something
+        uint64_t m_idleTimeUs;      // summed over the idle passes, waiting included
+        uint64_t m_maxIterationUs;  // longest pass that did something
+    };
+    
+    // owns the thread driving a socket's update passes, in place of calling update in a loop
+    class Runner
+    {
+    private:
+        RUDP::Socket *m_socket;
+        RUDP::RunnerOptions m_options;
+        std::thread m_thread;
+        std::atomic<bool> m_isRunning;
+        
+        // only written by the runner's thread
+        std::atomic<uint64_t> m_numIterations;
+        std::atomic<uint64_t> m_numIdle;
+        std::atomic<uint64_t> m_busyTimeUs;
+        std::atomic<uint64_t> m_idleTimeUs;
+        std::atomic<uint64_t> m_maxIterationUs;
+        
+        Runner(const Runner &other);
+        Runner &operator=(const Runner &other);
+        
+        void run();
+        bool setAffinity(uint64_t mask);
+        
+    public:
+        Runner(RUDP::Socket *socket);
+        ~Runner();
+        
+        // false if a socket option or the affinity couldn't be applied, the thread is started regardless
+        bool start(const RUDP::RunnerOptions &options);
+        void stop();
+        
+        void getStats(RUDP::RunnerStats *stats);
+    };
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,97 @@
+//
+//  scheduler.h
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+#ifndef RUDP_scheduler_h
+#define RUDP_scheduler_h
+
+#include <RUDP/list.h>
+#include <RUDP/map.h>
+#include <RUDP/packet.h>
+#include <RUDP/address.h>
+
+namespace RUDP
+{
+    enum SendPriority : uint8_t
+    {
+        SendPriority_High = 0,
+        SendPriority_Normal = 1,
+        SendPriority_Low = 2,
+        SendPriority_Background = 3,
+        SendPriority_Count = 4
+    };
+    
+    // one send queue per peer and channel
+    struct FlowKey
+    {
+        RUDP::PeerKey m_peer;
+        RUDP::ChannelId m_channel;
+        
+        uint64_t hash() const
+        {
+            return RUDP::hashMix(m_peer.hash(), 0x9e3779b97f4a7c15ULL ^ m_channel);
+        }
+        
+        bool equals(const FlowKey *other) const
+        {
+            return m_channel == other->m_channel && m_peer.equals(&other->m_peer);
+        }
+    };
+    
+    // lives in the scheduler's map while it has packets queued, removed again once it drains
+    struct SendFlow
+    {
+        RUDP::FlowKey m_key;
+        RUDP::List<RUDP::Packet> m_queue;
+        RUDP::SendFlow *m_next;
+        size_t m_deficit;
+        uint16_t m_weight;
+        uint8_t m_class;
+        bool m_isActive;
+        bool m_hasQuantum;
+        
+        SendFlow() : m_next(NULL), m_deficit(0), m_weight(1), m_class(RUDP::SendPriority_Normal), m_isActive(false), m_hasQuantum(false) {}
+        
+    private:
+        SendFlow(const SendFlow &other);
+        SendFlow &operator=(const SendFlow &other);
+    };
+    
+    // picks the next outgoing packet, strict priority between classes and deficit round robin
+    // weighted per flow inside a class. only used by the socket's update thread
+    class SendScheduler
+    {
+    private:
+        RUDP::Map<RUDP::FlowKey, RUDP::SendFlow> m_flows;
+        RUDP::SendFlow *m_active[RUDP::SendPriority_Count];
+        RUDP::SendFlow *m_activeEnd[RUDP::SendPriority_Count];
+        RUDP::SendFlow *m_current;
+        size_t m_numQueued;
+        
+        SendScheduler(const SendScheduler &other);
+        SendScheduler &operator=(const SendScheduler &other);
+        
+        void activate(RUDP::SendFlow *flow);
+        void removeIfEmpty(RUDP::SendFlow *flow);
+        size_t replaceSequenced(RUDP::SendFlow *flow);
+        void rotate(uint8_t priorityClass);
+        
+    public:
+        SendScheduler();
+        
+        // returns the number of queued sequenced packets replaced by newer messages
+        size_t enqueue(RUDP::List<RUDP::Packet> *packets);
+        
+        // the packet stays queued until pop, pop can hand its node over to another list.
+        // packets past their deadline that reach the front of a flow are moved to expired instead
+        RUDP::Packet *peek(uint64_t now, RUDP::List<RUDP::Packet> *expired);
+        void pop(RUDP::List<RUDP::Packet> *keepIn = NULL);
+        
+        size_t getNumQueued();
+    };
+}
+
+#endif
\ No newline at end of file
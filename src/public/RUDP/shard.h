@@ -0,0 +1,79 @@
+//
+//  shard.h
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+#ifndef RUDP_shard_h
+#define RUDP_shard_h
+
+#include <RUDP/queue.h>
+#include <RUDP/map.h>
+#include <RUDP/packet.h>
+#include <RUDP/address.h>
+#include <RUDP/peer.h>
+#include <vector>
+#include <atomic>
+#include <thread>
+
+namespace RUDP
+{
+    const size_t ShardQueueSize = 1024;
+    
+    class Socket;
+    
+    // a message completed by a shard. the view points at the fragments in the shard's channel, releasing it
+    // hands it back to the shard, which has to happen on the thread that polled it
+    struct ShardMessage
+    {
+        RUDP::Peer *m_peer; // the socket's own peer for the sender, filled in by Socket::pollShardMessages
+        RUDP::PeerKey m_key;
+        sockaddr_storage m_addr;
+        RUDP::MessageView m_view;
+    };
+    
+    // worker thread owning the receive side of every peer that hashes to it. the socket's update thread
+    // is the only producer of m_inbound, the thread calling pollShardMessages the only consumer of m_delivered
+    // and the only producer of m_released
+    class Shard
+    {
+        friend class Peer;
+        friend class MessageView;
+        
+    private:
+        RUDP::Socket *m_socket;
+        RUDP::SpscQueue<RUDP::Packet*> m_inbound; // pool nodes, owned by the shard once they are in
+        RUDP::SpscQueue<RUDP::ShardMessage> m_delivered;
+        RUDP::SpscQueue<RUDP::MessageView> m_released;
+        RUDP::Map<RUDP::PeerKey, RUDP::Peer> m_peers;
+        std::vector<RUDP::Peer*> m_readyPeers; // peers with messages not yet handed to m_delivered
+        size_t m_numHeld; // views handed out and not back yet, kept below the size of m_released
+        std::atomic<bool> m_isRunning;
+        std::thread m_thread;
+        
+        Shard(const Shard &other);
+        Shard &operator=(const Shard &other);
+        
+        void run();
+        void process(RUDP::Packet *pck, RUDP::List<RUDP::Packet> *acks);
+        bool deliver(RUDP::Peer *peer);
+        size_t deliverReady();
+        size_t removeReleased();
+        void addReadyPeer(RUDP::Peer *peer);
+        void returnView(RUDP::MessageView *view);
+        
+    public:
+        Shard(RUDP::Socket *socket);
+        ~Shard();
+        
+        void start();
+        void stop();
+        
+        // false when the ring is full, the packet stays the caller's and is dropped, the sender retransmits it
+        bool enqueue(RUDP::Packet *pck);
+        bool dequeue(RUDP::ShardMessage *msg);
+    };
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,143 @@
+//
+//  simulation.h
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+#ifndef RUDP_simulation_h
+#define RUDP_simulation_h
+
+#include <RUDP/socket.h>
+#include <RUDP/emulator.h>
+#include <RUDP/map.h>
+#include <RUDP/util.h>
+#include <stdint.h>
+#include <vector>
+
+namespace RUDP
+{
+    class Simulation;
+    
+    // socket is the endpoint the callback belongs to, NULL for scheduled callbacks without one
+    typedef void (*SimulationCallback)(RUDP::Simulation *simulation, RUDP::Socket *socket, void *context);
+    
+    struct SimulationStats
+    {
+        uint64_t m_numEvents; // arrivals, timers and callbacks taken off the queue
+        uint64_t m_numSteps;  // Socket::step calls
+        uint64_t m_time;      // us of virtual time
+    };
+    
+    // discrete event simulation of sockets over an EmulatedNetwork, all in the calling thread. while it
+    // exists RUDP::Clock reads virtual time, which only moves once every endpoint is done with the
+    // current instant, and then straight to the next datagram arrival, retransmission, expiry or
+    // scheduled callback. idle stretches cost nothing, so an hour of traffic runs as fast as its
+    // packets can be processed. endpoints are only stepped when they have something to do.
+    // the same seed and the same calls repeat a run exactly. one simulation at a time, and no socket
+    // outside of it may be updated meanwhile
+    class Simulation
+    {
+    private:
+        struct Endpoint
+        {
+            // declared first so the socket is gone before its transport
+            RUDP::EmulatedTransport m_transport;
+            RUDP::Socket m_socket;
+            uint64_t m_timer;        // time of the timer entry in the queue, UINT64_MAX for none
+            uint64_t m_instant;      // the instant m_numPasses counts for
+            uint32_t m_numPasses;
+            bool m_isReady;
+            
+            Endpoint(RUDP::EmulatedNetwork *network, uint32_t ipv4, uint16_t port) :
+            m_transport(network, ipv4, port),
+            m_timer(UINT64_MAX),
+            m_instant(0),
+            m_numPasses(0),
+            m_isReady(false)
+            {
+            
+            }
+        };
+        
+        struct Entry
+        {
+            uint64_t m_time;
+            uint64_t m_order; // first scheduled goes first among entries with the same time
+            Endpoint *m_endpoint;
+            RUDP::SimulationCallback m_callback; // NULL to only step m_endpoint
+            void *m_context;
+            bool m_isTimer;
+        };
+        
+        struct LaterEntry
+        {
+            bool operator()(const Entry &a, const Entry &b) const
+            {
+                return a.m_time != b.m_time ? a.m_time > b.m_time : a.m_order > b.m_order;
+            }
+        };
+        
+        // declared before the endpoints so it outlives them
+        RUDP::EmulatedNetwork m_network;
+        RUDP::Map<RUDP::PeerKey, Endpoint> m_endpoints;
+        std::vector<Endpoint*> m_endpointList;
+        std::vector<Entry> m_queue; // min heap on time
+        std::vector<Endpoint*> m_ready;
+        std::vector<Endpoint*> m_stepping;
+        RUDP::Random m_random;
+        RUDP::SimulationCallback m_stepCallback;
+        void *m_stepContext;
+        RUDP::SimulationStats m_stats;
+        uint64_t m_now;
+        uint64_t m_nextOrder;
+        bool m_isStopped;
+        
+        Simulation(const Simulation &other);
+        Simulation &operator=(const Simulation &other);
+        
+        static uint64_t ReadClock(void *context);
+        static void OnDelivery(RUDP::EmulatedTransport *target, uint64_t due, void *context);
+        
+        void push(uint64_t time, Endpoint *endpoint, RUDP::SimulationCallback callback, void *context, bool isTimer);
+        void makeReady(Endpoint *endpoint);
+        void step(Endpoint *endpoint);
+        Endpoint *find(RUDP::Socket *socket);
+    
+    public:
+        Simulation(uint64_t seed = 1);
+        ~Simulation();
+        
+        RUDP::EmulatedNetwork *getNetwork();
+        
+        // for the scenario's own decisions, seeded apart from the network
+        RUDP::Random *getRandom();
+        
+        // a socket opened over a new emulated transport at ipv4:port, owned by the simulation.
+        // NULL when the address is taken
+        RUDP::Socket *addEndpoint(uint32_t ipv4, uint16_t port);
+        size_t getNumEndpoints();
+        RUDP::Socket *getEndpoint(size_t index);
+        
+        // called after every step of an endpoint, to poll its messages and enqueue more on it.
+        // enqueueing on other sockets from here only takes effect once those are stepped
+        void setStepCallback(RUDP::SimulationCallback callback, void *context);
+        
+        // calls callback once virtual time reaches timeUs, earlier times mean the current instant.
+        // socket, if any, is stepped right after, so pass the one the callback enqueues on
+        void schedule(uint64_t timeUs, RUDP::Socket *socket, RUDP::SimulationCallback callback, void *context);
+        
+        // us of virtual time, starts at one second so no timestamp is 0
+        uint64_t getTime();
+        
+        // handles events until us of virtual time have passed or stop is called, returns the time reached
+        uint64_t run(uint64_t us);
+        
+        // ends run once the current instant is done, for callbacks
+        void stop();
+        
+        void getStats(RUDP::SimulationStats *stats);
+    };
+}
+
+#endif
\ No newline at end of file
@@ -15,30 +15,119 @@
 #include <RUDP/list.h>
 #include <RUDP/map.h>
 #include <RUDP/peer.h>
+#include <RUDP/event.h>
+#include <RUDP/scheduler.h>
+#include <RUDP/shard.h>
+#include <RUDP/queue.h>
+#include <RUDP/counters.h>
+#include <RUDP/transport.h>
 #include <limits.h>
 #include <mutex>
+#include <vector>
+#include <atomic>
 
 namespace RUDP
 {
+    // called from updatePeers once every fragment of a reliable message has been acknowledged, or once
+    // the receiver confirmed skipping it after its deadline passed. userData is the PeerMessage's
+    // m_userData at the time it was enqueued
+    typedef void (*MessageAcknowledgedCallback)(RUDP::Peer *peer, RUDP::ChannelId channel, void *userData, bool isExpired);
+    
+    // capacity of the socket's handoff queues in batches, a batch being everything one
+    // flushToSocket or one listen call passed on
+    const size_t SocketQueueSize = 1024;
+    
+    // retransmissions per update pass while no send budget is set, the rest wait for the next pass
+    const uint32_t DefaultResendBudget = 64;
+    
+    // what an ack echoes of the reliable packet it confirms. skips and stream packets are told apart
+    // from message fragments, their ids come from other sequences
+    struct AckKey
+    {
+        RUDP::PeerKey m_peerKey;
+        RUDP::PacketId m_packetId;
+        RUDP::ChannelId m_channelId;
+        uint8_t m_kind;
+        
+        AckKey() : m_packetId(0), m_channelId(0), m_kind(0) {}
+        
+        void set(RUDP::Packet *pck);
+        
+        uint64_t hash() const
+        {
+            uint64_t id = (uint64_t)m_packetId << 16 | (uint64_t)m_channelId << 8 | m_kind;
+            return RUDP::hashMix(m_peerKey.hash() ^ 0xa0761d6478bd642fULL, id ^ 0xe7037ed1a0b428dbULL);
+        }
+        
+        bool equals(const AckKey *other) const
+        {
+            return m_packetId == other->m_packetId && m_channelId == other->m_channelId && m_kind == other->m_kind && m_peerKey.equals(&other->m_peerKey);
+        }
+    };
+    
+    struct SocketStats
+    {
+        uint64_t m_numExpiredUnsent;         // fragments dropped from the send queues
+        uint64_t m_numExpiredUnacknowledged; // fragments dropped from the retransmit set
+        uint64_t m_numSkipsSent;             // messages the receiver was told to skip
+        uint64_t m_numSkipsReceived;         // incomplete messages skipped on request of the sender
+        uint64_t m_numSequencedReplaced;     // queued sequenced fragments replaced by a newer message
+        uint64_t m_numPacketsReceived;       // every datagram read from the socket
+        uint64_t m_numDuplicatesDropped;     // message fragments that had already been received
+        uint64_t m_numShardOverflows;        // packets dropped unacknowledged because their shard was full
+    };
+    
     class Socket
     {
+        friend class Peer;
+        friend class Shard;
+        friend class UdpTransport;
+    
     private:
-        RUDP::Map<RUDP::Peer> m_peerList;
-        RUDP::List<RUDP::Packet> m_ackQueue;
-        RUDP::List<RUDP::Packet> m_outQueue;
-        RUDP::List<RUDP::Packet> m_inQueue;
-        std::mutex m_inQueueLock;
-        std::mutex m_outQueueLock;
-        std::mutex m_ackQueueLock;
+        RUDP::Map<RUDP::PeerKey, RUDP::Peer> m_peerList;
+        RUDP::List<RUDP::Packet> m_ackQueue; // sent reliable packets awaiting an ack, owned by the update thread
+        RUDP::Map<RUDP::AckKey, RUDP::Packet*> m_ackIndex; // m_ackQueue by what their acks echo
+        uint32_t m_numAckShadowed; // packets in m_ackQueue whose key an older one still holds
+        RUDP::MpscQueue<RUDP::Chain<RUDP::Packet>> m_outQueue; // filled from any thread, drained by flush
+        RUDP::SpscQueue<RUDP::Chain<RUDP::Packet>> m_inQueue;  // filled by listen, drained by updatePeers
+        RUDP::List<RUDP::Packet> m_inBacklog; // received packets that didn't fit in m_inQueue yet, owned by the update thread
+        RUDP::SendScheduler m_sendScheduler; // owned by the update thread like m_ackQueue
+        RUDP::Event m_sendEvent; // wakes the update thread when m_outQueue gets a batch
+        
+        // peers with at least one message ready, only touched by the thread calling updatePeers
+        std::vector<RUDP::Peer*> m_readyPeers;
+        std::vector<RUDP::Peer*> m_newPeers;
+        size_t m_newPeersIndex;
+        RUDP::Event m_readyEvent;
+        RUDP::MessageAcknowledgedCallback m_acknowledgedCallback;
+        std::vector<RUDP::Shard*> m_shards;
+        
+        std::atomic<uint64_t> m_numExpiredUnsent;
+        std::atomic<uint64_t> m_numExpiredUnacknowledged;
+        std::atomic<uint64_t> m_numSkipsSent;
+        std::atomic<uint64_t> m_numSkipsReceived;
+        std::atomic<uint64_t> m_numSequencedReplaced;
+        std::atomic<uint64_t> m_numPacketsReceived;
+        std::atomic<uint64_t> m_numDuplicatesDropped;
+        std::atomic<uint64_t> m_numShardOverflows;
+        RUDP::CounterSlot m_counters; // written by the update thread
         
         sockaddr_storage m_address;
-        uint64_t m_ackTimeout;
-        RUDP::SocketHandle m_handle;
+        uint64_t m_ackTimeout; // us
+        uint64_t m_now; // us, read once at the start of each step
+        uint32_t m_sendBudget;
+        RUDP::UdpTransport m_udp;
+        RUDP::Transport *m_transport; // m_udp unless the socket was opened over another transport
         uint16_t m_port;
         
-        bool acknowledge();
+        uint32_t acknowledge(uint32_t budget);
+        bool receiveAcknowledgement(RUDP::Packet *ack);
+        void trackAcknowledgement(RUDP::Packet *pck);
+        void untrackAcknowledgement(RUDP::Packet *pck);
+        void sendSkip(RUDP::Packet *expired, uint64_t now);
+        static bool IsSameMessage(RUDP::Packet *a, RUDP::Packet *b);
         bool listen(uint32_t attempts);
-        bool flush();
+        bool flush(uint32_t budget);
         
         void setAckTimeout(uint64_t ms);
         static void PrintLastSocketError(const char *context);
@@ -46,6 +135,8 @@ namespace RUDP
         bool receivePacket(RUDP::Packet *pck);
         bool sendPacket(RUDP::Packet *pck);
         
+        void addReadyPeer(RUDP::Peer *peer);
+    
     public:
         Socket();
         ~Socket();
@@ -55,16 +146,61 @@ namespace RUDP
         bool open(sockaddr_in *target);
         bool open(sockaddr_in6 *target);
         
+        // runs the socket over transport instead of a UDP socket of its own, e.g. an EmulatedTransport.
+        // the transport has to outlive the socket
+        bool open(RUDP::Transport *transport);
+        
         uint16_t getPort();
         RUDP::SocketHandle getHandle();
         sockaddr_storage *getAddress();
         
         void updatePeers();
+        size_t pollMessages(RUDP::MessageView *views, size_t maxViews);
+        RUDP::EventHandle getReadyHandle();
+        RUDP::Peer *acceptPeer();
+        void setMessageAcknowledgedCallback(RUDP::MessageAcknowledgedCallback callback);
+        
+        // pipeline mode: message fragments and skips are handed by peer to numShards worker threads that
+        // own the receive side of their peers, completed messages are then read with pollShardMessages
+        // instead of pollMessages. acks and streams still go through updatePeers. only call this while
+        // update isn't running, 0 goes back to reassembling everything in updatePeers
+        void setNumShards(uint32_t numShards);
+        size_t pollShardMessages(RUDP::ShardMessage *messages, size_t maxMessages);
+        
         RUDP::Peer *getPeer(uint32_t ipv4, uint16_t port);
         RUDP::Peer *getPeer(sockaddr_storage *addr);
+        RUDP::Peer *getPeer(RUDP::PeerKey *key, sockaddr_storage *addr);
+        
+        // false when the out queue is full, the packets then stay in the list
+        bool enqueueOutgoingPackets(RUDP::List<RUDP::Packet> *packets);
+        
+        // maximum number of packets sent per update iteration, retransmissions included. 0 means no limit
+        // for new packets, retransmissions are then held to DefaultResendBudget
+        void setSendBudget(uint32_t numPackets);
+        
+        void getStats(RUDP::SocketStats *stats);
+        
+        // safe from any thread while update runs, never holds up the update thread. per peer and
+        // per channel counters are read with Peer::getCounters
+        void getCounters(RUDP::SocketCounters *counters);
+        
+        // kernel buffer sizes in bytes, 0 leaves a buffer as it is. false when opened over another transport
+        bool setBufferSizes(int receiveSize, int sendSize);
+        
+        // linux busy polling: reads spin in the driver for up to us microseconds before sleeping.
+        // budget caps the packets handled per poll, 0 keeps the kernel's default. false elsewhere
+        bool setBusyPoll(uint32_t us, uint32_t budget, bool prefer);
+        
+        // one pass of update, true when anything was received or sent
+        bool step();
+        
+        // sleeps until a datagram arrives, a batch is flushed to the socket or ms have passed
+        void wait(uint64_t ms);
         
-        void enqueueOutgoingPackets(RUDP::List<RUDP::Packet> *packets);
-        void enqueueAcknowledgments(RUDP::List<RUDP::Packet> *packets);
+        // clock time in us at which step next has work that doesn't wait on a datagram: the last pass's
+        // time while sends are queued, else the earliest retransmission or expiry, UINT64_MAX for none.
+        // update thread only
+        uint64_t getNextEventTime();
         
         uint64_t update(uint64_t msTimeout);
     };
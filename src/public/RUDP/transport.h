@@ -0,0 +1,78 @@
+//
+//  transport.h
+//  RUDP
+//
+//  Copyright (c) 2016 Timothy Smale. All rights reserved.
+//
+
+#ifndef RUDP_transport_h
+#define RUDP_transport_h
+
+#include <RUDP/platform.h>
+#include <RUDP/event.h>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace RUDP
+{
+    // one piece of an outgoing datagram
+    struct TransportBuffer
+    {
+        const char *m_data;
+        size_t m_dataLen;
+    };
+    
+    // what a socket moves its datagrams through. Socket::open binds a UdpTransport of its own,
+    // Socket::open(transport) runs the whole protocol over anything else, like the link emulator.
+    // send is called by the update thread, receive and wait by the thread running update as well
+    class Transport
+    {
+    public:
+        virtual ~Transport() {}
+        
+        // false when the datagram couldn't be handed on. one dropped on purpose still counts as sent
+        virtual bool send(const RUDP::TransportBuffer *buffers, size_t numBuffers, const sockaddr_storage *target) = 0;
+        
+        // copies one datagram into buffer and returns its size, 0 or less when none was read
+        virtual ssize_t receive(char *buffer, size_t bufferLen, sockaddr_storage *sender) = 0;
+        
+        // sleeps until a datagram can be received, wakeup is signaled or ms have passed
+        virtual void wait(RUDP::Event *wakeup, uint64_t ms) = 0;
+        
+        // running total of datagrams that arrived but were dropped before they could be received
+        virtual uint64_t getNumDropped() = 0;
+        
+        virtual void getAddress(sockaddr_storage *address) = 0;
+    };
+    
+    class UdpTransport : public RUDP::Transport
+    {
+    private:
+        RUDP::SocketHandle m_handle;
+        sockaddr_storage m_address;
+        uint64_t m_numDropped; // only touched by the receiving thread
+        bool m_isOpen;
+        
+        UdpTransport(const UdpTransport &other);
+        UdpTransport &operator=(const UdpTransport &other);
+    
+    public:
+        UdpTransport();
+        ~UdpTransport();
+        
+        bool open(sockaddr *target, socklen_t targetSize);
+        void close();
+        
+        bool setBufferSizes(int receiveSize, int sendSize);
+        bool setBusyPoll(uint32_t us, uint32_t budget, bool prefer);
+        RUDP::SocketHandle getHandle();
+        
+        bool send(const RUDP::TransportBuffer *buffers, size_t numBuffers, const sockaddr_storage *target);
+        ssize_t receive(char *buffer, size_t bufferLen, sockaddr_storage *sender);
+        void wait(RUDP::Event *wakeup, uint64_t ms);
+        uint64_t getNumDropped();
+        void getAddress(sockaddr_storage *address);
+    };
+}
+
+#endif
\ No newline at end of file
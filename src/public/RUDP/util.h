@@ -11,6 +11,7 @@
 
 #include <mutex>
 #include <cstdarg>
+#include <stdint.h>
 
 #define RUDP_BIT_SET(a, b) (a) |= (b)
 #define RUDP_BIT_UNSET(a, b) (a) &= (~(b))
@@ -22,6 +23,99 @@
 
 namespace RUDP
 {
+    inline uint32_t popCount64(uint64_t x)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return (uint32_t)__builtin_popcountll(x);
+#else
+        x = x - ((x >> 1) & 0x5555555555555555ULL);
+        x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+        x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+        return (uint32_t)((x * 0x0101010101010101ULL) >> 56);
+#endif
+    }
+    
+    // x must not be 0
+    inline uint32_t countTrailingZeros64(uint64_t x)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return (uint32_t)__builtin_ctzll(x);
+#else
+        uint32_t n = 0;
+        if ((uint32_t)x == 0)
+        {
+            n = 32;
+            x >>= 32;
+        }
+        
+        uint32_t low = (uint32_t)x;
+        while ((low & 1) == 0)
+        {
+            low >>= 1;
+            n++;
+        }
+        
+        return n;
+#endif
+    }
+    
+    // x must not be 0
+    inline uint32_t highestBit32(uint32_t x)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return 31 - (uint32_t)__builtin_clz(x);
+#else
+        uint32_t n = 0;
+        while (x >>= 1)
+        {
+            n++;
+        }
+        
+        return n;
+#endif
+    }
+    
+    // small seeded generator (splitmix64) for emulated links and simulations, the same seed
+    // always gives the same sequence. not meant for anything that has to be unpredictable
+    class Random
+    {
+    private:
+        uint64_t m_state;
+        
+    public:
+        Random(uint64_t seed = 1) : m_state(seed) {}
+        
+        void seed(uint64_t seed)
+        {
+            m_state = seed;
+        }
+        
+        uint64_t next()
+        {
+            uint64_t z = (m_state += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            return z ^ (z >> 31);
+        }
+        
+        // uniform in [0, 1)
+        double nextDouble()
+        {
+            return (next() >> 11) * (1.0 / 9007199254740992.0);
+        }
+        
+        // uniform in [0, bound], bound included
+        uint64_t nextUpTo(uint64_t bound)
+        {
+            return bound == UINT64_MAX ? next() : next() % (bound + 1);
+        }
+        
+        bool chance(double probability)
+        {
+            return probability > 0 && nextDouble() < probability;
+        }
+    };
+    
     class Print
     {
     private:
@@ -9,7 +9,7 @@
 #include <iostream>
 #include <vector>
 #include <RUDP/RUDP.h>
-#include <thread>
+#include <RUDP/runner.h>
 
 // todo: prevent packet ID overflow (use timestamp?)
 // todo: deal with timestamp overflow
@@ -27,18 +27,7 @@ Consetetur sadipscing elitr, sed diam nonumy eirmod tempor invidunt ut labore et
 
 RUDP::Socket sck;
 
-void listenThread()
-{
-    for (size_t timeout = 0; timeout < 60; timeout++)
-    {
-        if (sck.update(500))
-        {
-            timeout = 0;
-        }
-    }
-}
-
-int main(int argc, const char * argv[])
+int main()
 {
     uint32_t serverIP = 127 << 24 | 1;
     uint16_t serverPort = 6112;
@@ -48,7 +37,10 @@ int main(int argc, const char * argv[])
         return EXIT_FAILURE;
     }
     
-    std::thread thread(listenThread);
+    RUDP::Runner runner(&sck);
+    RUDP::RunnerOptions options;
+    options.m_idlePolicy = RUDP::IdlePolicy_Block;
+    runner.start(options);
     
     RUDP::Peer *peer = sck.getPeer(serverIP, serverPort);
     if (!peer)
@@ -62,30 +54,59 @@ int main(int argc, const char * argv[])
     peer->enqueueMessage(&message, RUDP::EnqueueMessageOption_ConfirmDelivery);
     peer->flushToSocket();
     
-    std::vector<char> readBuffer;
-    for(size_t bytesRead = 1, timeout = 0; (bytesRead > 0 || timeout < 6000); timeout++ )
+    RUDP::MessageView views[16];
+    RUDP::MessageSpan spans[32];
+    size_t dataLen = strlen(dataToSend);
+    
+    for(size_t numReceived = 1, timeout = 0; (numReceived > 0 || timeout < 6000); timeout++ )
     {
         sck.updatePeers();
-        bytesRead = 0;
+        numReceived = sck.pollMessages(views, RUDP_ARRAYSIZE(views));
         
-        while(peer->peekMessage(bytesRead))
+        for (size_t v = 0; v < numReceived; v++)
         {
-            readBuffer.resize(bytesRead);
+            RUDP::MessageView &view = views[v];
+            
+            // compare in place, fragment by fragment
+            size_t numSpans = view.getSpans(spans, RUDP_ARRAYSIZE(spans));
+            size_t offset = 0;
+            int diff = view.getSize() == dataLen ? 0 : 1;
             
-            message.prepareForReceiving(readBuffer.data(), bytesRead);
-            if(peer->receiveMessage(&message))
+            for (size_t i = 0; i < numSpans && diff == 0; i++)
             {
-                RUDP::Print::f("peer received message (%d) on channel %d -> %.*s (%d)\n\n",
-                               strncmp(dataToSend, message.m_data, strlen(dataToSend)),
-                               message.m_channel,
-                               (int)message.m_dataLen,
-                               message.m_data,
-                               (int)message.m_dataLen);
+                diff = memcmp(dataToSend + offset, spans[i].m_data, spans[i].m_dataLen);
+                offset += spans[i].m_dataLen;
             }
+            
+            RUDP::Print::f("peer received message (%d) on channel %d in %d fragments (%d)\n\n",
+                           diff,
+                           view.getChannel(),
+                           (int)numSpans,
+                           (int)view.getSize());
+            
+            view.release();
         }
     }
     
-    thread.join();
+    runner.stop();
+    
+    RUDP::RunnerStats stats;
+    runner.getStats(&stats);
+    RUDP::Print::f("io thread: %llu passes, %llu idle, %llu us busy, longest pass %llu us\n",
+                   (unsigned long long)stats.m_numIterations,
+                   (unsigned long long)stats.m_numIdle,
+                   (unsigned long long)stats.m_busyTimeUs,
+                   (unsigned long long)stats.m_maxIterationUs);
+    
+    RUDP::SocketCounters counters;
+    sck.getCounters(&counters);
+    
+    for (int i = 0; i < RUDP::Counter_Count; i++)
+    {
+        RUDP::Print::f("%s: %llu\n", RUDP::Counter_ToString((RUDP::Counter)i), (unsigned long long)counters.m_traffic.get((RUDP::Counter)i));
+    }
+    
+    RUDP::Print::f("packet pool: %d/%d\n", (int)counters.m_packets.m_numUsed, (int)counters.m_packets.m_numTotal);
     
     return EXIT_SUCCESS;
 }